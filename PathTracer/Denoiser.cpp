@@ -0,0 +1,209 @@
+#include "Denoiser.h"
+
+#include <cstring>
+
+Denoiser Denoiser::New(VulkanHelper::Device device, VulkanHelper::ThreadPool* threadPool)
+{
+    Denoiser denoiser;
+    denoiser.m_Device = device;
+    denoiser.m_ThreadPool = threadPool;
+
+#ifdef USE_OIDN
+    denoiser.m_OidnDevice = oidn::newDevice(oidn::DeviceType::CPU);
+    denoiser.m_OidnDevice.commit();
+
+    const char* errorMessage;
+    if (denoiser.m_OidnDevice.getError(errorMessage) != oidn::Error::None)
+        VH_LOG_ERROR("Failed to create Open Image Denoise device: {}", errorMessage);
+#endif
+
+    return denoiser;
+}
+
+bool Denoiser::IsAvailable()
+{
+#ifdef USE_OIDN
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Denoiser::SetImages(VulkanHelper::ImageView colorImageView, VulkanHelper::ImageView albedoImageView, VulkanHelper::ImageView normalImageView)
+{
+    m_ColorImageView = colorImageView;
+    m_AlbedoImageView = albedoImageView;
+    m_NormalImageView = normalImageView;
+
+    const uint32_t width = m_ColorImageView.GetWidth();
+    const uint32_t height = m_ColorImageView.GetHeight();
+
+    VulkanHelper::Image::Config outputImageConfig{};
+    outputImageConfig.Device = m_Device;
+    outputImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
+    outputImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_DST_BIT;
+    outputImageConfig.Width = width;
+    outputImageConfig.Height = height;
+
+    VulkanHelper::Image outputImage = VulkanHelper::Image::New(outputImageConfig).Value();
+    m_OutputImageView = VulkanHelper::ImageView::New({ outputImage, VulkanHelper::ImageView::ViewType::VIEW_2D }).Value();
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(glm::vec4) * (uint64_t)width * (uint64_t)height;
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.CpuMapable = true;
+
+    bufferConfig.DebugName = "Denoiser Color Readback";
+    m_ColorReadbackBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+    bufferConfig.DebugName = "Denoiser Albedo Readback";
+    m_AlbedoReadbackBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+    bufferConfig.DebugName = "Denoiser Normal Readback";
+    m_NormalReadbackBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    bufferConfig.DebugName = "Denoiser Upload";
+    m_UploadBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.CpuMapable = false;
+    bufferConfig.DebugName = "Denoiser Passthrough";
+    m_PassthroughBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    // A denoise in flight has the old size, its result is thrown away once it's done
+    m_OutputSamples = 0;
+    m_RequestedSamples = 0;
+    if (m_State == State::READBACK)
+        m_State = State::IDLE;
+}
+
+void Denoiser::Denoise(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated, uint32_t resetCount)
+{
+    m_FrameIndex++;
+
+    // Accumulation was reset, shown result is from the old image. Sample counts can't tell that on their own,
+    // the new image can reach the old sample count before a denoise of the old one finishes
+    if (resetCount != m_ResetCount)
+    {
+        m_ResetCount = resetCount;
+        m_OutputSamples = 0;
+        m_RequestedSamples = 0;
+
+        // Copy in flight is of the old image, it's done by the time the next readback is started
+        if (m_State == State::READBACK)
+            m_State = State::IDLE;
+    }
+
+    if (m_State == State::READBACK && m_FrameIndex - m_ReadbackFrame >= READBACK_DELAY)
+    {
+        StartJob();
+    }
+    else if (m_State == State::DENOISING && m_Task.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        m_State = State::IDLE;
+
+        if (!m_Job->Error.empty())
+            VH_LOG_WARN("Denoising failed: {}", m_Job->Error);
+        else if (m_Job->ResetCount == m_ResetCount && m_Job->Width == m_OutputImageView.GetWidth() && m_Job->Height == m_OutputImageView.GetHeight())
+            UploadResult(commandBuffer);
+    }
+
+    if (m_State == State::IDLE && IsAvailable() && samplesAccumulated > 0 && samplesAccumulated != m_RequestedSamples)
+        RequestReadback(commandBuffer, samplesAccumulated);
+
+    if (m_OutputSamples == 0)
+        CopyInputToOutput(commandBuffer);
+}
+
+void Denoiser::RequestReadback(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated)
+{
+    m_ColorImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+    m_AlbedoImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+    m_NormalImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+
+    VH_ASSERT(m_ColorReadbackBuffer.CopyFromImage(commandBuffer, m_ColorImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy color image to denoiser readback buffer");
+    VH_ASSERT(m_AlbedoReadbackBuffer.CopyFromImage(commandBuffer, m_AlbedoImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy albedo image to denoiser readback buffer");
+    VH_ASSERT(m_NormalReadbackBuffer.CopyFromImage(commandBuffer, m_NormalImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy normal image to denoiser readback buffer");
+
+    m_RequestedSamples = samplesAccumulated;
+    m_ReadbackFrame = m_FrameIndex;
+    m_State = State::READBACK;
+}
+
+void Denoiser::StartJob()
+{
+    auto job = std::make_shared<Job>();
+    job->Width = m_ColorImageView.GetWidth();
+    job->Height = m_ColorImageView.GetHeight();
+    job->Samples = m_RequestedSamples;
+    job->ResetCount = m_ResetCount;
+#ifdef USE_OIDN
+    job->Device = m_OidnDevice;
+#endif
+
+    // Copied out of the mapped memory so that the buffers can be reused while the filter runs
+    const size_t pixelCount = (size_t)job->Width * (size_t)job->Height;
+    auto readBack = [pixelCount](VulkanHelper::Buffer& buffer, std::vector<glm::vec4>& data)
+    {
+        data.resize(pixelCount);
+        std::memcpy(data.data(), buffer.Map().Value(), pixelCount * sizeof(glm::vec4));
+        buffer.Unmap();
+    };
+
+    readBack(m_ColorReadbackBuffer, job->Color);
+    readBack(m_AlbedoReadbackBuffer, job->Albedo);
+    readBack(m_NormalReadbackBuffer, job->Normal);
+    job->Output = job->Color; // Filter writes only RGB, alpha stays the same
+
+    m_Job = job;
+    m_Task = m_ThreadPool->PushTask([job]() {
+        Execute(*job);
+    });
+    m_State = State::DENOISING;
+}
+
+void Denoiser::UploadResult(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    // Previous upload is long done, a denoise takes at least the readback delay
+    VH_ASSERT(m_UploadBuffer.UploadData(m_Job->Output.data(), m_Job->Output.size() * sizeof(glm::vec4), 0) == VulkanHelper::VHResult::OK, "Failed to upload denoised image");
+
+    m_OutputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_DST_OPTIMAL, commandBuffer);
+    VH_ASSERT(m_UploadBuffer.CopyToImage(commandBuffer, m_OutputImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy denoised image");
+
+    m_OutputSamples = m_Job->Samples;
+}
+
+void Denoiser::CopyInputToOutput(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    m_ColorImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+    VH_ASSERT(m_PassthroughBuffer.CopyFromImage(commandBuffer, m_ColorImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy color image to denoiser passthrough buffer");
+
+    m_PassthroughBuffer.Barrier(commandBuffer, VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT, VulkanHelper::AccessFlags::TRANSFER_READ_BIT, VulkanHelper::PipelineStages::TRANSFER_BIT, VulkanHelper::PipelineStages::TRANSFER_BIT);
+
+    m_OutputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_DST_OPTIMAL, commandBuffer);
+    VH_ASSERT(m_PassthroughBuffer.CopyToImage(commandBuffer, m_OutputImageView.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy color image to denoiser output");
+}
+
+void Denoiser::Execute(Job& job)
+{
+#ifdef USE_OIDN
+    const size_t pixelStride = sizeof(glm::vec4);
+    const size_t rowStride = pixelStride * job.Width;
+
+    // Albedo and normal are averaged over the same samples as the color, so they're noisy too and the filter has to denoise them as well
+    oidn::FilterRef filter = job.Device.newFilter("RT");
+    filter.setImage("color", job.Color.data(), oidn::Format::Float3, job.Width, job.Height, 0, pixelStride, rowStride);
+    filter.setImage("albedo", job.Albedo.data(), oidn::Format::Float3, job.Width, job.Height, 0, pixelStride, rowStride);
+    filter.setImage("normal", job.Normal.data(), oidn::Format::Float3, job.Width, job.Height, 0, pixelStride, rowStride);
+    filter.setImage("output", job.Output.data(), oidn::Format::Float3, job.Width, job.Height, 0, pixelStride, rowStride);
+    filter.set("hdr", true);
+    filter.commit();
+    filter.execute();
+
+    const char* errorMessage;
+    if (job.Device.getError(errorMessage) != oidn::Error::None)
+        job.Error = errorMessage;
+#else
+    (void)job;
+#endif
+}
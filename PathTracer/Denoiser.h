@@ -0,0 +1,99 @@
+#pragma once
+
+#include "VulkanHelper.h"
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_OIDN
+#include <OpenImageDenoise/oidn.hpp>
+#endif
+
+// Denoises the accumulated image with Intel Open Image Denoise on the CPU, guided by the albedo and normal AOVs.
+// Nothing here waits for the GPU or for the CPU filter. Images are read back a few frames after the copy is recorded,
+// the filter runs on the thread pool and its result is uploaded in whichever frame it finishes.
+// Without USE_OIDN the output just mirrors the noisy input.
+class Denoiser
+{
+public:
+    Denoiser() = default;
+
+    [[nodiscard]] static Denoiser New(VulkanHelper::Device device, VulkanHelper::ThreadPool* threadPool);
+
+    // False when built without Open Image Denoise
+    [[nodiscard]] static bool IsAvailable();
+
+    // Images have to be R32G32B32A32_SFLOAT and support transfer src
+    void SetImages(VulkanHelper::ImageView colorImageView, VulkanHelper::ImageView albedoImageView, VulkanHelper::ImageView normalImageView);
+
+    // Starts a new denoise once the previous one is done and uploads finished results. Results of denoises started
+    // before the accumulation was reset (reset count changed) are thrown away, the noisy image is shown until a new one finishes
+    void Denoise(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated, uint32_t resetCount);
+
+    [[nodiscard]] inline VulkanHelper::ImageView GetOutputImageView() const { return m_OutputImageView; }
+    [[nodiscard]] inline uint32_t GetDenoisedSampleCount() const { return m_OutputSamples; }
+
+private:
+    struct Job
+    {
+        std::vector<glm::vec4> Color;
+        std::vector<glm::vec4> Albedo;
+        std::vector<glm::vec4> Normal;
+        std::vector<glm::vec4> Output;
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        uint32_t Samples = 0;
+        uint32_t ResetCount = 0; // Of the image it was read back from
+        std::string Error;
+
+#ifdef USE_OIDN
+        oidn::DeviceRef Device;
+#endif
+    };
+
+    enum class State
+    {
+        IDLE,
+        READBACK,
+        DENOISING
+    };
+
+    void RequestReadback(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated);
+    void StartJob();
+    void UploadResult(VulkanHelper::CommandBuffer& commandBuffer);
+    void CopyInputToOutput(VulkanHelper::CommandBuffer& commandBuffer);
+
+    // Runs on the thread pool
+    static void Execute(Job& job);
+
+    constexpr static uint64_t READBACK_DELAY = 4; // In frames, so that the copy is read after the GPU is done with it
+
+    VulkanHelper::Device m_Device;
+    VulkanHelper::ThreadPool* m_ThreadPool = nullptr;
+
+#ifdef USE_OIDN
+    oidn::DeviceRef m_OidnDevice;
+#endif
+
+    VulkanHelper::ImageView m_ColorImageView;
+    VulkanHelper::ImageView m_AlbedoImageView;
+    VulkanHelper::ImageView m_NormalImageView;
+    VulkanHelper::ImageView m_OutputImageView;
+
+    VulkanHelper::Buffer m_ColorReadbackBuffer;
+    VulkanHelper::Buffer m_AlbedoReadbackBuffer;
+    VulkanHelper::Buffer m_NormalReadbackBuffer;
+    VulkanHelper::Buffer m_UploadBuffer;
+    VulkanHelper::Buffer m_PassthroughBuffer; // Noisy image goes through it when there's no valid result
+
+    State m_State = State::IDLE;
+    uint64_t m_FrameIndex = 0;
+    uint64_t m_ReadbackFrame = 0;
+    uint32_t m_RequestedSamples = 0; // Sample count of the last denoise started, so that the same image isn't denoised twice
+    uint32_t m_OutputSamples = 0; // Sample count of the shown result, 0 if the noisy image is shown
+    uint32_t m_ResetCount = 0; // Of the current image, jobs of older ones are dropped
+    std::shared_ptr<Job> m_Job;
+    std::future<void> m_Task;
+};
@@ -1,6 +1,7 @@
 #include "imgui.h"
 #define NOMINMAX
 #include "Editor.h"
+#include "ExrWriter.h"
 
 #include <portable-file-dialogs.h>
 #include <memory>
@@ -34,8 +35,8 @@ void Editor::Initialize(VulkanHelper::Device device, VulkanHelper::Renderer rend
     samplerConfig.MipmapMode = VulkanHelper::Sampler::MipmapMode::LINEAR;
     m_ImGuiSampler = VulkanHelper::Sampler::New(samplerConfig).Value();
 
-    m_PostProcessor = PostProcessor::New(device);
-    m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView());
+    m_PostProcessor = PostProcessor::New(device, &m_ThreadPool);
+    m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView(), m_PathTracer.GetAlbedoImageView(), m_PathTracer.GetNormalImageView());
 
     PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
         m_PostProcessor.SetTonemappingData({}, commandBuffer);
@@ -88,6 +89,39 @@ void Editor::Draw(VulkanHelper::CommandBuffer commandBuffer)
     }
     m_DeferredTasks.clear();
 
+    if (m_RenderingSequence)
+    {
+        if (m_PathTracer.GetSamplesAccumulated() >= m_PathTracer.GetMaxSamplesAccumulated())
+        {
+            char frameNumber[16];
+            snprintf(frameNumber, sizeof(frameNumber), "%04u", m_SequenceFrameIndex);
+            SaveToFile("../../RenderedImages/" + m_SequenceOutputName + "_" + frameNumber + (m_ExportSettings.SaveAsExr ? ".exr" : ".png"), commandBuffer);
+
+            // Next frame has been converting on the thread pool the whole time this one was rendering. Frames that fail
+            // to load are skipped, otherwise the previous image would be saved again under their name
+            m_SequenceFrameIndex++;
+            while (m_SequenceFrameIndex < m_SequenceFrameCount && !m_PathTracer.StepVolumeSequences(commandBuffer))
+            {
+                VH_LOG_ERROR("Failed to load volume sequence frame {}, skipping it", m_SequenceFrameIndex);
+                m_SequenceFrameIndex++;
+            }
+
+            if (m_SequenceFrameIndex >= m_SequenceFrameCount)
+            {
+                m_RenderingSequence = false;
+            }
+            else
+            {
+                m_PathTracer.ResetPathTracing();
+                m_RenderTime = 0.0f;
+            }
+        }
+    }
+    else
+    {
+        m_PathTracer.UpdateVolumeSequences(commandBuffer);
+    }
+
 
     /// Hack the animation together
 
@@ -113,6 +147,9 @@ void Editor::Draw(VulkanHelper::CommandBuffer commandBuffer)
 
     ///
 
+    // Nothing is shown while the window is minimized, so the scheduler can go for throughput instead of responsiveness
+    m_PathTracer.SetSchedulerThroughputMode(m_Renderer.GetSwapchainImageWidth() == 0 || m_Renderer.GetSwapchainImageHeight() == 0);
+
     bool allSamplesAccumulated = m_PathTracer.PathTrace(commandBuffer);
     if (!allSamplesAccumulated)
     {
@@ -126,7 +163,7 @@ void Editor::Draw(VulkanHelper::CommandBuffer commandBuffer)
         return;
     }
 
-    m_PostProcessor.PostProcess(commandBuffer);
+    m_PostProcessor.PostProcess(commandBuffer, m_PathTracer.GetSamplesAccumulated(), m_PathTracer.GetResetCount());
 
     // Transition output image to shader read-only optimal layout for imgui rendering
     m_PostProcessor.GetOutputImageView().GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
@@ -283,7 +320,7 @@ void Editor::RenderCameraSettings()
 void Editor::ResizeImage(uint32_t width, uint32_t height)
 {
     m_PathTracer.ResizeImage(width, height);
-    m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView());
+    m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView(), m_PathTracer.GetAlbedoImageView(), m_PathTracer.GetNormalImageView());
     m_CurrentImGuiDescriptorIndex = VulkanHelper::Renderer::CreateImGuiDescriptorSet(m_PostProcessor.GetOutputImageView(), m_ImGuiSampler, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL);
     
     // Update camera aspect ratio when image is resized
@@ -356,6 +393,24 @@ void Editor::RenderPostProcessingSettings()
     if (!ImGui::CollapsingHeader("Post Processing Settings"))
         return;
 
+    static bool denoiserEnabled = m_PostProcessor.IsDenoiserEnabled();
+    ImGui::BeginDisabled(!Denoiser::IsAvailable());
+    if (ImGui::Checkbox("Denoise", &denoiserEnabled))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PostProcessor.SetDenoiserEnabled(denoiserEnabled);
+            UpdateAOVs(commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+
+    if (!Denoiser::IsAvailable())
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(built without Open Image Denoise)");
+    }
+
     static float exposure = 1.0f;
     static float gamma = 2.2f;
 
@@ -373,6 +428,16 @@ void Editor::RenderPostProcessingSettings()
         });
     }
 
+    const char* workingFormats[] = { "RGBA16 Float", "B10G11R11 Float", "RGBA32 Float" };
+    static int workingFormat = (int)m_PostProcessor.GetWorkingFormat();
+    if (ImGui::Combo("Bloom Format", &workingFormat, workingFormats, IM_ARRAYSIZE(workingFormats)))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer, std::shared_ptr<void>) {
+            m_PostProcessor.SetWorkingFormat((PostProcessor::WorkingFormat)workingFormat);
+            workingFormat = (int)m_PostProcessor.GetWorkingFormat(); // Falls back to RGBA16 if unsupported, stays the same if the shaders fail to compile
+        });
+    }
+
     static float bloomThreshold = 2.0f;
     static float bloomStrength = 1.0f;
     static int bloomMipCount = 10;
@@ -422,6 +487,18 @@ void Editor::RenderInfo()
     uint32_t samplesAccumulated = glm::min(m_PathTracer.GetSamplesAccumulated(), m_PathTracer.GetMaxSamplesAccumulated());
     ImGui::Text("Estimated Time: %.3f s", m_RenderTime * (float)(m_PathTracer.GetMaxSamplesAccumulated() - samplesAccumulated) / (float)samplesAccumulated);
 
+    if (m_PathTracer.IsAdaptiveSamplingEnabled())
+        ImGui::Text("Active Tiles: %u / %u", m_PathTracer.GetActiveTileCount(), m_PathTracer.GetConvergenceTileCount());
+
+    if (m_PathTracer.IsAutomaticSchedulingEnabled())
+        ImGui::Text("Dispatch Time: %.2f ms (%u chunks, %u samples)", m_PathTracer.GetAverageDispatchTime(), m_PathTracer.GetSplitScreenCount(), m_PathTracer.GetSamplesPerFrame());
+
+    if (m_PathTracer.IsPreviewActive())
+        ImGui::Text("Preview: 1/%u Resolution", m_PathTracer.GetPreviewScale());
+
+    if (m_PostProcessor.IsDenoiserEnabled())
+        ImGui::Text("Denoised Samples: %u", m_PostProcessor.GetDenoisedSampleCount());
+
     ImGui::Text("Total Vertex Count: %u", (uint32_t)m_PathTracer.GetTotalVertexCount());
     ImGui::Text("Total Index Count: %u", (uint32_t)m_PathTracer.GetTotalIndexCount());
 
@@ -453,7 +530,7 @@ void Editor::RenderInfo()
             PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer, std::shared_ptr<void>) {
                 m_PathTracer.SetScene(m_CurrentSceneFilepath);
                 m_RenderTime = 0.0f;
-                m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView());
+                m_PostProcessor.SetInputImage(m_PathTracer.GetOutputImageView(), m_PathTracer.GetAlbedoImageView(), m_PathTracer.GetNormalImageView());
                 m_CurrentImGuiDescriptorIndex = VulkanHelper::Renderer::CreateImGuiDescriptorSet(m_PostProcessor.GetOutputImageView(), m_ImGuiSampler, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL);
                 m_InitialViewMatrix = glm::inverse(m_PathTracer.GetCameraViewInverse());
                 m_InitialProjectionMatrix = glm::inverse(m_PathTracer.GetCameraProjectionInverse());
@@ -474,7 +551,72 @@ void Editor::RenderPathTracingSettings()
         m_PathTracer.SetMaxSamplesAccumulated((uint32_t)maxSamples);
     }
 
+    static bool adaptiveSampling = m_PathTracer.IsAdaptiveSamplingEnabled();
+    if (ImGui::Checkbox("Adaptive Sampling", &adaptiveSampling))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetAdaptiveSampling(adaptiveSampling, commandBuffer);
+            adaptiveSampling = m_PathTracer.IsAdaptiveSamplingEnabled(); // Turns off if the convergence shader fails to compile
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    ImGui::BeginDisabled(!adaptiveSampling);
+    static float adaptiveErrorThreshold = m_PathTracer.GetAdaptiveErrorThreshold();
+    if (ImGui::SliderFloat("Adaptive Error Threshold", &adaptiveErrorThreshold, 0.001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetAdaptiveErrorThreshold(adaptiveErrorThreshold, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static int adaptiveMinSamples = (int)m_PathTracer.GetAdaptiveMinSamples();
+    if (ImGui::DragInt("Adaptive Min Samples", &adaptiveMinSamples, 1, 2, INT32_MAX, "%d", ImGuiSliderFlags_AlwaysClamp))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetAdaptiveMinSamples((uint32_t)adaptiveMinSamples, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+
+    static bool automaticScheduling = m_PathTracer.IsAutomaticSchedulingEnabled();
+    if (ImGui::Checkbox("Automatic Scheduling", &automaticScheduling))
+    {
+        m_PathTracer.SetAutomaticScheduling(automaticScheduling);
+    }
+
+    ImGui::BeginDisabled(!automaticScheduling);
+    static float targetDispatchTime = m_PathTracer.GetTargetDispatchTime();
+    if (ImGui::SliderFloat("Target Frame Time (ms)", &targetDispatchTime, 4.0f, 100.0f, "%.1f"))
+    {
+        m_PathTracer.SetTargetDispatchTime(targetDispatchTime);
+    }
+    ImGui::EndDisabled();
+
+    static int previewScale = m_PathTracer.GetPreviewScale() >= 4 ? 2 : (m_PathTracer.GetPreviewScale() >= 2 ? 1 : 0);
+    const char* previewScales[] = { "Off", "1/2 Resolution", "1/4 Resolution" };
+    if (ImGui::Combo("Interactive Preview", &previewScale, previewScales, IM_ARRAYSIZE(previewScales)))
+    {
+        m_PathTracer.SetPreviewScale(1u << previewScale);
+    }
+
+    // Wavefront integrator can't continue per pixel histories, camera changes restart the accumulation there
+    static bool temporalReprojection = m_PathTracer.IsTemporalReprojectionEnabled();
+    if (ImGui::Checkbox("Temporal Reprojection", &temporalReprojection))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetTemporalReprojection(temporalReprojection, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    // Scheduler picks samples per frame and split screen count on its own
+    ImGui::BeginDisabled(automaticScheduling);
     static int samplesPerFrame = (int)m_PathTracer.GetSamplesPerFrame();
+    if (automaticScheduling)
+        samplesPerFrame = (int)m_PathTracer.GetSamplesPerFrame();
     if (ImGui::SliderInt("Samples Per Frame", &samplesPerFrame, 1, 100, "%d"))
     {
         PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
@@ -482,6 +624,7 @@ void Editor::RenderPathTracingSettings()
             m_RenderTime = 0.0f;
         });
     }
+    ImGui::EndDisabled();
 
     static int maxDepth = (int)m_PathTracer.GetMaxDepth();
     if (ImGui::SliderInt("Max Depth", &maxDepth, 1, 40, "%d"))
@@ -546,8 +689,117 @@ void Editor::RenderPathTracingSettings()
             m_RenderTime = 0.0f;
         });
     }
+
+    static bool lightTree = m_PathTracer.IsLightTreeEnabled();
+    if (ImGui::Checkbox("Light Tree", &lightTree))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetLightTree(lightTree, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
     ImGui::EndDisabled();
 
+    // Resampling picks from the same lights as the MIS, so it needs at least one of them
+    ImGui::BeginDisabled(!enableSkyMIS && !enableMeshMIS);
+    static bool restir = m_PathTracer.IsReSTIREnabled();
+    if (ImGui::Checkbox("ReSTIR Direct Light", &restir))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIR(restir, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    ImGui::BeginDisabled(!restir);
+    static bool restirUnbiased = m_PathTracer.IsReSTIRUnbiased();
+    if (ImGui::Checkbox("ReSTIR Unbiased", &restirUnbiased))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIRUnbiased(restirUnbiased, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static int restirCandidateCount = (int)m_PathTracer.GetReSTIRCandidateCount();
+    if (ImGui::SliderInt("ReSTIR Candidates", &restirCandidateCount, 1, 64, "%d"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIRCandidateCount((uint32_t)restirCandidateCount, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static int restirSpatialSampleCount = (int)m_PathTracer.GetReSTIRSpatialSampleCount();
+    if (ImGui::SliderInt("ReSTIR Spatial Samples", &restirSpatialSampleCount, 0, 8, "%d"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIRSpatialSampleCount((uint32_t)restirSpatialSampleCount, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static float restirSpatialRadius = m_PathTracer.GetReSTIRSpatialRadius();
+    if (ImGui::SliderFloat("ReSTIR Spatial Radius", &restirSpatialRadius, 1.0f, 64.0f, "%.1f"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIRSpatialRadius(restirSpatialRadius, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static float restirHistoryLimit = m_PathTracer.GetReSTIRHistoryLimit();
+    if (ImGui::SliderFloat("ReSTIR History Limit", &restirHistoryLimit, 1.0f, 50.0f, "%.1f"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetReSTIRHistoryLimit(restirHistoryLimit, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+    ImGui::EndDisabled();
+
+    // Only the megakernel integrator guides its paths
+    static bool pathGuiding = m_PathTracer.IsPathGuidingEnabled();
+    if (ImGui::Checkbox("Path Guiding", &pathGuiding))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetPathGuiding(pathGuiding, commandBuffer);
+            pathGuiding = m_PathTracer.IsPathGuidingEnabled(); // Turns off if the guiding update shader fails to compile
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    ImGui::BeginDisabled(!pathGuiding);
+    static int guidingTrainingFrames = (int)m_PathTracer.GetGuidingTrainingFrames();
+    if (ImGui::SliderInt("Guiding Training Frames", &guidingTrainingFrames, 1, 256, "%d"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetGuidingTrainingFrames((uint32_t)guidingTrainingFrames);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static float guidingSelectionProbability = m_PathTracer.GetGuidingSelectionProbability();
+    if (ImGui::SliderFloat("Guiding Probability", &guidingSelectionProbability, 0.0f, 0.95f, "%.2f"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetGuidingSelectionProbability(guidingSelectionProbability, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+
+    const char* samplerTypes[] = { "PCG", "Sobol" };
+    static int samplerType = (int)m_PathTracer.GetSamplerType();
+    if (ImGui::Combo("Sampler", &samplerType, samplerTypes, IM_ARRAYSIZE(samplerTypes)))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetSamplerType((PathTracer::SamplerType)samplerType, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
     static bool areRayQueriesSupported = m_Device.AreRayQueriesSupported();
 
     ImGui::BeginDisabled(!areRayQueriesSupported);
@@ -561,6 +813,32 @@ void Editor::RenderPathTracingSettings()
     }
     ImGui::EndDisabled();
 
+    // Inline ray query is the last one so it can be left out when ray queries aren't supported
+    const char* integrators[] = { "Megakernel", "Wavefront", "Inline Ray Query" };
+    static int selectedIntegrator = (int)m_PathTracer.GetIntegrator();
+    if (ImGui::Combo("Integrator", &selectedIntegrator, integrators, IM_ARRAYSIZE(integrators) - (areRayQueriesSupported ? 0 : 1)))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetIntegrator((PathTracer::Integrator)selectedIntegrator, commandBuffer);
+            selectedIntegrator = (int)m_PathTracer.GetIntegrator(); // Falls back to the megakernel if the shaders fail to compile
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    ImGui::BeginDisabled(selectedIntegrator != (int)PathTracer::Integrator::WAVEFRONT);
+    static int wavefrontPathPoolSize = (int)m_PathTracer.GetWavefrontPathPoolSize();
+    ImGui::DragInt("Wavefront Path Pool Size", &wavefrontPathPoolSize, 1024.0f, 64, 4 * 1024 * 1024, "%d", ImGuiSliderFlags_AlwaysClamp);
+
+    // Buffers are recreated on every change, so it's applied only once the drag is released
+    if (ImGui::IsItemDeactivatedAfterEdit())
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetWavefrontPathPoolSize((uint32_t)wavefrontPathPoolSize, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+
     static bool showEnvMapDirectly = m_PathTracer.IsEnvMapShownDirectly();
     if (ImGui::Checkbox("Show Environment Map Directly", &showEnvMapDirectly))
     {
@@ -597,14 +875,18 @@ void Editor::RenderPathTracingSettings()
         });
     }
 
+    ImGui::BeginDisabled(automaticScheduling);
     static int splitScreenCount = (int)m_PathTracer.GetSplitScreenCount();
-    if (ImGui::SliderInt("Split Screen Count", &splitScreenCount, 1, 4, "%d"))
+    if (automaticScheduling)
+        splitScreenCount = (int)m_PathTracer.GetSplitScreenCount();
+    if (ImGui::SliderInt("Split Screen Count", &splitScreenCount, 1, (int)PathTracer::MAX_SPLIT_SCREEN_COUNT, "%d"))
     {
         PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
             m_PathTracer.SetSplitScreenCount((uint32_t)splitScreenCount, commandBuffer);
             m_RenderTime = 0.0f;
         });
     }
+    ImGui::EndDisabled();
 }
 
 void Editor::RenderSkySettings()
@@ -668,6 +950,16 @@ void Editor::RenderSkySettings()
 
     ImGui::BeginDisabled(!isAtmosphereEnabled);
 
+    // Baked from LUTs into the environment map, for previews where the path traced atmosphere is too slow
+    static bool approximateSky = m_PathTracer.IsApproximateSkyEnabled();
+    if (ImGui::Checkbox("Approximate Sky", &approximateSky))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetApproximateSky(approximateSky, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
     static glm::vec3 sunColor = m_PathTracer.GetSunColor();
     if (ImGui::ColorEdit3("Sun Color", &sunColor.x, ImGuiColorEditFlags_Float))
     {
@@ -767,6 +1059,39 @@ void Editor::RenderSkySettings()
         });
     }
 
+    static bool atmosphereTransmittanceLUT = m_PathTracer.UseAtmosphereTransmittanceLUT();
+    if (ImGui::Checkbox("Atmosphere Transmittance LUT", &atmosphereTransmittanceLUT))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetUseAtmosphereTransmittanceLUT(atmosphereTransmittanceLUT, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    // Estimators are only used when the transmittance isn't read from the LUT
+    ImGui::BeginDisabled(atmosphereTransmittanceLUT);
+    const char* transmittanceEstimators[] = { "Delta Tracking", "Ratio Tracking", "Residual Ratio Tracking" };
+    static int atmosphereEstimator = (int)m_PathTracer.GetAtmosphereTransmittanceEstimator();
+    if (ImGui::Combo("Atmosphere Transmittance", &atmosphereEstimator, transmittanceEstimators, IM_ARRAYSIZE(transmittanceEstimators)))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetAtmosphereTransmittanceEstimator((PathTracer::TransmittanceEstimator)atmosphereEstimator, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+
+    static float atmosphereControlFraction = m_PathTracer.GetAtmosphereResidualControlFraction();
+    ImGui::BeginDisabled(atmosphereEstimator != (int)PathTracer::TransmittanceEstimator::RESIDUAL_RATIO_TRACKING);
+    if (ImGui::SliderFloat("Atmosphere Control Fraction", &atmosphereControlFraction, 0.0f, 1.0f, "%.2f"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetAtmosphereResidualControlFraction(atmosphereControlFraction, commandBuffer);
+            m_RenderTime = 0.0f;
+        });
+    }
+    ImGui::EndDisabled();
+    ImGui::EndDisabled();
+
     ImGui::EndDisabled();
 }
 
@@ -778,6 +1103,40 @@ void Editor::SaveToFileSettings()
     static char fileName[256] = "output";
     ImGui::InputText("File Name", fileName, sizeof(fileName));
 
+    const char* formats[] = { "PNG", "EXR" };
+    int format = m_ExportSettings.SaveAsExr ? 1 : 0;
+    if (ImGui::Combo("Format", &format, formats, IM_ARRAYSIZE(formats)))
+    {
+        m_ExportSettings.SaveAsExr = format == 1;
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            UpdateAOVs(commandBuffer);
+        });
+    }
+
+    if (m_ExportSettings.SaveAsExr)
+    {
+        ImGui::Checkbox("Half Float", &m_ExportSettings.HalfFloat);
+
+        // Path tracer starts writing the AOVs once any of these is checked, which resets the accumulation
+        bool aovLayersChanged = false;
+        aovLayersChanged |= ImGui::Checkbox("Albedo Layer", &m_ExportSettings.Albedo);
+        aovLayersChanged |= ImGui::Checkbox("Normal Layer", &m_ExportSettings.Normal);
+        aovLayersChanged |= ImGui::Checkbox("Depth Layer", &m_ExportSettings.Depth);
+        if (aovLayersChanged)
+        {
+            PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+                UpdateAOVs(commandBuffer);
+            });
+        }
+
+        ImGui::Checkbox("Sample Count Layer", &m_ExportSettings.SampleCount);
+
+        // Variance comes from the moments that only adaptive sampling tracks, and not with the wavefront integrator
+        ImGui::BeginDisabled(!m_PathTracer.AreSampleMomentsTracked());
+        ImGui::Checkbox("Variance Layer", &m_ExportSettings.Variance);
+        ImGui::EndDisabled();
+    }
+
     static char savedFilename[256] = "output";
 
     static bool imageSaved = false;
@@ -792,13 +1151,14 @@ void Editor::SaveToFileSettings()
             std::filesystem::create_directories("../../RenderedImages");
         }
 
-        filePath = "../../RenderedImages/" + std::string(fileName) + "_" + std::to_string(m_PathTracer.GetSamplesAccumulated()) + "spp_" + std::to_string((int)m_RenderTime) + "s.png";
+        const std::string extension = m_ExportSettings.SaveAsExr ? ".exr" : ".png";
+        filePath = "../../RenderedImages/" + std::string(fileName) + "_" + std::to_string(m_PathTracer.GetSamplesAccumulated()) + "spp_" + std::to_string((int)m_RenderTime) + "s" + extension;
         while(true)
         {
             if (!std::filesystem::exists(filePath))
                 break;
 
-            filePath = "../../RenderedImages/" + std::string(fileName) + "_" + std::to_string(m_PathTracer.GetSamplesAccumulated()) + "spp_" + std::to_string((int)m_RenderTime) + "s_" + std::to_string(counter++) + ".png";
+            filePath = "../../RenderedImages/" + std::string(fileName) + "_" + std::to_string(m_PathTracer.GetSamplesAccumulated()) + "spp_" + std::to_string((int)m_RenderTime) + "s_" + std::to_string(counter++) + extension;
         }
 
         PushDeferredTask(std::make_shared<std::string>(filePath), [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void> data) {
@@ -810,10 +1170,47 @@ void Editor::SaveToFileSettings()
 
     if (imageSaved)
         ImGui::Text("File saved to: RenderedImages/%s", savedFilename);
+
+    uint32_t sequenceLength = m_PathTracer.GetLongestVolumeSequenceLength();
+    ImGui::BeginDisabled(sequenceLength == 0);
+    if (!m_RenderingSequence)
+    {
+        if (ImGui::Button("Render Volume Sequence"))
+        {
+            if (!std::filesystem::exists("../../RenderedImages"))
+            {
+                std::filesystem::create_directories("../../RenderedImages");
+            }
+
+            m_SequenceOutputName = fileName;
+            PushDeferredTask(nullptr, [this, sequenceLength](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+                m_PathTracer.RewindVolumeSequences(commandBuffer);
+                m_PathTracer.ResetPathTracing();
+                m_SequenceFrameIndex = 0;
+                m_SequenceFrameCount = sequenceLength;
+                m_RenderingSequence = true;
+                m_RenderTime = 0.0f;
+            });
+        }
+    }
+    else
+    {
+        if (ImGui::Button("Stop Rendering Sequence"))
+            m_RenderingSequence = false;
+
+        ImGui::Text("Rendering sequence frame %u / %u", m_SequenceFrameIndex + 1, m_SequenceFrameCount);
+    }
+    ImGui::EndDisabled();
 }
 
 void Editor::SaveToFile(const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer)
 {
+    if (std::filesystem::path(filepath).extension() == ".exr")
+    {
+        SaveToExr(filepath, commandBuffer);
+        return;
+    }
+
     VulkanHelper::Image postProcessorImage = m_PostProcessor.GetOutputImageView().GetImage();
     VulkanHelper::Buffer::Config bufferConfig{};
     bufferConfig.Device = m_Device;
@@ -842,6 +1239,158 @@ void Editor::SaveToFile(const std::string& filepath, VulkanHelper::CommandBuffer
     buffer.Unmap();
 }
 
+void Editor::SaveToExr(const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer)
+{
+    VulkanHelper::Image colorImage = m_PathTracer.GetOutputImageView().GetImage();
+    const uint32_t width = colorImage.GetWidth();
+    const uint32_t height = colorImage.GetHeight();
+    const uint64_t pixelCount = (uint64_t)width * (uint64_t)height;
+
+    // AOV images are only up to date while the path tracer writes them, the moments only with adaptive sampling
+    const bool saveAlbedo = m_ExportSettings.Albedo && m_PathTracer.AreAOVsEnabled();
+    const bool saveNormal = m_ExportSettings.Normal && m_PathTracer.AreAOVsEnabled();
+    const bool saveDepth = m_ExportSettings.Depth && m_PathTracer.AreAOVsEnabled();
+    const bool saveVariance = m_ExportSettings.Variance && m_PathTracer.AreSampleMomentsTracked();
+    const bool readMoments = (m_ExportSettings.SampleCount || saveVariance) && m_PathTracer.AreSampleMomentsTracked();
+
+    auto createReadbackBuffer = [&](uint64_t size)
+    {
+        VulkanHelper::Buffer::Config bufferConfig{};
+        bufferConfig.Device = m_Device;
+        bufferConfig.Size = size;
+        bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+        bufferConfig.CpuMapable = true;
+        bufferConfig.DebugName = "Save to EXR Buffer";
+        return VulkanHelper::Buffer::New(bufferConfig).Value();
+    };
+
+    auto readBackImage = [&](VulkanHelper::Image image)
+    {
+        VulkanHelper::Buffer buffer = createReadbackBuffer(sizeof(glm::vec4) * pixelCount);
+        image.TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+        VH_ASSERT(buffer.CopyFromImage(commandBuffer, image) == VulkanHelper::VHResult::OK, "Failed to copy image to buffer");
+        return buffer;
+    };
+
+    VulkanHelper::Buffer colorBuffer = readBackImage(colorImage);
+    VulkanHelper::Buffer albedoBuffer;
+    VulkanHelper::Buffer normalBuffer;
+    VulkanHelper::Buffer momentsBuffer;
+
+    if (saveAlbedo)
+        albedoBuffer = readBackImage(m_PathTracer.GetAlbedoImageView().GetImage());
+
+    if (saveNormal || saveDepth)
+        normalBuffer = readBackImage(m_PathTracer.GetNormalImageView().GetImage());
+
+    if (readMoments)
+    {
+        momentsBuffer = createReadbackBuffer(sizeof(glm::vec2) * pixelCount);
+
+        // Moments are written by the path tracing dispatches that may still be in flight
+        m_PathTracer.GetSampleMomentsBuffer().Barrier(
+            commandBuffer,
+            VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::TRANSFER_READ_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+            VulkanHelper::PipelineStages::TRANSFER_BIT
+        );
+        VH_ASSERT(momentsBuffer.CopyFromBuffer(commandBuffer, m_PathTracer.GetSampleMomentsBuffer(), 0, 0, sizeof(glm::vec2) * pixelCount) == VulkanHelper::VHResult::OK, "Failed to copy sample moments to buffer");
+    }
+
+    VH_ASSERT(commandBuffer.EndRecording() == VulkanHelper::VHResult::OK, "Failed to end command buffer recording");
+    VH_ASSERT(commandBuffer.SubmitAndWait() == VulkanHelper::VHResult::OK, "Failed to submit command buffer");
+    VH_ASSERT(commandBuffer.BeginRecording(VulkanHelper::CommandBuffer::Usage::ONE_TIME_SUBMIT_BIT) == VulkanHelper::VHResult::OK, "Failed to begin command buffer recording");
+
+    ExrWriter::Config exrConfig{};
+    exrConfig.Width = width;
+    exrConfig.Height = height;
+    exrConfig.Type = m_ExportSettings.HalfFloat ? ExrWriter::PixelType::HALF : ExrWriter::PixelType::FLOAT;
+    exrConfig.Compression = ExrWriter::CompressionType::ZIP;
+    exrConfig.ThreadPool = &m_ThreadPool;
+    ExrWriter writer = ExrWriter::New(exrConfig);
+
+    const float* color = (const float*)colorBuffer.Map().Value();
+    writer.AddChannel("R", color + 0, 4);
+    writer.AddChannel("G", color + 1, 4);
+    writer.AddChannel("B", color + 2, 4);
+    writer.AddChannel("A", color + 3, 4);
+
+    if (saveAlbedo)
+    {
+        const float* albedo = (const float*)albedoBuffer.Map().Value();
+        writer.AddChannel("albedo.R", albedo + 0, 4);
+        writer.AddChannel("albedo.G", albedo + 1, 4);
+        writer.AddChannel("albedo.B", albedo + 2, 4);
+    }
+
+    if (saveNormal || saveDepth)
+    {
+        // Distance to the first hit is stored in the alpha of the normal AOV
+        const float* normal = (const float*)normalBuffer.Map().Value();
+        if (saveNormal)
+        {
+            writer.AddChannel("normal.X", normal + 0, 4);
+            writer.AddChannel("normal.Y", normal + 1, 4);
+            writer.AddChannel("normal.Z", normal + 2, 4);
+        }
+
+        if (saveDepth)
+            writer.AddChannel("depth.Z", normal + 3, 4);
+    }
+
+    // Moments hold the luminance second moment and the number of frames accumulated in every pixel
+    const glm::vec2* moments = readMoments ? (const glm::vec2*)momentsBuffer.Map().Value() : nullptr;
+
+    std::vector<float> sampleCounts;
+    if (m_ExportSettings.SampleCount)
+    {
+        sampleCounts.resize(pixelCount);
+        for (uint64_t i = 0; i < pixelCount; i++)
+            sampleCounts[i] = moments != nullptr ? moments[i].y * (float)m_PathTracer.GetSamplesPerFrame() : (float)m_PathTracer.GetSamplesAccumulated();
+
+        writer.AddChannel("samples.Y", sampleCounts.data(), 1);
+    }
+
+    std::vector<float> variances;
+    if (saveVariance)
+    {
+        // Variance of the pixel mean luminance, the same error estimate that adaptive sampling uses
+        variances.resize(pixelCount);
+        for (uint64_t i = 0; i < pixelCount; i++)
+        {
+            const float mean = glm::dot(glm::vec3(color[i * 4 + 0], color[i * 4 + 1], color[i * 4 + 2]), glm::vec3(0.212671f, 0.715160f, 0.072169f));
+            variances[i] = glm::max(moments[i].x - mean * mean, 0.0f) / glm::max(moments[i].y, 1.0f);
+        }
+
+        writer.AddChannel("variance.Y", variances.data(), 1);
+    }
+
+    if (!writer.Write(filepath))
+        VH_LOG_ERROR("Failed to save EXR: {}", filepath);
+
+    colorBuffer.Unmap();
+    if (saveAlbedo)
+        albedoBuffer.Unmap();
+    if (saveNormal || saveDepth)
+        normalBuffer.Unmap();
+    if (readMoments)
+        momentsBuffer.Unmap();
+}
+
+void Editor::UpdateAOVs(VulkanHelper::CommandBuffer commandBuffer)
+{
+    const bool exportNeedsAOVs = m_ExportSettings.SaveAsExr && (m_ExportSettings.Albedo || m_ExportSettings.Normal || m_ExportSettings.Depth);
+    const bool aovsNeeded = m_PostProcessor.IsDenoiserEnabled() || exportNeedsAOVs;
+
+    // Enabling them resets the accumulation, so it's done only when something changes
+    if (aovsNeeded != m_PathTracer.AreAOVsEnabled())
+    {
+        m_PathTracer.SetAOVsEnabled(aovsNeeded, commandBuffer);
+        m_RenderTime = 0.0f;
+    }
+}
+
 void Editor::RenderVolumeSettings()
 {
     if (!ImGui::CollapsingHeader("Volume Settings"))
@@ -865,6 +1414,18 @@ void Editor::RenderVolumeSettings()
         });
     }
 
+    const VolumeGridManager& gridManager = m_PathTracer.GetVolumeGridManager();
+    ImGui::Text("Volume Grid VRAM: %.1f / %.1f MB", (float)gridManager.GetUsedMemory() / (1024.0f * 1024.0f), (float)gridManager.GetMemoryBudget() / (1024.0f * 1024.0f));
+    ImGui::Text("Resident Grids: %u (%u in use) / %u slots", gridManager.GetResidentGridCount(), gridManager.GetReferencedGridCount(), gridManager.GetSlotCount());
+
+    static int memoryBudgetMB = (int)(gridManager.GetMemoryBudget() / (1024 * 1024));
+    if (ImGui::DragInt("Volume VRAM Budget (MB)", &memoryBudgetMB, 16.0f, 64, 65536))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer, std::shared_ptr<void>) {
+            m_PathTracer.SetVolumeMemoryBudget((uint64_t)memoryBudgetMB * 1024 * 1024);
+        });
+    }
+
     if (m_PathTracer.GetVolumes().empty())
     {
         ImGui::Text("No volumes in the scene.");
@@ -882,6 +1443,18 @@ void Editor::RenderVolumeSettings()
         });
     }
 
+    ImGui::SameLine();
+    if (ImGui::Button("Duplicate Volume"))
+    {
+        PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+            // Copy shares the density grid with the original, only the parameters are duplicated
+            PathTracer::Volume volume = m_PathTracer.GetVolumes()[(size_t)selectedVolumeIndex];
+            m_PathTracer.AddVolume(volume, commandBuffer);
+            selectedVolumeIndex = (int)m_PathTracer.GetVolumesCount() - 1;
+            m_RenderTime = 0.0f;
+        });
+    }
+
     const auto& volumes = m_PathTracer.GetVolumes();
     std::vector<std::string> volumeNames;
     std::vector<const char*> volumeNamesCStr;
@@ -898,6 +1471,24 @@ void Editor::RenderVolumeSettings()
     bool volumeModified = false;
     PathTracer::Volume selectedVolume = volumes[(size_t)selectedVolumeIndex];
 
+    static PathTracer::VolumeImportSettings importSettings{};
+    const char* quantizations[] = { "None (fp32)", "Fp16", "Fp8", "FpN" };
+    int selectedQuantization = (int)importSettings.Quantization;
+    if (ImGui::Combo("Grid Quantization", &selectedQuantization, quantizations, IM_ARRAYSIZE(quantizations)))
+        importSettings.Quantization = (PathTracer::GridQuantization)selectedQuantization;
+
+    if (importSettings.Quantization == PathTracer::GridQuantization::FPN)
+        ImGui::SliderFloat("Quantization Tolerance", &importSettings.Tolerance, 0.0001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+
+    ImGui::Checkbox("Stream From Disk", &importSettings.Streamed);
+    if (importSettings.Streamed)
+    {
+        static int maxBrickPoolSizeMB = (int)(VolumeBrickStreamer::GetMaxPoolSize(m_Device) / (1024 * 1024));
+        int brickPoolSizeMB = glm::min((int)importSettings.BrickPoolSizeMB, maxBrickPoolSizeMB);
+        if (ImGui::DragInt("Brick Pool Size (MB)", &brickPoolSizeMB, 16.0f, 16, maxBrickPoolSizeMB, "%d", ImGuiSliderFlags_AlwaysClamp))
+            importSettings.BrickPoolSizeMB = (uint32_t)brickPoolSizeMB;
+    }
+
     if (ImGui::Button("Import Density Data (.vdb)"))
     {
         static std::vector<std::string> selection;
@@ -905,7 +1496,7 @@ void Editor::RenderVolumeSettings()
         if (!selection.empty())
         {
             PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
-                m_PathTracer.AddDensityDataToVolume((uint32_t)selectedVolumeIndex, selection[0], commandBuffer);
+                m_PathTracer.AddDensityDataToVolume((uint32_t)selectedVolumeIndex, selection[0], importSettings, commandBuffer);
                 m_RenderTime = 0.0f;
             });
         }
@@ -923,6 +1514,40 @@ void Editor::RenderVolumeSettings()
         }
     }
 
+    if (ImGui::Button("Import Density Sequence (.vdb)"))
+    {
+        static std::vector<std::string> selection;
+        selection = pfd::open_file("Select Any Frame Of The Sequence", ".", {"OpenVDB Files", "*.vdb"}).result();
+        if (!selection.empty())
+        {
+            PushDeferredTask(nullptr, [this](VulkanHelper::CommandBuffer commandBuffer, std::shared_ptr<void>) {
+                m_PathTracer.AddDensitySequenceToVolume((uint32_t)selectedVolumeIndex, selection[0], importSettings, commandBuffer);
+                m_RenderTime = 0.0f;
+            });
+        }
+    }
+
+    if (selectedVolume.BrickStreamer != nullptr)
+    {
+        const VolumeBrickStreamer& streamer = *selectedVolume.BrickStreamer;
+        ImGui::Text("Resident Bricks: %u / %u (pool holds %u)", streamer.GetResidentBrickCount(), streamer.GetStoredBrickCount(), streamer.GetPoolCapacity());
+    }
+
+    if (selectedVolume.Sequence != nullptr)
+    {
+        ImGui::Text("Sequence Frame: %u / %u", selectedVolume.Sequence->CurrentFrame + 1, (uint32_t)selectedVolume.Sequence->Frames.size());
+
+        bool playing = selectedVolume.Sequence->Playing;
+        ImGui::BeginDisabled(m_RenderingSequence);
+        if (ImGui::Checkbox("Play Sequence", &playing))
+        {
+            PushDeferredTask(nullptr, [this, playing](VulkanHelper::CommandBuffer, std::shared_ptr<void>) {
+                m_PathTracer.SetVolumeSequencePlaying((uint32_t)selectedVolumeIndex, playing);
+            });
+        }
+        ImGui::EndDisabled();
+    }
+
     ImGui::PushID("VolumeSettings");
 
     if (ImGui::InputFloat3("Corner Min", &selectedVolume.CornerMin.x))
@@ -944,6 +1569,20 @@ void Editor::RenderVolumeSettings()
     ImGui::BeginDisabled(selectedVolume.DensityDataIndex == -1);
     if (ImGui::SliderFloat("Grid Sharpness", &selectedVolume.GridSharpness, 0.0f, 10.0f))
         volumeModified = true;
+
+    const char* transmittanceEstimators[] = { "Delta Tracking", "Ratio Tracking", "Residual Ratio Tracking" };
+    int estimator = (int)selectedVolume.Estimator;
+    if (ImGui::Combo("Transmittance Estimator", &estimator, transmittanceEstimators, IM_ARRAYSIZE(transmittanceEstimators)))
+    {
+        selectedVolume.Estimator = (PathTracer::TransmittanceEstimator)estimator;
+        volumeModified = true;
+    }
+
+    if (selectedVolume.Estimator == PathTracer::TransmittanceEstimator::RESIDUAL_RATIO_TRACKING)
+    {
+        if (ImGui::SliderFloat("Control Density Fraction", &selectedVolume.ResidualControlFraction, 0.0f, 1.0f, "%.2f"))
+            volumeModified = true;
+    }
     ImGui::EndDisabled();
 
     bool useApproximatedScatteringForClouds = (bool)selectedVolume.ApproximatedScatteringForClouds;
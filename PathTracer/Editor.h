@@ -18,6 +18,18 @@ struct ViewportSettings
 };
 IMGUI_REFLECT(ViewportSettings, Width, Height)
 
+// EXR contains the linear accumulation instead of the tonemapped image, AOVs are added as separate layers
+struct ExportSettings
+{
+    bool SaveAsExr = false;
+    bool HalfFloat = true;
+    bool Albedo = false;
+    bool Normal = false;
+    bool Depth = false;
+    bool SampleCount = false;
+    bool Variance = false;
+};
+
 class Editor
 {
 public:
@@ -43,6 +55,8 @@ private:
     void SaveToFileSettings();
 
     void SaveToFile(const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer);
+    void SaveToExr(const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer);
+    void UpdateAOVs(VulkanHelper::CommandBuffer commandBuffer);
     void ResizeImage(uint32_t width, uint32_t height);
     void UpdateCamera();
     void ProcessCameraInput();
@@ -56,6 +70,7 @@ private:
     uint32_t m_CurrentImGuiDescriptorIndex = 0;
     float m_RenderTime = 0.0f;
     std::string m_CurrentSceneFilepath;
+    ExportSettings m_ExportSettings;
 
     // Camera system
     FlyCamera m_Camera;
@@ -65,6 +80,12 @@ private:
     glm::mat4 m_InitialViewMatrix = glm::mat4(1.0f);
     glm::mat4 m_InitialProjectionMatrix = glm::mat4(1.0f);
 
+    // Batch rendering of volume sequences, every sequence step is rendered to max samples and saved to a separate file
+    bool m_RenderingSequence = false;
+    uint32_t m_SequenceFrameIndex = 0;
+    uint32_t m_SequenceFrameCount = 0;
+    std::string m_SequenceOutputName;
+
     // A lot of vulkan commands can't be called when the render pass is active. And ImGui
     // Is an immediate mode GUI, it runs in a render pass, so some commands have to be deferred to the beginning of the next frame.
     std::vector<std::pair<std::shared_ptr<void>, std::function<void(VulkanHelper::CommandBuffer, std::shared_ptr<void> data)>>> m_DeferredTasks;
@@ -0,0 +1,219 @@
+#include "ExrWriter.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+
+// Implemented in stb_image_write, which is compiled in Editor.cpp. Output is a zlib stream allocated with malloc
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int dataLength, int* outLength, int quality);
+
+namespace
+{
+    template<typename T>
+    void Append(std::vector<uint8_t>& bytes, const T& value)
+    {
+        // EXR is little endian, same as every platform this runs on
+        const uint8_t* valueBytes = (const uint8_t*)&value;
+        bytes.insert(bytes.end(), valueBytes, valueBytes + sizeof(T));
+    }
+
+    void AppendString(std::vector<uint8_t>& bytes, const std::string& string)
+    {
+        bytes.insert(bytes.end(), string.begin(), string.end());
+        bytes.push_back(0);
+    }
+
+    void AppendAttribute(std::vector<uint8_t>& bytes, const std::string& name, const std::string& type, const std::vector<uint8_t>& value)
+    {
+        AppendString(bytes, name);
+        AppendString(bytes, type);
+        Append(bytes, (int32_t)value.size());
+        bytes.insert(bytes.end(), value.begin(), value.end());
+    }
+}
+
+ExrWriter ExrWriter::New(const Config& config)
+{
+    ExrWriter writer;
+    writer.m_Config = config;
+
+    return writer;
+}
+
+void ExrWriter::AddChannel(const std::string& name, const float* data, uint32_t stride)
+{
+    m_Channels.push_back({ name, data, stride });
+}
+
+bool ExrWriter::Write(const std::string& filepath) const
+{
+    // Channels have to be stored in alphabetical order
+    std::vector<Channel> channels = m_Channels;
+    std::sort(channels.begin(), channels.end(), [](const Channel& a, const Channel& b) { return a.Name < b.Name; });
+
+    std::vector<uint8_t> header;
+
+    // Magic number and version 2, single part scanline image. Long names are needed for names over 31 characters
+    bool longNames = false;
+    for (const Channel& channel : channels)
+        longNames |= channel.Name.size() > 31;
+
+    Append(header, (int32_t)20000630);
+    Append(header, (int32_t)(2 | (longNames ? 0x400 : 0)));
+
+    std::vector<uint8_t> channelList;
+    for (const Channel& channel : channels)
+    {
+        AppendString(channelList, channel.Name);
+        Append(channelList, (int32_t)m_Config.Type);
+        Append(channelList, (uint32_t)0); // pLinear and reserved
+        Append(channelList, (int32_t)1); // X sampling
+        Append(channelList, (int32_t)1); // Y sampling
+    }
+    channelList.push_back(0);
+
+    std::vector<uint8_t> window;
+    Append(window, (int32_t)0);
+    Append(window, (int32_t)0);
+    Append(window, (int32_t)m_Config.Width - 1);
+    Append(window, (int32_t)m_Config.Height - 1);
+
+    std::vector<uint8_t> screenWindowCenter;
+    Append(screenWindowCenter, 0.0f);
+    Append(screenWindowCenter, 0.0f);
+
+    AppendAttribute(header, "channels", "chlist", channelList);
+    AppendAttribute(header, "compression", "compression", { (uint8_t)m_Config.Compression });
+    AppendAttribute(header, "dataWindow", "box2i", window);
+    AppendAttribute(header, "displayWindow", "box2i", window);
+    AppendAttribute(header, "lineOrder", "lineOrder", { 0 }); // Increasing Y
+    AppendAttribute(header, "pixelAspectRatio", "float", { 0x00, 0x00, 0x80, 0x3F }); // 1.0f
+    AppendAttribute(header, "screenWindowCenter", "v2f", screenWindowCenter);
+    AppendAttribute(header, "screenWindowWidth", "float", { 0x00, 0x00, 0x80, 0x3F }); // 1.0f
+    header.push_back(0);
+
+    // Blocks are independent, so they're encoded in parallel
+    const uint32_t linesPerBlock = GetLinesPerBlock();
+    const uint32_t blockCount = (m_Config.Height + linesPerBlock - 1) / linesPerBlock;
+
+    std::vector<std::vector<uint8_t>> blocks(blockCount);
+    if (m_Config.ThreadPool != nullptr)
+    {
+        std::vector<std::future<std::vector<uint8_t>>> tasks;
+        tasks.reserve(blockCount);
+        for (uint32_t i = 0; i < blockCount; i++)
+        {
+            tasks.push_back(m_Config.ThreadPool->PushTask([this, &channels, i, linesPerBlock]() {
+                return EncodeBlock(channels, i * linesPerBlock);
+            }));
+        }
+
+        for (uint32_t i = 0; i < blockCount; i++)
+            blocks[i] = tasks[i].get();
+    }
+    else
+    {
+        for (uint32_t i = 0; i < blockCount; i++)
+            blocks[i] = EncodeBlock(channels, i * linesPerBlock);
+    }
+
+    // Offset table points at every block, block is its first line, its size and the data
+    std::vector<uint8_t> offsetTable;
+    uint64_t offset = header.size() + sizeof(uint64_t) * blockCount;
+    for (uint32_t i = 0; i < blockCount; i++)
+    {
+        Append(offsetTable, offset);
+        offset += sizeof(int32_t) * 2 + blocks[i].size();
+    }
+
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file.is_open())
+    {
+        VH_LOG_ERROR("Failed to open file for writing: {}", filepath);
+        return false;
+    }
+
+    file.write((const char*)header.data(), (std::streamsize)header.size());
+    file.write((const char*)offsetTable.data(), (std::streamsize)offsetTable.size());
+    for (uint32_t i = 0; i < blockCount; i++)
+    {
+        const int32_t firstLine = (int32_t)(i * linesPerBlock);
+        const int32_t dataSize = (int32_t)blocks[i].size();
+        file.write((const char*)&firstLine, sizeof(int32_t));
+        file.write((const char*)&dataSize, sizeof(int32_t));
+        file.write((const char*)blocks[i].data(), dataSize);
+    }
+
+    return file.good();
+}
+
+std::vector<uint8_t> ExrWriter::EncodeBlock(const std::vector<Channel>& channels, uint32_t firstLine) const
+{
+    const uint32_t lineCount = std::min(GetLinesPerBlock(), m_Config.Height - firstLine);
+    const size_t valueSize = m_Config.Type == PixelType::HALF ? sizeof(uint16_t) : sizeof(float);
+
+    // Every line stores its channels one after another
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)lineCount * m_Config.Width * channels.size() * valueSize);
+    for (uint32_t y = firstLine; y < firstLine + lineCount; y++)
+    {
+        for (const Channel& channel : channels)
+        {
+            for (uint32_t x = 0; x < m_Config.Width; x++)
+            {
+                const float value = channel.Data[((size_t)y * m_Config.Width + x) * channel.Stride];
+                if (m_Config.Type == PixelType::HALF)
+                    Append(raw, (uint16_t)glm::packHalf1x16(value));
+                else
+                    Append(raw, value);
+            }
+        }
+    }
+
+    if (m_Config.Compression == CompressionType::NONE)
+        return raw;
+
+    // Bytes of every value are split into two halves and delta encoded, floats compress much better that way
+    const size_t size = raw.size();
+    std::vector<uint8_t> reordered(size);
+    size_t firstHalf = 0;
+    size_t secondHalf = (size + 1) / 2;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (i % 2 == 0)
+            reordered[firstHalf++] = raw[i];
+        else
+            reordered[secondHalf++] = raw[i];
+    }
+
+    int previous = size > 0 ? reordered[0] : 0;
+    for (size_t i = 1; i < size; i++)
+    {
+        const int current = reordered[i];
+        reordered[i] = (uint8_t)(current - previous + (128 + 256));
+        previous = current;
+    }
+
+    int compressedSize = 0;
+    unsigned char* compressed = stbi_zlib_compress(reordered.data(), (int)size, &compressedSize, 8);
+
+    // Readers treat blocks that are as big as the raw data as uncompressed
+    std::vector<uint8_t> block;
+    if (compressed != nullptr && (size_t)compressedSize < size)
+        block.assign(compressed, compressed + compressedSize);
+    else
+        block = std::move(raw);
+
+    free(compressed);
+
+    return block;
+}
+
+uint32_t ExrWriter::GetLinesPerBlock() const
+{
+    return m_Config.Compression == CompressionType::ZIP ? 16 : 1;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "VulkanHelper.h"
+
+#include <string>
+#include <vector>
+
+// Writes single part scanline OpenEXR files. Every channel is read from a float plane, channel names containing
+// a dot (e.g. "albedo.R") put the channel into a layer. ZIP blocks are compressed in parallel on the thread pool.
+class ExrWriter
+{
+public:
+    enum class PixelType : int32_t
+    {
+        HALF = 1,
+        FLOAT = 2
+    };
+
+    enum class CompressionType : uint8_t
+    {
+        NONE = 0,
+        ZIP = 3 // Blocks of 16 scanlines
+    };
+
+    struct Config
+    {
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        PixelType Type = PixelType::HALF;
+        CompressionType Compression = CompressionType::ZIP;
+        VulkanHelper::ThreadPool* ThreadPool = nullptr; // Blocks are compressed on the calling thread if null
+    };
+
+    ExrWriter() = default;
+
+    [[nodiscard]] static ExrWriter New(const Config& config);
+
+    // Data has to stay alive until Write() returns. Stride is the distance between two pixels in floats,
+    // so that channels can be taken straight out of an interleaved RGBA image
+    void AddChannel(const std::string& name, const float* data, uint32_t stride);
+
+    // Returns false if the file couldn't be written
+    [[nodiscard]] bool Write(const std::string& filepath) const;
+
+private:
+    struct Channel
+    {
+        std::string Name;
+        const float* Data = nullptr;
+        uint32_t Stride = 1;
+    };
+
+    [[nodiscard]] std::vector<uint8_t> EncodeBlock(const std::vector<Channel>& channels, uint32_t firstLine) const;
+    [[nodiscard]] uint32_t GetLinesPerBlock() const;
+
+    Config m_Config;
+    std::vector<Channel> m_Channels;
+};
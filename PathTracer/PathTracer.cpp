@@ -1,13 +1,21 @@
 #include "PathTracer.h"
+#include "SkyBaker.h"
 
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <chrono>
 #include <array>
 #include <fstream>
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <numeric>
 #include <numbers>
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <functional>
+#include <unordered_set>
 
 #include "Log/Log.h"
 #include "Vulkan/BLASBuilder.h"
@@ -74,12 +82,26 @@ PathTracer PathTracer::New(const VulkanHelper::Device& device, VulkanHelper::Thr
     materialIndicesBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
     pathTracer.m_MaterialAndMeshIndicesBuffer = VulkanHelper::Buffer::New(materialIndicesBufferConfig).Value();
 
+    VulkanHelper::Buffer::Config instanceTransformsBufferConfig{};
+    instanceTransformsBufferConfig.Device = device;
+    instanceTransformsBufferConfig.Size = sizeof(InstanceTransform) * MAX_INSTANCES;
+    instanceTransformsBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    instanceTransformsBufferConfig.DebugName = "Instance Transforms";
+    pathTracer.m_InstanceTransformsBuffer = VulkanHelper::Buffer::New(instanceTransformsBufferConfig).Value();
+
     VulkanHelper::Buffer::Config emissiveMeshesBufferConfig{};
     emissiveMeshesBufferConfig.Device = device;
     emissiveMeshesBufferConfig.Size = sizeof(EmissiveMeshEntry) * MAX_EMISSIVE_MESHES;
     emissiveMeshesBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
     pathTracer.m_EmissiveMeshesBuffer = VulkanHelper::Buffer::New(emissiveMeshesBufferConfig).Value();
 
+    VulkanHelper::Buffer::Config instanceEmissiveOffsetsBufferConfig{};
+    instanceEmissiveOffsetsBufferConfig.Device = device;
+    instanceEmissiveOffsetsBufferConfig.Size = sizeof(uint32_t) * MAX_INSTANCES;
+    instanceEmissiveOffsetsBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    instanceEmissiveOffsetsBufferConfig.DebugName = "Instance Emissive Offsets";
+    pathTracer.m_InstanceEmissiveOffsetsBuffer = VulkanHelper::Buffer::New(instanceEmissiveOffsetsBufferConfig).Value();
+
     // Sampler
     VulkanHelper::Sampler::Config samplerConfig{};
     samplerConfig.AddressMode = VulkanHelper::Sampler::AddressMode::REPEAT;
@@ -100,6 +122,16 @@ PathTracer PathTracer::New(const VulkanHelper::Device& device, VulkanHelper::Thr
     volumesBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT | VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
     pathTracer.m_VolumesBuffer = VulkanHelper::Buffer::New(volumesBufferConfig).Value();
 
+    // Volume BVH buffer, binary tree with one volume per leaf has at most 2N - 1 nodes
+    VulkanHelper::Buffer::Config volumeBVHBufferConfig{};
+    volumeBVHBufferConfig.Device = device;
+    volumeBVHBufferConfig.Size = sizeof(VolumeBVHNode) * MAX_ENTITIES * 2;
+    volumeBVHBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    volumeBVHBufferConfig.DebugName = "Volume BVH";
+    pathTracer.m_VolumeBVHBuffer = VulkanHelper::Buffer::New(volumeBVHBufferConfig).Value();
+
+    pathTracer.m_VolumeGridManager = VolumeGridManager::New(MAX_HETEROGENEOUS_VOLUMES, DEFAULT_VOLUME_MEMORY_BUDGET);
+
     if (device.AreRayQueriesSupported())
     {
         pathTracer.m_UseRayQueries = true;
@@ -116,16 +148,84 @@ PathTracer PathTracer::New(const VulkanHelper::Device& device, VulkanHelper::Thr
 
     pathTracer.m_PathTracerPushConstant = VulkanHelper::PushConstant::New(pushConstantConfig).Value();
 
+    // Wavefront stages are a mix of ray tracing and compute pipelines
+    pushConstantConfig.Stage = VulkanHelper::ShaderStages::RAYGEN_BIT | VulkanHelper::ShaderStages::COMPUTE_BIT;
+    pathTracer.m_WavefrontPushConstant = VulkanHelper::PushConstant::New(pushConstantConfig).Value();
+
+    TileScheduler::Config schedulerConfig{};
+    schedulerConfig.TargetDispatchTime = pathTracer.m_TargetDispatchTime;
+    schedulerConfig.MaxChunkCount = MAX_SPLIT_SCREEN_COUNT;
+    pathTracer.m_TileScheduler = TileScheduler::New(schedulerConfig);
+
+    VulkanHelper::QueryPool::Config queryPoolConfig{};
+    queryPoolConfig.Device = device;
+    queryPoolConfig.Type = VulkanHelper::QueryPool::Type::TIMESTAMP;
+    queryPoolConfig.QueryCount = (uint32_t)pathTracer.m_DispatchTimings.size() * 2;
+    pathTracer.m_DispatchTimestamps = VulkanHelper::QueryPool::New(queryPoolConfig).Value();
+
+    pushConstantConfig.Stage = VulkanHelper::ShaderStages::COMPUTE_BIT;
+    pathTracer.m_InlineRayQueryPushConstant = VulkanHelper::PushConstant::New(pushConstantConfig).Value();
+    pathTracer.m_GuidingPushConstant = VulkanHelper::PushConstant::New(pushConstantConfig).Value();
+    pathTracer.m_ConvergencePushConstant = VulkanHelper::PushConstant::New(pushConstantConfig).Value();
+
+    // Atmosphere transmittance LUT, written by a compute shader and sampled by the shadow rays
+    VulkanHelper::Image::Config transmittanceImageConfig{};
+    transmittanceImageConfig.Device = device;
+    transmittanceImageConfig.Width = ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH;
+    transmittanceImageConfig.Height = ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT;
+    transmittanceImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
+    transmittanceImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT;
+
+    VulkanHelper::ImageView::Config transmittanceImageViewConfig{};
+    transmittanceImageViewConfig.image = VulkanHelper::Image::New(transmittanceImageConfig).Value();
+    transmittanceImageViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
+    transmittanceImageViewConfig.BaseLayer = 0;
+    transmittanceImageViewConfig.LayerCount = 1;
+    pathTracer.m_AtmosphereTransmittanceLUT = VulkanHelper::ImageView::New(transmittanceImageViewConfig).Value();
+
+    // Approximate sky is baked on the CPU from the same LUT
+    VulkanHelper::Buffer::Config skyReadbackConfig{};
+    skyReadbackConfig.Device = device;
+    skyReadbackConfig.Size = sizeof(glm::vec4) * ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH * ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT;
+    skyReadbackConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    skyReadbackConfig.CpuMapable = true;
+    skyReadbackConfig.DebugName = "Sky Bake Transmittance Readback";
+    pathTracer.m_SkyBakeReadbackBuffer = VulkanHelper::Buffer::New(skyReadbackConfig).Value();
+
     return pathTracer;
 }
 
 bool PathTracer::PathTrace(VulkanHelper::CommandBuffer& commandBuffer)
 {
-    if (m_SamplesAccumulated >= m_MaxSamplesAccumulated)
+    if (m_SamplesAccumulated >= m_MaxSamplesAccumulated || (m_AdaptiveSampling && m_ActiveTileCount == 0))
         return true;
 
+    // Low resolution preview is rendered while the settings keep changing, full resolution accumulation starts once they settle
+    const auto dispatchTime = std::chrono::high_resolution_clock::now();
+    const bool previewRequested = m_PreviewScale > 1 && std::chrono::duration<float, std::milli>(dispatchTime - m_LastResetTime).count() < PREVIEW_SETTLE_TIME;
+    if (previewRequested != m_PreviewActive)
+        SetPreviewActive(previewRequested, commandBuffer);
+
+    ReadDispatchTimestamps();
+
+    // Split can change only between frames
+    if (m_AutomaticScheduling && m_ChunkIndex == 0 && !m_PreviewActive)
+        UpdateSchedule(commandBuffer);
+
+    UpdateVolumeBrickStreaming(commandBuffer);
+
+    if (m_AtmosphereTransmittanceLUTPending)
+    {
+        UpdateAtmosphereTransmittanceLUT(commandBuffer);
+        m_AtmosphereTransmittanceLUTPending = false;
+    }
+
+    UpdateApproximateSky(commandBuffer);
+
     static auto timer = std::chrono::high_resolution_clock::now();
     m_OutputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+    m_AlbedoImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+    m_NormalImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
 
     auto PCGHash = [](uint32_t input){
         uint32_t state = input * 747796405u + 2891336453u;
@@ -135,22 +235,106 @@ bool PathTracer::PathTrace(VulkanHelper::CommandBuffer& commandBuffer)
 
     uint32_t timeElapsed = (uint32_t)((uint64_t)std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - timer).count() % UINT32_MAX);
 
-    PushConstantData data;
-    data.FrameCount = m_FrameCount;
-    data.Seed = PCGHash(timeElapsed); // Random seed for each frame
-    data.ChunkIndex = m_DispatchCount % (m_ScreenChunkCount * m_ScreenChunkCount);
+    const uint32_t seed = PCGHash(timeElapsed); // Random seed for each frame
+    const uint32_t chunkIndex = m_ChunkIndex;
 
-    VH_ASSERT(m_PathTracerPushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+    // Preview dispatches are much cheaper than the regular ones, so they aren't measured. If the slot is still
+    // waiting for the GPU the dispatch isn't measured either
+    DispatchTiming& timing = m_DispatchTimings[m_DispatchTimingSlot];
+    const bool measureDispatch = m_AutomaticScheduling && !m_PreviewActive && !timing.Pending;
+    if (measureDispatch)
+    {
+        m_DispatchTimestamps.Reset(commandBuffer, m_DispatchTimingSlot * 2, 2);
+        m_DispatchTimestamps.WriteTimestamp(commandBuffer, VulkanHelper::PipelineStages::TOP_OF_PIPE_BIT, m_DispatchTimingSlot * 2);
+    }
 
-    m_PathTracerPipeline.Bind(commandBuffer);
-    m_PathTracerPipeline.RayTrace(
-        commandBuffer,
-        (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetWidth() / (float)m_ScreenChunkCount),
-        (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetHeight() / (float)m_ScreenChunkCount)
-    );
+    // Wavefront integrator accumulates samples on its own and doesn't track the moments
+    if (m_AdaptiveSampling && m_Integrator != Integrator::WAVEFRONT)
+        UpdateConvergenceMask(commandBuffer, chunkIndex);
+
+    if (m_Integrator == Integrator::WAVEFRONT)
+    {
+        PathTraceWavefront(commandBuffer, m_FrameCount, seed, chunkIndex);
+    }
+    else if (m_Integrator == Integrator::INLINE_RAY_QUERY)
+    {
+        PathTraceInlineRayQuery(commandBuffer, m_FrameCount, seed, chunkIndex);
+    }
+    else
+    {
+        // Guide is learned again after every reset, preview dispatches don't train it since they never finish a frame
+        if (m_PathGuiding && m_GuidingResetPending)
+        {
+            UpdateGuiding(commandBuffer, true);
+            m_GuidingResetPending = false;
+        }
+        const bool guidingTraining = m_PathGuiding && !m_PreviewActive && m_FrameCount < m_GuidingTrainingFrames;
+
+        PushConstantData data{};
+        data.FrameCount = m_FrameCount;
+        data.Seed = seed;
+        data.ChunkIndex = chunkIndex;
+        data.SampleIndex = GetFirstSampleIndex();
+        data.GuidingTraining = guidingTraining ? 1 : 0;
+
+        VH_ASSERT(m_PathTracerPushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+
+        m_PathTracerPipeline.Bind(commandBuffer);
+        m_PathTracerPipeline.RayTrace(
+            commandBuffer,
+            (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetWidth() / (float)GetActiveChunkCount()),
+            (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetHeight() / (float)GetActiveChunkCount())
+        );
+
+        if (guidingTraining)
+            UpdateGuiding(commandBuffer, false);
+    }
     m_DispatchCount++;
-    m_FrameCount = (uint32_t)glm::floor((float)m_DispatchCount / (float)(m_ScreenChunkCount * m_ScreenChunkCount));
-    m_SamplesAccumulated = (m_FrameCount * m_SamplesPerFrame);
+
+    if (measureDispatch)
+    {
+        m_DispatchTimestamps.WriteTimestamp(commandBuffer, VulkanHelper::PipelineStages::BOTTOM_OF_PIPE_BIT, m_DispatchTimingSlot * 2 + 1);
+
+        timing.Pending = true;
+        timing.ChunkCount = m_ScreenChunkCount;
+        timing.SamplesPerFrame = m_SamplesPerFrame;
+        m_DispatchTimingSlot = (m_DispatchTimingSlot + 1) % (uint32_t)m_DispatchTimings.size();
+    }
+
+    // Preview renders the first chunk of the first frame over and over, the shaders fill the rest of the pixels with it
+    if (m_PreviewActive)
+        return false;
+
+    m_ChunkIndex++;
+
+    // Samples per frame can be changed by the scheduler, so the samples are summed up frame by frame
+    if (m_ChunkIndex >= m_ScreenChunkCount * m_ScreenChunkCount)
+    {
+        m_ChunkIndex = 0;
+        m_FrameCount++;
+        m_SamplesAccumulated += m_SamplesPerFrame;
+
+        if (m_ReprojectionPending)
+        {
+            ReprojectHistory(commandBuffer);
+            m_ReprojectionPending = false;
+        }
+
+        // Next frame reads the reservoirs written by this one
+        if (m_ReSTIR)
+        {
+            for (auto& buffer : m_ReservoirBuffers)
+            {
+                buffer.Barrier(
+                    commandBuffer,
+                    VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+                    VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+                    VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+                    VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+                );
+            }
+        }
+    }
 
     return false;
 }
@@ -200,10 +384,12 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     m_RefractionFromOutsideLookup = LoadLookupTable("../../Assets/LookupTables/RefractionLookupHitFromOutside.bin", {128, 128, 32}, initializationCmd);
     m_RefractionFromInsideLookup = LoadLookupTable("../../Assets/LookupTables/RefractionLookupHitFromInside.bin", {128, 128, 32}, initializationCmd);
     LoadEnvironmentMap(m_EnvMapFilepath.c_str(), initializationCmd);
+    m_ApproximateSkyBaked = false;
 
     // Meshes
     m_SceneMeshes.clear();
     m_SceneMeshInfo.clear();
+    m_InstanceLightTrees.clear();
     for (const auto& mesh : scene.Value().Meshes)
     {
         VulkanHelper::Mesh::Config meshConfig{};
@@ -220,6 +406,12 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
         m_SceneMeshes.push_back(std::move(VulkanHelper::Mesh::New(meshConfig).Value()));
         m_SceneMeshInfo.push_back(MeshInfoEntry{ .TriangleCount = static_cast<uint32_t>(mesh.Indices.Size() / 3) });
 
+        MeshInfoEntry& meshInfo = m_SceneMeshInfo.back();
+        meshInfo.Positions.reserve(mesh.Vertices.Size());
+        for (const auto& vertex : mesh.Vertices)
+            meshInfo.Positions.push_back(vertex.Position);
+        meshInfo.Indices.assign(mesh.Indices.Data(), mesh.Indices.Data() + mesh.Indices.Size());
+
         m_TotalVertexCount += mesh.Vertices.Size();
         m_TotalIndexCount += mesh.Indices.Size();
     }
@@ -443,6 +635,23 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
 
     m_EmissiveTriangleCount = 0;
 
+    // Object space bounds of every mesh, the instance bounds are built from their corners
+    std::vector<std::pair<glm::vec3, glm::vec3>> meshBounds;
+    meshBounds.reserve(m_SceneMeshInfo.size());
+    for (const MeshInfoEntry& meshInfo : m_SceneMeshInfo)
+    {
+        glm::vec3 boundsMin(std::numeric_limits<float>::max());
+        glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+        for (const glm::vec3& position : meshInfo.Positions)
+        {
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+        meshBounds.push_back({ boundsMin, boundsMax });
+    }
+    m_SceneBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+    m_SceneBoundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+
     VulkanHelper::Vector<VulkanHelper::BLAS::Config> blasConfigs;
     m_SceneMeshInstances.clear();
     m_SceneMeshInstances.reserve(scene.Value().MeshInstances.Size());
@@ -455,6 +664,19 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
         materialAndMeshIndices.PushBack(instance.MaterialIndex);
         materialAndMeshIndices.PushBack(instance.MeshIndex);
 
+        const auto& [meshBoundsMin, meshBoundsMax] = meshBounds[instance.MeshIndex];
+        for (uint32_t corner = 0; corner < 8; corner++)
+        {
+            const glm::vec3 position(
+                (corner & 1) ? meshBoundsMax.x : meshBoundsMin.x,
+                (corner & 2) ? meshBoundsMax.y : meshBoundsMin.y,
+                (corner & 4) ? meshBoundsMax.z : meshBoundsMin.z
+            );
+            const glm::vec3 worldPosition = glm::vec3(instance.Transform * glm::vec4(position, 1.0f));
+            m_SceneBoundsMin = glm::min(m_SceneBoundsMin, worldPosition);
+            m_SceneBoundsMax = glm::max(m_SceneBoundsMax, worldPosition);
+        }
+
         if (m_Materials[instance.MaterialIndex].EmissiveColor != glm::vec3(0.0f))
         {
             uint32_t triangleCount = (uint32_t)((m_SceneMeshes[instance.MeshIndex].GetIndexBuffer().GetSize() / sizeof(uint32_t)) / 3);
@@ -484,6 +706,7 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
 
     if (m_EmissiveMeshes.size() > 0)
         UploadDataToBuffer(m_EmissiveMeshesBuffer, m_EmissiveMeshes.data(), (uint32_t)m_EmissiveMeshes.size() * sizeof(EmissiveMeshEntry), 0, initializationCmd);
+    BuildEmissiveTriangleTable(initializationCmd);
 
     VulkanHelper::BLASBuilder blasBuilder = VulkanHelper::BLASBuilder::New({ .Device = m_Device }).Value();
     auto buildResult = blasBuilder.Build(blasConfigs.Data(), (uint32_t)blasConfigs.Size(), computeCmd);
@@ -493,6 +716,12 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
 
     UploadDataToBuffer(m_MaterialAndMeshIndicesBuffer, materialAndMeshIndices.Data(), (uint32_t)materialAndMeshIndices.Size() * sizeof(uint32_t), 0, initializationCmd);
 
+    std::vector<InstanceTransform> instanceTransforms;
+    instanceTransforms.reserve(modelMatrices.Size());
+    for (const glm::mat4& modelMatrix : modelMatrices)
+        instanceTransforms.push_back({ modelMatrix, glm::inverse(modelMatrix) });
+    UploadDataToBuffer(m_InstanceTransformsBuffer, instanceTransforms.data(), instanceTransforms.size() * sizeof(InstanceTransform), 0, initializationCmd);
+
     m_SceneTLAS = VulkanHelper::TLAS::New({
         m_Device,
         std::move(blasList),
@@ -510,11 +739,16 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     m_Width = (uint32_t)((float)initialRes * aspectRatio);
     m_Height = initialRes;
     CreateOutputImageView();
+    CreateAdaptiveSamplingBuffers();
+    CreateReprojectionBuffers();
+    CreateReservoirBuffers();
+    CreateGuidingBuffers();
 
-    VulkanHelper::ShaderStages allRTShadersStages = VulkanHelper::ShaderStages::RAYGEN_BIT | VulkanHelper::ShaderStages::CLOSEST_HIT_BIT | VulkanHelper::ShaderStages::MISS_BIT;
+    // Compute is used by the wavefront integrator stages
+    VulkanHelper::ShaderStages allRTShadersStages = VulkanHelper::ShaderStages::RAYGEN_BIT | VulkanHelper::ShaderStages::CLOSEST_HIT_BIT | VulkanHelper::ShaderStages::MISS_BIT | VulkanHelper::ShaderStages::COMPUTE_BIT;
 
     // Create Descriptor set
-    std::array<VulkanHelper::DescriptorSet::BindingDescription, 20> bindingDescriptions = {
+    std::array<VulkanHelper::DescriptorSet::BindingDescription, 40> bindingDescriptions = {
         VulkanHelper::DescriptorSet::BindingDescription{0, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_IMAGE},
         VulkanHelper::DescriptorSet::BindingDescription{1, 1, allRTShadersStages, VulkanHelper::DescriptorType::ACCELERATION_STRUCTURE_KHR},
         VulkanHelper::DescriptorSet::BindingDescription{2, 1, allRTShadersStages, VulkanHelper::DescriptorType::UNIFORM_BUFFER},
@@ -534,7 +768,27 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
         VulkanHelper::DescriptorSet::BindingDescription{16, MAX_HETEROGENEOUS_VOLUMES, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume Temperature buffers
         VulkanHelper::DescriptorSet::BindingDescription{17, MAX_HETEROGENEOUS_VOLUMES, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume max densities buffers
         VulkanHelper::DescriptorSet::BindingDescription{18, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Instances material indices
-        VulkanHelper::DescriptorSet::BindingDescription{19, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}  // Emissive meshes buffer
+        VulkanHelper::DescriptorSet::BindingDescription{19, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Emissive meshes buffer
+        VulkanHelper::DescriptorSet::BindingDescription{20, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume BVH
+        VulkanHelper::DescriptorSet::BindingDescription{21, MAX_HETEROGENEOUS_VOLUMES, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume brick page tables
+        VulkanHelper::DescriptorSet::BindingDescription{22, MAX_HETEROGENEOUS_VOLUMES, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume brick pools
+        VulkanHelper::DescriptorSet::BindingDescription{23, MAX_HETEROGENEOUS_VOLUMES, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Volume brick feedback
+        VulkanHelper::DescriptorSet::BindingDescription{24, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Instance transforms
+        VulkanHelper::DescriptorSet::BindingDescription{25, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Sample moments
+        VulkanHelper::DescriptorSet::BindingDescription{26, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Convergence mask
+        VulkanHelper::DescriptorSet::BindingDescription{27, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_IMAGE}, // Albedo AOV
+        VulkanHelper::DescriptorSet::BindingDescription{28, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_IMAGE}, // Normal AOV
+        VulkanHelper::DescriptorSet::BindingDescription{29, 3, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Reprojection history
+        VulkanHelper::DescriptorSet::BindingDescription{30, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Reprojection history moments
+        VulkanHelper::DescriptorSet::BindingDescription{31, 2, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // ReSTIR reservoirs
+        VulkanHelper::DescriptorSet::BindingDescription{32, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Emissive triangles alias map
+        VulkanHelper::DescriptorSet::BindingDescription{33, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Instance emissive offsets
+        VulkanHelper::DescriptorSet::BindingDescription{34, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Light tree
+        VulkanHelper::DescriptorSet::BindingDescription{35, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Guiding training splats
+        VulkanHelper::DescriptorSet::BindingDescription{36, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Guiding radiance
+        VulkanHelper::DescriptorSet::BindingDescription{37, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_BUFFER}, // Guiding distribution
+        VulkanHelper::DescriptorSet::BindingDescription{38, 1, allRTShadersStages, VulkanHelper::DescriptorType::STORAGE_IMAGE}, // Atmosphere transmittance LUT output
+        VulkanHelper::DescriptorSet::BindingDescription{39, 1, allRTShadersStages, VulkanHelper::DescriptorType::SAMPLED_IMAGE}  // Atmosphere transmittance LUT
     };
 
     VulkanHelper::DescriptorSet::Config descriptorSetConfig{};
@@ -566,18 +820,33 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     VH_ASSERT(m_PathTracerDescriptorSet.AddImage(9, 0, &m_RefractionFromOutsideLookup, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add refraction hit from outside lookup texture to descriptor set");
     VH_ASSERT(m_PathTracerDescriptorSet.AddImage(10, 0, &m_RefractionFromInsideLookup, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add reflection hit from inside lookup texture to descriptor set");
 
-    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(11, 0, &m_EnvMapTexture, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add env map texture to descriptor set");
-    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(12, 0, &m_EnvAliasMap) == VulkanHelper::VHResult::OK, "Failed to add env alias map buffer to descriptor set");
+    AddEnvironmentMapToDescriptorSet();
     VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(13, 0, &m_VolumesBuffer) == VulkanHelper::VHResult::OK, "Failed to add volumes buffer to descriptor set");
     VH_ASSERT(m_PathTracerDescriptorSet.AddSampler(14, 0, &m_LookupTableSampler) == VulkanHelper::VHResult::OK, "Failed to add lookup table sampler to descriptor set");
     VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(18, 0, &m_MaterialAndMeshIndicesBuffer) == VulkanHelper::VHResult::OK, "Failed to add instances material indices buffer to descriptor set");
     VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(19, 0, &m_EmissiveMeshesBuffer) == VulkanHelper::VHResult::OK, "Failed to add emissive meshes buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(20, 0, &m_VolumeBVHBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume BVH buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(24, 0, &m_InstanceTransformsBuffer) == VulkanHelper::VHResult::OK, "Failed to add instance transforms buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(25, 0, &m_SampleMomentsBuffer) == VulkanHelper::VHResult::OK, "Failed to add sample moments buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(26, 0, &m_ConvergenceMaskBuffer) == VulkanHelper::VHResult::OK, "Failed to add convergence mask buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(27, 0, &m_AlbedoImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add albedo image view to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(28, 0, &m_NormalImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add normal image view to descriptor set");
+    AddReprojectionBuffersToDescriptorSet();
+    AddReservoirBuffersToDescriptorSet();
+    AddEmissiveTrianglesToDescriptorSet();
+    AddGuidingBuffersToDescriptorSet();
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(38, 0, &m_AtmosphereTransmittanceLUT, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add atmosphere transmittance LUT output to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(39, 0, &m_AtmosphereTransmittanceLUT, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add atmosphere transmittance LUT to descriptor set");
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
 
     // Upload Path Tracer uniform data
     PathTracerUniform pathTracerUniform{};
     m_CameraProjectionInverse = glm::inverse(glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100.0f));
     pathTracerUniform.CameraViewInverse = m_CameraViewInverse;
     pathTracerUniform.CameraProjectionInverse = m_CameraProjectionInverse;
+    pathTracerUniform.PreviousViewProjection = glm::inverse(m_CameraProjectionInverse) * glm::inverse(m_CameraViewInverse);
+    pathTracerUniform.PreviousCameraPosition = m_CameraViewInverse[3];
     pathTracerUniform.PlanetPosition = glm::vec4(m_PlanetPosition, 0.0f);
     pathTracerUniform.PlanetRadius = m_PlanetRadius;
     pathTracerUniform.AtmosphereHeight = m_AtmosphereHeight;
@@ -585,6 +854,12 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     pathTracerUniform.MieScatteringCoefficientMultiplier = glm::vec4(m_MieScatteringCoefficientMultiplier, 0.0f);
     pathTracerUniform.OzoneAbsorptionCoefficientMultiplier = glm::vec4(m_OzoneAbsorptionCoefficientMultiplier, 0.0f);
     pathTracerUniform.SunColor = glm::vec4(m_SunColor, 0.0f);
+    pathTracerUniform.RayleighScatteringCoefficient = glm::vec4(RAYLEIGH_SCATTERING_COEFFICIENT, 0.0f);
+    pathTracerUniform.MieScatteringCoefficient = glm::vec4(MIE_SCATTERING_COEFFICIENT, 0.0f);
+    pathTracerUniform.MieAbsorptionCoefficient = glm::vec4(MIE_ABSORPTION_COEFFICIENT, 0.0f);
+    pathTracerUniform.OzoneAbsorptionCoefficient = glm::vec4(OZONE_ABSORPTION_COEFFICIENT, 0.0f);
+    pathTracerUniform.GuidingBoundsMin = glm::vec4(m_SceneBoundsMin, 0.0f);
+    pathTracerUniform.GuidingBoundsMax = glm::vec4(m_SceneBoundsMax, 0.0f);
     pathTracerUniform.RayleighDensityFalloff = m_RayleighDensityFalloff;
     pathTracerUniform.MieDensityFalloff = m_MieDensityFalloff;
     pathTracerUniform.OzoneDensityFalloff = m_OzoneDensityFalloff;
@@ -602,6 +877,15 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     pathTracerUniform.EmissiveMeshCount = (uint32_t)m_EmissiveMeshes.size();
     pathTracerUniform.TotalEmissiveTriangleCount = m_EmissiveTriangleCount;
     pathTracerUniform.EmissiveMeshSamplingPDFBias = m_EmissiveMeshSamplingPDFBias;
+    pathTracerUniform.AtmosphereTransmittanceEstimator = (uint32_t)m_AtmosphereTransmittanceEstimator;
+    pathTracerUniform.AtmosphereResidualControlFraction = m_AtmosphereResidualControlFraction;
+    pathTracerUniform.AdaptiveMinSamples = m_AdaptiveMinSamples;
+    pathTracerUniform.AdaptiveErrorThreshold = m_AdaptiveErrorThreshold;
+    pathTracerUniform.ReSTIRCandidateCount = m_ReSTIRCandidateCount;
+    pathTracerUniform.ReSTIRSpatialSampleCount = m_ReSTIRSpatialSampleCount;
+    pathTracerUniform.ReSTIRSpatialRadius = m_ReSTIRSpatialRadius;
+    pathTracerUniform.ReSTIRHistoryLimit = m_ReSTIRHistoryLimit;
+    pathTracerUniform.GuidingSelectionProbability = m_GuidingSelectionProbability;
 
     // Create a staging buffer to upload uniform data
     VulkanHelper::Buffer::Config uniformStagingBufferConfig{};
@@ -618,42 +902,7 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
     // RT Pipeline
     //
 
-    std::vector<VulkanHelper::Shader::Define> defines;
-    if (m_EnableEnvMapMIS)
-        defines.push_back({"ENABLE_SKY_MIS", "1"});
-    if (m_EnableMeshMIS)
-        defines.push_back({"ENABLE_MESH_MIS", "1"});
-    if (m_ShowEnvMapDirectly)
-        defines.push_back({"SHOW_ENV_MAP_DIRECTLY", "1"});
-    if (m_UseOnlyGeometryNormals)
-        defines.push_back({"USE_ONLY_GEOMETRY_NORMALS", "1"});
-    if (m_UseEnergyCompensation)
-        defines.push_back({"USE_ENERGY_COMPENSATION", "1"});
-    if (m_FurnaceTestMode)
-        defines.push_back({"FURNACE_TEST_MODE", "1"});
-    if (m_UseRayQueries)
-        defines.push_back({"USE_RAY_QUERIES", "1"});
-    if (m_EnableAtmosphere)
-        defines.push_back({"ENABLE_ATMOSPHERE", "1"});
-
-    switch (m_PhaseFunction)
-    {
-    case PhaseFunction::HENYEY_GREENSTEIN:
-        defines.push_back({"PHASE_FUNCTION_HENYEY_GREENSTEIN", "1"});
-        break;
-    case PhaseFunction::DRAINE:
-        defines.push_back({"PHASE_FUNCTION_DRAINE", "1"});
-        break;
-    case PhaseFunction::HENYEY_GREENSTEIN_PLUS_DRAINE:
-        defines.push_back({"PHASE_FUNCTION_HENYEY_GREENSTEIN_PLUS_DRAINE", "1"});
-        break;
-
-    default:
-        VH_ASSERT(false, "Unknown phase function!");
-        break;
-    }
-
-    VulkanHelper::Shader::InitializeSession("../../PathTracer/Shaders/", (uint32_t)defines.size(), defines.data());
+    InitializeShaderSession();
     VulkanHelper::Shader rgenShader = VulkanHelper::Shader::New({m_Device, "RayGen.slang", VulkanHelper::ShaderStages::RAYGEN_BIT}).Value();
     VulkanHelper::Shader hitShader = VulkanHelper::Shader::New({m_Device, "ClosestHit.slang", VulkanHelper::ShaderStages::CLOSEST_HIT_BIT}).Value();
     VulkanHelper::Shader missShader = VulkanHelper::Shader::New({m_Device, "Miss.slang", VulkanHelper::ShaderStages::MISS_BIT}).Value();
@@ -671,6 +920,16 @@ void PathTracer::SetScene(const std::string& sceneFilePath)
 
     m_PathTracerPipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
 
+    CreateConvergencePipeline();
+    CreateReprojectionPipeline();
+    CreateGuidingPipeline(initializationCmd);
+    CreateAtmosphereTransmittancePipeline();
+
+    if (m_Integrator == Integrator::WAVEFRONT)
+        CreateWavefrontPipelines(initializationCmd);
+    else if (m_Integrator == Integrator::INLINE_RAY_QUERY)
+        CreateInlineRayQueryPipeline();
+
     VH_ASSERT(initializationCmd.EndRecording() == VulkanHelper::VHResult::OK, "Failed to end recording initialization command buffer");
     VH_ASSERT(initializationCmd.SubmitAndWait() == VulkanHelper::VHResult::OK, "Failed to submit initialization command buffer");
 }
@@ -682,31 +941,48 @@ void PathTracer::ResizeImage(uint32_t width, uint32_t height)
 
     // Update the output image view with the new dimensions
     CreateOutputImageView();
+    CreateAdaptiveSamplingBuffers();
+    CreateReprojectionBuffers();
+    CreateReservoirBuffers();
 
     // Update descriptor set
     VH_ASSERT(m_PathTracerDescriptorSet.AddImage(0, 0, &m_OutputImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add output image view to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(25, 0, &m_SampleMomentsBuffer) == VulkanHelper::VHResult::OK, "Failed to add sample moments buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(26, 0, &m_ConvergenceMaskBuffer) == VulkanHelper::VHResult::OK, "Failed to add convergence mask buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(27, 0, &m_AlbedoImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add albedo image view to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(28, 0, &m_NormalImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add normal image view to descriptor set");
+    AddReprojectionBuffersToDescriptorSet();
+    AddReservoirBuffersToDescriptorSet();
 
     ResetPathTracing();
 }
 
 void PathTracer::CreateOutputImageView()
 {
-    VulkanHelper::Image::Config outputImageConfig{};
-    outputImageConfig.Device = m_Device;
-    outputImageConfig.Width = m_Width;
-    outputImageConfig.Height = m_Height;
-    outputImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
-    outputImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT;
-
-    VulkanHelper::Image outputImage = VulkanHelper::Image::New(outputImageConfig).Value();
-
-    VulkanHelper::ImageView::Config outputImageViewConfig{};
-    outputImageViewConfig.image = outputImage;
-    outputImageViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
-    outputImageViewConfig.BaseLayer = 0;
-    outputImageViewConfig.LayerCount = 1;
+    // AOVs have the same size and format as the output, transfer is needed for the denoiser readback
+    auto createImageView = [this]()
+    {
+        VulkanHelper::Image::Config outputImageConfig{};
+        outputImageConfig.Device = m_Device;
+        outputImageConfig.Width = m_Width;
+        outputImageConfig.Height = m_Height;
+        outputImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
+        outputImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_SRC_BIT;
+
+        VulkanHelper::Image outputImage = VulkanHelper::Image::New(outputImageConfig).Value();
+
+        VulkanHelper::ImageView::Config outputImageViewConfig{};
+        outputImageViewConfig.image = outputImage;
+        outputImageViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
+        outputImageViewConfig.BaseLayer = 0;
+        outputImageViewConfig.LayerCount = 1;
+
+        return VulkanHelper::ImageView::New(outputImageViewConfig).Value();
+    };
 
-    m_OutputImageView = VulkanHelper::ImageView::New(outputImageViewConfig).Value();
+    m_OutputImageView = createImageView();
+    m_AlbedoImageView = createImageView();
+    m_NormalImageView = createImageView();
 }
 
 void PathTracer::SetMaterial(uint32_t index, const Material& material, VulkanHelper::CommandBuffer commandBuffer)
@@ -795,6 +1071,14 @@ void PathTracer::SetMaterial(uint32_t index, const Material& material, VulkanHel
 
     m_Materials[index] = material;
 
+    // Weights of the triangles depend on the emitted power, so the table is rebuilt even if the set of emissive meshes stays the same.
+    // Light trees of the instances are cached, only the top level of the light tree is built again
+    if (emissiveChanged)
+    {
+        BuildEmissiveTriangleTable(commandBuffer);
+        AddEmissiveTrianglesToDescriptorSet();
+    }
+
     // Create a staging buffer to upload material data
     VulkanHelper::Buffer::Config stagingBufferConfig{};
     stagingBufferConfig.Device = m_Device;
@@ -980,7 +1264,7 @@ void PathTracer::UploadDataToBuffer(VulkanHelper::Buffer buffer, void* data, uin
             VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT,
             VulkanHelper::AccessFlags::MEMORY_READ_BIT,
             VulkanHelper::PipelineStages::TRANSFER_BIT,
-            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT // Compute passes read the uniform too
         );
     }
 }
@@ -1023,6 +1307,7 @@ void PathTracer::SetSamplesPerFrame(uint32_t samplesPerFrame, VulkanHelper::Comm
 {
     m_SamplesPerFrame = samplesPerFrame;
     UploadDataToBuffer(m_PathTracerUniformBuffer, &samplesPerFrame, sizeof(uint32_t), offsetof(PathTracerUniform, SampleCount), commandBuffer);
+    m_PreviewActive = false; // Uniform doesn't hold the preview settings anymore, the next preview frame uploads them again
     ResetPathTracing();
 }
 
@@ -1052,15 +1337,25 @@ void PathTracer::SetEnvMapFilepath(const std::string& filePath, VulkanHelper::Co
     m_EnvMapFilepath = filePath;
 
     LoadEnvironmentMap(filePath, commandBuffer);
-    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(11, 0, &m_EnvMapTexture, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add env map texture to descriptor set");
-    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(12, 0, &m_EnvAliasMap) == VulkanHelper::VHResult::OK, "Failed to add env alias map buffer to descriptor set");
+    m_ApproximateSkyBaked = false;
+    m_ApproximateSkyPending = true;
+    AddEnvironmentMapToDescriptorSet();
+    ResetPathTracing();
+}
+
+void PathTracer::SetApproximateSky(bool enable, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_ApproximateSky = enable;
+    m_ApproximateSkyPending = true;
     ResetPathTracing();
+    ReloadShaders(commandBuffer);
 }
 
 void PathTracer::SetSkyAzimuth(float azimuth, VulkanHelper::CommandBuffer commandBuffer)
 {
     m_SkyRotationAzimuth = azimuth;
     UploadDataToBuffer(m_PathTracerUniformBuffer, &azimuth, sizeof(float), offsetof(PathTracerUniform, SkyRotationAzimuth), commandBuffer);
+    m_ApproximateSkyPending = true;
     ResetPathTracing();
 }
 
@@ -1068,17 +1363,20 @@ void PathTracer::SetSkyAltitude(float altitude, VulkanHelper::CommandBuffer comm
 {
     m_SkyRotationAltitude = altitude;
     UploadDataToBuffer(m_PathTracerUniformBuffer, &altitude, sizeof(float), offsetof(PathTracerUniform, SkyRotationAltitude), commandBuffer);
+    m_ApproximateSkyPending = true;
     ResetPathTracing();
 }
 
-void PathTracer::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
+void PathTracer::InitializeShaderSession()
 {
+    // Every compilation of the path tracer shaders starts here, so they never depend on a session left by someone else
     std::vector<VulkanHelper::Shader::Define> defines;
-
     if (m_EnableEnvMapMIS)
         defines.push_back({"ENABLE_SKY_MIS", "1"});
     if (m_EnableMeshMIS)
         defines.push_back({"ENABLE_MESH_MIS", "1"});
+    if (m_EnableMeshMIS && m_LightTree)
+        defines.push_back({"LIGHT_TREE", "1"});
     if (m_ShowEnvMapDirectly)
         defines.push_back({"SHOW_ENV_MAP_DIRECTLY", "1"});
     if (m_UseOnlyGeometryNormals)
@@ -1087,9 +1385,25 @@ void PathTracer::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
         defines.push_back({"USE_ENERGY_COMPENSATION", "1"});
     if (m_FurnaceTestMode)
         defines.push_back({"FURNACE_TEST_MODE", "1"});
-    if (m_UseRayQueries)
+    if (m_UseRayQueries || m_Integrator == Integrator::INLINE_RAY_QUERY) // Compute shaders can't use TraceRay
         defines.push_back({"USE_RAY_QUERIES", "1"});
-    if (m_EnableAtmosphere)
+    if (m_AdaptiveSampling)
+        defines.push_back({"ADAPTIVE_SAMPLING", "1"});
+    if (m_AOVsEnabled || m_TemporalReprojection) // Reprojection needs the first hit normals and distances
+        defines.push_back({"ENABLE_AOVS", "1"});
+    if (m_TemporalReprojection)
+        defines.push_back({"TEMPORAL_REPROJECTION", "1"});
+    if (m_ReSTIR)
+        defines.push_back({"ENABLE_RESTIR", "1"});
+    if (m_ReSTIR && m_ReSTIRUnbiased)
+        defines.push_back({"RESTIR_UNBIASED", "1"});
+    if (m_PathGuiding)
+        defines.push_back({"PATH_GUIDING", "1"});
+    if (m_SamplerType == SamplerType::SOBOL)
+        defines.push_back({"SOBOL_SAMPLER", "1"});
+    if (m_UseAtmosphereTransmittanceLUT)
+        defines.push_back({"ATMOSPHERE_TRANSMITTANCE_LUT", "1"});
+    if (m_EnableAtmosphere && !m_ApproximateSky) // Approximated sky is sampled as a regular environment map
         defines.push_back({"ENABLE_ATMOSPHERE", "1"});
 
     switch (m_PhaseFunction)
@@ -1110,6 +1424,11 @@ void PathTracer::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
     }
 
     VulkanHelper::Shader::InitializeSession("../../PathTracer/Shaders/", (uint32_t)defines.size(), defines.data());
+}
+
+void PathTracer::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    InitializeShaderSession();
     auto rgenShaderRes = VulkanHelper::Shader::New({m_Device, "RayGen.slang", VulkanHelper::ShaderStages::RAYGEN_BIT});
     auto hitShaderRes = VulkanHelper::Shader::New({m_Device, "ClosestHit.slang", VulkanHelper::ShaderStages::CLOSEST_HIT_BIT});
     auto missShaderRes = VulkanHelper::Shader::New({m_Device, "Miss.slang", VulkanHelper::ShaderStages::MISS_BIT});
@@ -1131,6 +1450,17 @@ void PathTracer::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
     pipelineConfig.CommandBuffer = &commandBuffer;
 
     m_PathTracerPipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+
+    CreateConvergencePipeline();
+    CreateReprojectionPipeline();
+    CreateGuidingPipeline(commandBuffer);
+    CreateAtmosphereTransmittancePipeline();
+
+    if (m_Integrator == Integrator::WAVEFRONT)
+        CreateWavefrontPipelines(commandBuffer);
+    else if (m_Integrator == Integrator::INLINE_RAY_QUERY)
+        CreateInlineRayQueryPipeline();
+
     ResetPathTracing();
 }
 
@@ -1139,10 +1469,109 @@ void PathTracer::LoadEnvironmentMap(const std::string& filePath, VulkanHelper::C
     VulkanHelper::AssetImporter importer = VulkanHelper::AssetImporter::New({m_ThreadPool}).Value();
     VulkanHelper::TextureAsset textureAsset = importer.ImportTexture(filePath).get().Value();
 
+    float* pixels = (float*)textureAsset.Data.Data(); // TODO wrong alignemnt
+    const std::vector<AliasMapEntry> aliasMap = CreateEnvironmentMapAliasMap(pixels, textureAsset.Width, textureAsset.Height);
+    UploadEnvironmentMap(pixels, aliasMap, textureAsset.Width, textureAsset.Height, commandBuffer);
+}
+
+void PathTracer::AddEnvironmentMapToDescriptorSet()
+{
+    VH_ASSERT(m_PathTracerDescriptorSet.AddImage(11, 0, &m_EnvMapTexture, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add env map texture to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(12, 0, &m_EnvAliasMap) == VulkanHelper::VHResult::OK, "Failed to add env alias map buffer to descriptor set");
+}
+
+void PathTracer::UpdateApproximateSky(VulkanHelper::CommandBuffer commandBuffer)
+{
+    if (m_SkyBakeState == SkyBakeState::READBACK && --m_SkyBakeReadbackFrames == 0)
+    {
+        StartApproximateSkyBake();
+    }
+    else if (m_SkyBakeState == SkyBakeState::BAKING && m_SkyBakeTask.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        m_SkyBakeState = SkyBakeState::IDLE;
+
+        // Even if the sky was changed again in the meantime, the result is closer to it than the current one
+        if (m_EnableAtmosphere && m_ApproximateSky)
+        {
+            UploadEnvironmentMap(m_SkyBakeJob->Pixels.data(), m_SkyBakeJob->AliasMap, APPROXIMATE_SKY_WIDTH, APPROXIMATE_SKY_HEIGHT, commandBuffer);
+            AddEnvironmentMapToDescriptorSet();
+            m_ApproximateSkyBaked = true;
+            ResetPathTracing();
+        }
+        m_SkyBakeJob.reset();
+    }
+
+    // Changes made while a bake is running are picked up once it's done
+    if (!m_ApproximateSkyPending || m_SkyBakeState != SkyBakeState::IDLE)
+        return;
+    m_ApproximateSkyPending = false;
+
+    if (m_EnableAtmosphere && m_ApproximateSky)
+    {
+        if (!m_AtmosphereTransmittancePipelineCreated)
+        {
+            VH_LOG_WARN("Atmosphere transmittance LUT isn't available, approximate sky can't be baked");
+            return;
+        }
+
+        // LUT was updated earlier in this command buffer if the atmosphere changed
+        m_AtmosphereTransmittanceLUT.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+        VH_ASSERT(m_SkyBakeReadbackBuffer.CopyFromImage(commandBuffer, m_AtmosphereTransmittanceLUT.GetImage()) == VulkanHelper::VHResult::OK, "Failed to copy atmosphere transmittance LUT to sky bake readback buffer");
+        m_AtmosphereTransmittanceLUT.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+
+        m_SkyBakeReadbackFrames = SKY_BAKE_READBACK_DELAY;
+        m_SkyBakeState = SkyBakeState::READBACK;
+    }
+    else if (m_ApproximateSkyBaked)
+    {
+        LoadEnvironmentMap(m_EnvMapFilepath, commandBuffer);
+        AddEnvironmentMapToDescriptorSet();
+        m_ApproximateSkyBaked = false;
+    }
+}
+
+void PathTracer::StartApproximateSkyBake()
+{
+    // Sky is seen from the world origin
+    SkyBaker::Config config{};
+    config.PlanetRadius = m_PlanetRadius;
+    config.AtmosphereHeight = m_AtmosphereHeight;
+    config.ViewPosition = -m_PlanetPosition;
+    config.RayleighScattering = RAYLEIGH_SCATTERING_COEFFICIENT * m_RayleighScatteringCoefficientMultiplier;
+    config.MieScattering = MIE_SCATTERING_COEFFICIENT * m_MieScatteringCoefficientMultiplier;
+    config.MieAbsorption = MIE_ABSORPTION_COEFFICIENT * m_MieScatteringCoefficientMultiplier;
+    config.OzoneAbsorption = OZONE_ABSORPTION_COEFFICIENT * m_OzoneAbsorptionCoefficientMultiplier;
+    config.RayleighDensityFalloff = m_RayleighDensityFalloff;
+    config.MieDensityFalloff = m_MieDensityFalloff;
+    config.OzoneDensityFalloff = m_OzoneDensityFalloff;
+    config.OzonePeak = m_OzonePeak;
+    config.SunRadiance = 2e5f * m_SunColor; // Same as in SampleSunDisk()
+    config.SunAngularRadius = SUN_ANGULAR_RADIUS;
+    config.SkyRotationAzimuth = m_SkyRotationAzimuth;
+    config.SkyRotationAltitude = m_SkyRotationAltitude;
+    config.ThreadPool = nullptr; // Bake itself runs on the pool, waiting there for row tasks in the same pool can deadlock it
+
+    config.TransmittanceLUTWidth = ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH;
+    config.TransmittanceLUTHeight = ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT;
+    config.TransmittanceLUT.resize((size_t)ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH * ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT);
+    std::memcpy(config.TransmittanceLUT.data(), m_SkyBakeReadbackBuffer.Map().Value(), config.TransmittanceLUT.size() * sizeof(glm::vec4));
+    m_SkyBakeReadbackBuffer.Unmap();
+
+    auto job = std::make_shared<SkyBakeJob>();
+    m_SkyBakeJob = job;
+    m_SkyBakeTask = m_ThreadPool->PushTask([job, config]() {
+        job->Pixels = SkyBaker::New(config).Bake(APPROXIMATE_SKY_WIDTH, APPROXIMATE_SKY_HEIGHT);
+        job->AliasMap = CreateEnvironmentMapAliasMap(job->Pixels.data(), APPROXIMATE_SKY_WIDTH, APPROXIMATE_SKY_HEIGHT);
+    });
+    m_SkyBakeState = SkyBakeState::BAKING;
+}
+
+void PathTracer::UploadEnvironmentMap(const float* pixels, const std::vector<AliasMapEntry>& aliasMap, uint32_t width, uint32_t height, VulkanHelper::CommandBuffer commandBuffer)
+{
     VulkanHelper::Image::Config imageConfig{};
     imageConfig.Device = m_Device;
-    imageConfig.Width = textureAsset.Width;
-    imageConfig.Height = textureAsset.Height;
+    imageConfig.Width = width;
+    imageConfig.Height = height;
     imageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
     imageConfig.Usage = VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_DST_BIT;
 
@@ -1158,18 +1587,47 @@ void PathTracer::LoadEnvironmentMap(const std::string& filePath, VulkanHelper::C
 
     m_EnvMapTexture = VulkanHelper::ImageView::New(imageViewConfig).Value();
 
-    const uint32_t width = textureAsset.Width;
-    const uint32_t height = textureAsset.Height;
+    // Create a staging buffer
+    VulkanHelper::Buffer::Config stagingBufferConfig{};
+    stagingBufferConfig.Device = m_Device;
+    stagingBufferConfig.Size = (uint64_t)width * height * 4 * sizeof(float);
+    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    stagingBufferConfig.CpuMapable = true;
+    stagingBufferConfig.DebugName = "EnvMap Staging Buffer";
+
+    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
+
+    VH_ASSERT(stagingBuffer.UploadData(pixels, stagingBufferConfig.Size, 0) == VulkanHelper::VHResult::OK, "Failed to upload texture data");
+
+    VH_ASSERT(stagingBuffer.CopyToImage(
+        commandBuffer,
+        textureImage
+    ) == VulkanHelper::VHResult::OK, "Failed to copy staging buffer to image");
+
+    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+
+    // Finally send the alias map to the GPU
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(AliasMapEntry) * aliasMap.size();
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.DebugName = "EnvAliasMap";
+
+    m_EnvAliasMap = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    bufferConfig.CpuMapable = true;
+    VulkanHelper::Buffer aliasMapStagingBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    VH_ASSERT(aliasMapStagingBuffer.UploadData(aliasMap.data(), bufferConfig.Size, 0) == VulkanHelper::VHResult::OK, "Failed to upload environment alias map data");
+    VH_ASSERT(m_EnvAliasMap.CopyFromBuffer(commandBuffer, aliasMapStagingBuffer, 0, 0, bufferConfig.Size) == VulkanHelper::VHResult::OK, "Failed to copy environment alias map buffer");
+}
+
+std::vector<PathTracer::AliasMapEntry> PathTracer::CreateEnvironmentMapAliasMap(float* pixels, uint32_t width, uint32_t height)
+{
     const uint64_t size = width * height;
-    float* pixels = (float*)textureAsset.Data.Data(); // TODO wrong alignemnt
 
     // Create Importance Buffer for Importance Sampling
-    struct AliasMapEntry
-    {
-        uint32_t Alias; // Alias pointing to another texel
-        float Importance; // Importance of the current texel
-    };
-
     std::vector<AliasMapEntry> importanceBuffer(width * height);
     std::vector<float> importanceData(width * height);
 
@@ -1295,44 +1753,20 @@ void PathTracer::LoadEnvironmentMap(const std::string& filePath, VulkanHelper::C
 		    pixels[idx4 + 3] = glm::max(pixels[idx4], glm::max(pixels[idx4 + 1], pixels[idx4 + 2])) / sum;
 	}
 
-    // Create a staging buffer
-    VulkanHelper::Buffer::Config stagingBufferConfig{};
-    stagingBufferConfig.Device = m_Device;
-    stagingBufferConfig.Size = textureAsset.Data.Size() * sizeof(uint8_t);
-    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
-    stagingBufferConfig.CpuMapable = true;
-    stagingBufferConfig.DebugName = "EnvMap Staging Buffer";
-
-    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
-
-    VH_ASSERT(stagingBuffer.UploadData(pixels, textureAsset.Data.Size() * sizeof(uint8_t), 0) == VulkanHelper::VHResult::OK, "Failed to upload texture data");
-
-    VH_ASSERT(stagingBuffer.CopyToImage(
-        commandBuffer,
-        textureImage
-    ) == VulkanHelper::VHResult::OK, "Failed to copy staging buffer to image");
-
-    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
-
-    // Finally send the alias map to the GPU
-    VulkanHelper::Buffer::Config bufferConfig{};
-    bufferConfig.Device = m_Device;
-    bufferConfig.Size = sizeof(AliasMapEntry) * aliasMap.size();
-    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
-    bufferConfig.DebugName = "EnvAliasMap";
-
-    m_EnvAliasMap = VulkanHelper::Buffer::New(bufferConfig).Value();
-
-    bufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
-    bufferConfig.CpuMapable = true;
-    VulkanHelper::Buffer aliasMapStagingBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
-
-    VH_ASSERT(aliasMapStagingBuffer.UploadData(aliasMap.data(), bufferConfig.Size, 0) == VulkanHelper::VHResult::OK, "Failed to upload environment alias map data");
-    VH_ASSERT(m_EnvAliasMap.CopyFromBuffer(commandBuffer, aliasMapStagingBuffer, 0, 0, bufferConfig.Size) == VulkanHelper::VHResult::OK, "Failed to copy environment alias map buffer");
+    return aliasMap;
 }
 
 void PathTracer::AddVolume(const Volume& volume, VulkanHelper::CommandBuffer commandBuffer)
 {
+    if (m_Volumes.size() >= MAX_ENTITIES)
+    {
+        VH_LOG_ERROR("Max volume count reached: {}", MAX_ENTITIES);
+        return;
+    }
+
+    // Copies of volumes with density data share the grids
+    AcquireVolumeGrids(volume);
+
     VolumeGPU volumeGPU(volume);
 
     UploadDataToBuffer(m_VolumesBuffer, &volumeGPU, sizeof(VolumeGPU), (uint32_t)m_Volumes.size() * sizeof(VolumeGPU), commandBuffer);
@@ -1341,36 +1775,130 @@ void PathTracer::AddVolume(const Volume& volume, VulkanHelper::CommandBuffer com
     // Update Uniform Buffer
     uint32_t count = (uint32_t)m_Volumes.size();
     UploadDataToBuffer(m_PathTracerUniformBuffer, &count, sizeof(uint32_t), offsetof(PathTracerUniform, VolumesCount), commandBuffer);
+    RebuildVolumeBVH(commandBuffer);
     ResetPathTracing();
 }
 
-void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::RebuildVolumeBVH(VulkanHelper::CommandBuffer commandBuffer)
 {
-    if (volumeIndex >= m_Volumes.size())
-    {
-        VH_LOG_ERROR("Volume index out of range: {}/{}", volumeIndex, m_Volumes.size());
+    m_VolumeBVHNodes.clear();
+    if (m_Volumes.empty())
         return;
-    }
-    auto& volume = m_Volumes[volumeIndex];
 
-    if (std::filesystem::exists(filepath) == false)
+    struct BuildEntry
     {
-        VH_LOG_ERROR("OPENDVDB file does not exist: {}", filepath);
-        return;
-    }
-
-    VH_LOG_DEBUG("Loading OPENDVDB volume: {}", filepath);
-    openvdb::io::File file(filepath);
+        glm::vec3 CornerMin;
+        glm::vec3 CornerMax;
+        glm::vec3 Center;
+        int VolumeIndex;
+    };
 
-    try {
-        file.open();  // This will throw if the file can't be opened
-    } catch (const openvdb::IoError& e) {
-        VH_LOG_ERROR("Failed to open OpenVDB file '{}': {}", filepath, e.what());
-        return;
+    std::vector<BuildEntry> entries(m_Volumes.size());
+    for (uint32_t i = 0; i < (uint32_t)m_Volumes.size(); i++)
+    {
+        // Same transform as in VolumeGPU, min and max have to be recomputed in case the scale is negative
+        glm::vec3 a = m_Volumes[i].Position + (m_Volumes[i].CornerMin * m_Volumes[i].Scale);
+        glm::vec3 b = m_Volumes[i].Position + (m_Volumes[i].CornerMax * m_Volumes[i].Scale);
+        entries[i].CornerMin = glm::min(a, b);
+        entries[i].CornerMax = glm::max(a, b);
+        entries[i].Center = (a + b) * 0.5f;
+        entries[i].VolumeIndex = (int)i;
+    }
+
+    m_VolumeBVHNodes.reserve(entries.size() * 2 - 1);
+    m_VolumeBVHNodes.push_back({});
+
+    // Top down build with median split along the longest axis of the centers, volume counts are
+    // small so there's no need for anything fancier. Median split also keeps the depth at log2(N)
+    std::function<void(uint32_t, uint32_t, uint32_t)> buildNode = [&](uint32_t nodeIndex, uint32_t begin, uint32_t end)
+    {
+        VolumeBVHNode node{};
+        node.CornerMin = glm::vec3(FLT_MAX);
+        node.CornerMax = glm::vec3(-FLT_MAX);
+        glm::vec3 centerMin = glm::vec3(FLT_MAX);
+        glm::vec3 centerMax = glm::vec3(-FLT_MAX);
+        for (uint32_t i = begin; i < end; i++)
+        {
+            node.CornerMin = glm::min(node.CornerMin, entries[i].CornerMin);
+            node.CornerMax = glm::max(node.CornerMax, entries[i].CornerMax);
+            centerMin = glm::min(centerMin, entries[i].Center);
+            centerMax = glm::max(centerMax, entries[i].Center);
+        }
+
+        if (end - begin == 1)
+        {
+            node.LeftChild = -1;
+            node.VolumeIndex = entries[begin].VolumeIndex;
+            m_VolumeBVHNodes[nodeIndex] = node;
+            return;
+        }
+
+        glm::vec3 extent = centerMax - centerMin;
+        int axis = 0;
+        if (extent.y > extent.x)
+            axis = 1;
+        if (extent.z > extent[axis])
+            axis = 2;
+
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(entries.begin() + begin, entries.begin() + middle, entries.begin() + end, [axis](const BuildEntry& a, const BuildEntry& b) {
+            return a.Center[axis] < b.Center[axis];
+        });
+
+        node.LeftChild = (int)m_VolumeBVHNodes.size();
+        node.VolumeIndex = -1;
+        m_VolumeBVHNodes[nodeIndex] = node;
+
+        // Children are allocated next to each other
+        m_VolumeBVHNodes.push_back({});
+        m_VolumeBVHNodes.push_back({});
+        buildNode((uint32_t)node.LeftChild, begin, middle);
+        buildNode((uint32_t)node.LeftChild + 1, middle, end);
+    };
+
+    buildNode(0, 0, (uint32_t)entries.size());
+
+    UploadDataToBuffer(m_VolumeBVHBuffer, m_VolumeBVHNodes.data(), sizeof(VolumeBVHNode) * m_VolumeBVHNodes.size(), 0, commandBuffer);
+}
+
+// Converts the grid into NanoVDB, quantizing it if requested. valueRange is used to make the FPN tolerance relative
+static nanovdb::GridHandle<nanovdb::HostBuffer> CreateNanoGrid(const openvdb::FloatGrid& grid, const PathTracer::VolumeImportSettings& importSettings, float valueRange)
+{
+    switch (importSettings.Quantization)
+    {
+    case PathTracer::GridQuantization::FP16:
+        return nanovdb::tools::createNanoGrid<openvdb::FloatGrid, nanovdb::Fp16>(grid);
+    case PathTracer::GridQuantization::FP8:
+        return nanovdb::tools::createNanoGrid<openvdb::FloatGrid, nanovdb::Fp8>(grid);
+    case PathTracer::GridQuantization::FPN:
+    {
+        nanovdb::tools::AbsDiff oracle(glm::max(importSettings.Tolerance * valueRange, 1e-6f));
+        return nanovdb::tools::createNanoGrid<openvdb::FloatGrid, nanovdb::FpN>(grid, nanovdb::tools::StatsMode::Default, nanovdb::CheckMode::Default, false, 0, oracle);
+    }
+    default:
+        return nanovdb::tools::createNanoGrid(grid);
+    }
+}
+
+// Reads density and temperature grids from a VDB file, temperature grid is optional
+static bool ReadVDBGrids(const std::string& filepath, openvdb::GridBase::Ptr& densityGrid, openvdb::GridBase::Ptr& temperatureGrid)
+{
+    if (std::filesystem::exists(filepath) == false)
+    {
+        VH_LOG_ERROR("OPENDVDB file does not exist: {}", filepath);
+        return false;
+    }
+
+    VH_LOG_DEBUG("Loading OPENDVDB volume: {}", filepath);
+    openvdb::io::File file(filepath);
+
+    try {
+        file.open();  // This will throw if the file can't be opened
+    } catch (const openvdb::IoError& e) {
+        VH_LOG_ERROR("Failed to open OpenVDB file '{}': {}", filepath, e.what());
+        return false;
     }
 
-    openvdb::GridBase::Ptr densityGrid;
-    openvdb::GridBase::Ptr temperatureGrid;
     for (openvdb::io::File::NameIterator nameIter = file.beginName(); nameIter != file.endName(); ++nameIter)
     {
         VH_LOG_DEBUG("Found grid in VDB file: {}", nameIter.gridName());
@@ -1385,13 +1913,48 @@ void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string&
         }
     }
     file.close();
-    VH_ASSERT(densityGrid != nullptr, "Density grid not found in VDB file. Volumes without density grid are not supported yet.");
+
+    // This can run on a worker thread so don't assert here
+    if (densityGrid == nullptr)
+    {
+        VH_LOG_ERROR("Density grid not found in VDB file '{}'. Volumes without density grid are not supported yet.", filepath);
+        return false;
+    }
+
+    return true;
+}
+
+// Bounding box of the grid scaled down so that it's more or less -1 to 1
+static void ComputeVolumeCorners(const openvdb::CoordBBox& bbox, glm::vec3& cornerMin, glm::vec3& cornerMax)
+{
+    openvdb::math::Coord min = bbox.min();
+    openvdb::math::Coord max = bbox.max();
+
+    cornerMin = glm::vec3(min.x(), min.y(), min.z());
+    cornerMax = glm::vec3(max.x(), max.y(), max.z());
+
+    float maxDimX = glm::max(glm::abs(min.x()), glm::abs(max.x()));
+    float maxDimY = glm::max(glm::abs(min.y()), glm::abs(max.y()));
+    float maxDimZ = glm::max(glm::abs(min.z()), glm::abs(max.z()));
+    float maxDim = glm::max(maxDimX, glm::max(maxDimY, maxDimZ));
+    cornerMin /= maxDim;
+    cornerMax /= maxDim;
+}
+
+std::shared_ptr<PathTracer::VolumeGridData> PathTracer::LoadVolumeGridData(const std::string& filepath, const VolumeImportSettings& importSettings)
+{
+    openvdb::GridBase::Ptr densityGrid;
+    openvdb::GridBase::Ptr temperatureGrid;
+    if (!ReadVDBGrids(filepath, densityGrid, temperatureGrid))
+        return nullptr;
+
+    std::shared_ptr<VolumeGridData> gridData = std::make_shared<VolumeGridData>();
 
     openvdb::FloatGrid::Ptr floatGridDensity = openvdb::gridPtrCast<openvdb::FloatGrid>(densityGrid);
     
     // Precompute max densities for empty space skipping
     float maxDensity = openvdb::tools::minMax(floatGridDensity->tree(), true).max();
-    volume.MaxDensityInTheGrid = maxDensity;
+    gridData->MaxDensityInTheGrid = maxDensity;
 
     VH_LOG_DEBUG("Density range: 0.0 - {}", maxDensity);
     
@@ -1408,22 +1971,11 @@ void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string&
 
     openvdb::math::Coord dim = floatGridDensity->evalActiveVoxelDim();
     openvdb::math::Coord min = floatGridDensity->evalActiveVoxelBoundingBox().min();
-    openvdb::math::Coord max = floatGridDensity->evalActiveVoxelBoundingBox().max();
-
-    volume.CornerMin = glm::vec3(min.x(), min.y(), min.z());
-    volume.CornerMax = glm::vec3(max.x(), max.y(), max.z());
 
-    // // Scale it down so AABB is more or less -1 to 1
-    float maxDimX = glm::max(glm::abs(min.x()), glm::abs(max.x()));
-    float maxDimY = glm::max(glm::abs(min.y()), glm::abs(max.y()));
-    float maxDimZ = glm::max(glm::abs(min.z()), glm::abs(max.z()));
-    float maxDim = glm::max(maxDimX, glm::max(maxDimY, maxDimZ));
-    volume.CornerMin /= maxDim;
-    volume.CornerMax /= maxDim;
+    ComputeVolumeCorners(floatGridDensity->evalActiveVoxelBoundingBox(), gridData->CornerMin, gridData->CornerMax);
 
     // For each volume there is 32x32x32 grid of max densities precomputed for empty space skipping
-    std::array<float, 32768> volumeMaxDensities;
-    volumeMaxDensities.fill(0.0f);
+    gridData->MaxDensities.resize(32768, 0.0f);
 
     // Prepare max densities and normalize temperature grid if present
     for (int z = 0; z < dim.z(); z++)
@@ -1437,8 +1989,8 @@ void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string&
                 float density = glm::clamp(floatGridDensity->tree().getValue(coord) / maxDensity, 0.0f, 1.0f); // Normalize to [0, 1]
 
                 int maxDensityGridIndex = ((x * 32) / dim.x()) + ((y * 32) / dim.y()) * 32 + ((z * 32) / dim.z()) * 1024;
-                if (volumeMaxDensities[(uint32_t)maxDensityGridIndex] < density)
-                    volumeMaxDensities[(uint32_t)maxDensityGridIndex] = density;
+                if (gridData->MaxDensities[(uint32_t)maxDensityGridIndex] < density)
+                    gridData->MaxDensities[(uint32_t)maxDensityGridIndex] = density;
 
                 // If temperature grid is present, modify the values so that they are rescaled from 0 to 1
                 if (temperatureGrid)
@@ -1458,343 +2010,2345 @@ void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string&
 
     // Density
     {
-        nanovdb::GridHandle<nanovdb::HostBuffer> nanoGridHandleDensity = nanovdb::tools::createNanoGrid(*floatGridDensity);
+        nanovdb::GridHandle<nanovdb::HostBuffer> nanoGridHandleDensity = CreateNanoGrid(*floatGridDensity, importSettings, maxDensity);
 
         VH_LOG_DEBUG("Density data size: {} MB", ((float)nanoGridHandleDensity.buffer().size()) / (1024.0f * 1024.0f));
         VH_LOG_DEBUG("Volume dimensions: x: {} y: {} z: {}", dim.x(), dim.y(), dim.z());
         VH_LOG_DEBUG("Max Density: {}", maxDensity);
 
+        const uint8_t* data = nanoGridHandleDensity.buffer().data();
+        gridData->DensityNanoGrid.assign(data, data + nanoGridHandleDensity.buffer().size());
+    }
+
+    // Temperature
+    if (temperatureGrid)
+    {
+        nanovdb::GridHandle<nanovdb::HostBuffer> nanoGridHandleTemperature = CreateNanoGrid(*floatGridTemperature, importSettings, glm::max(glm::abs(minTemperature), glm::abs(maxTemperature)));
+
+        VH_LOG_DEBUG("NanoVDB volume temperature data size: {} MB", ((float)nanoGridHandleTemperature.buffer().size()) / (1024.0f * 1024.0f));
+
+        const uint8_t* data = nanoGridHandleTemperature.buffer().data();
+        gridData->TemperatureNanoGrid.assign(data, data + nanoGridHandleTemperature.buffer().size());
+    }
+
+    return gridData;
+}
+
+// Splits the density grid into bricks and writes them into the cache file read by VolumeBrickStreamer.
+// Only bricks overlapping active leaves and tiles are visited, so the time it takes depends on the amount
+// of data in the grid and not on the size of its bounding box.
+static bool WriteVolumeBrickFile(const openvdb::FloatGrid& grid, const std::string& cacheFilepath)
+{
+    constexpr uint32_t brickSize = VolumeBrickStreamer::BRICK_SIZE;
+
+    openvdb::CoordBBox bbox = grid.evalActiveVoxelBoundingBox();
+    openvdb::math::Coord min = bbox.min();
+    openvdb::math::Coord dim = bbox.dim();
+
+    VolumeBrickStreamer::FileHeader header{};
+    header.VoxelCount = glm::uvec3(dim.x(), dim.y(), dim.z());
+    header.MaxDensityInTheGrid = openvdb::tools::minMax(grid.tree(), true).max();
+    ComputeVolumeCorners(bbox, header.CornerMin, header.CornerMax);
+
+    glm::uvec3 brickCount = (header.VoxelCount + glm::uvec3(brickSize - 1)) / glm::uvec3(brickSize);
+    uint64_t totalBrickCount = (uint64_t)brickCount.x * brickCount.y * brickCount.z;
+    if (totalBrickCount >= VolumeBrickStreamer::BRICK_NOT_RESIDENT)
+    {
+        VH_LOG_ERROR("Volume is too big to be bricked: {}x{}x{} voxels", dim.x(), dim.y(), dim.z());
+        return false;
+    }
+
+    // Local voxel coordinates have Y flipped the same way regular grids have, so the shader doesn't have to
+    auto toLocal = [&](const openvdb::math::Coord& coord) {
+        return glm::ivec3(coord.x() - min.x(), dim.y() - 1 - (coord.y() - min.y()), coord.z() - min.z());
+    };
+
+    std::vector<uint8_t> brickHasData(totalBrickCount, 0);
+    auto markBricks = [&](const openvdb::CoordBBox& box) {
+        glm::ivec3 a = toLocal(box.min());
+        glm::ivec3 b = toLocal(box.max());
+        glm::ivec3 first = glm::clamp(glm::min(a, b), glm::ivec3(0), glm::ivec3(header.VoxelCount) - 1) / (int)brickSize;
+        glm::ivec3 last = glm::clamp(glm::max(a, b), glm::ivec3(0), glm::ivec3(header.VoxelCount) - 1) / (int)brickSize;
+        for (int z = first.z; z <= last.z; z++)
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                    brickHasData[(uint64_t)x + (uint64_t)y * brickCount.x + (uint64_t)z * brickCount.x * brickCount.y] = 1;
+    };
+
+    for (openvdb::FloatTree::LeafCIter leaf = grid.tree().cbeginLeaf(); leaf; ++leaf)
+        markBricks(leaf->getNodeBoundingBox());
+
+    // Active tiles in upper nodes, voxels are already covered by the leaves
+    openvdb::FloatTree::ValueOnCIter tile = grid.tree().cbeginValueOn();
+    tile.setMaxDepth(openvdb::FloatTree::ValueOnCIter::LEAF_DEPTH - 1);
+    for (; tile; ++tile)
+    {
+        openvdb::CoordBBox tileBox;
+        tile.getBoundingBox(tileBox);
+        markBricks(tileBox);
+    }
+
+    std::filesystem::create_directories(std::filesystem::path(cacheFilepath).parent_path());
+    std::ofstream file(cacheFilepath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        VH_LOG_ERROR("Failed to create volume brick file: {}", cacheFilepath);
+        return false;
+    }
+
+    // Header is rewritten once all offsets are known
+    file.write((const char*)&header, sizeof(header));
+    header.BrickDataOffset = sizeof(header);
+
+    std::vector<VolumeBrickStreamer::FilePageTableEntry> pageTable(totalBrickCount, { VolumeBrickStreamer::BRICK_EMPTY, 0.0f });
+    std::vector<float> maxDensities(32768, 0.0f);
+    std::array<float, VolumeBrickStreamer::BRICK_VOXEL_COUNT> brick;
+    openvdb::FloatGrid::ConstAccessor accessor = grid.getConstAccessor();
+
+    for (uint32_t bz = 0; bz < brickCount.z; bz++)
+    {
+        for (uint32_t by = 0; by < brickCount.y; by++)
+        {
+            for (uint32_t bx = 0; bx < brickCount.x; bx++)
+            {
+                uint64_t brickIndex = (uint64_t)bx + (uint64_t)by * brickCount.x + (uint64_t)bz * brickCount.x * brickCount.y;
+                if (!brickHasData[brickIndex])
+                    continue;
+
+                float densitySum = 0.0f;
+                for (uint32_t z = 0; z < brickSize; z++)
+                {
+                    for (uint32_t y = 0; y < brickSize; y++)
+                    {
+                        for (uint32_t x = 0; x < brickSize; x++)
+                        {
+                            glm::uvec3 voxel = glm::uvec3(bx, by, bz) * brickSize + glm::uvec3(x, y, z);
+                            float& value = brick[x + y * brickSize + z * brickSize * brickSize];
+                            if (glm::any(glm::greaterThanEqual(voxel, header.VoxelCount)))
+                            {
+                                value = 0.0f;
+                                continue;
+                            }
+
+                            openvdb::math::Coord coord(min.x() + (int)voxel.x, min.y() + (dim.y() - 1 - (int)voxel.y), min.z() + (int)voxel.z);
+                            value = glm::max(accessor.getValue(coord), 0.0f);
+                            densitySum += value;
+
+                            float density = glm::clamp(value / header.MaxDensityInTheGrid, 0.0f, 1.0f);
+                            uint32_t maxDensityGridIndex = ((voxel.x * 32) / header.VoxelCount.x) + ((voxel.y * 32) / header.VoxelCount.y) * 32 + ((voxel.z * 32) / header.VoxelCount.z) * 1024;
+                            maxDensities[maxDensityGridIndex] = glm::max(maxDensities[maxDensityGridIndex], density);
+                        }
+                    }
+                }
+
+                if (densitySum <= 0.0f)
+                    continue;
+
+                pageTable[brickIndex] = { header.StoredBrickCount++, densitySum / (float)VolumeBrickStreamer::BRICK_VOXEL_COUNT };
+                file.write((const char*)brick.data(), sizeof(float) * brick.size());
+            }
+        }
+    }
+
+    header.PageTableOffset = header.BrickDataOffset + sizeof(float) * VolumeBrickStreamer::BRICK_VOXEL_COUNT * (uint64_t)header.StoredBrickCount;
+    file.write((const char*)pageTable.data(), sizeof(VolumeBrickStreamer::FilePageTableEntry) * pageTable.size());
+
+    header.MaxDensitiesOffset = header.PageTableOffset + sizeof(VolumeBrickStreamer::FilePageTableEntry) * pageTable.size();
+    file.write((const char*)maxDensities.data(), sizeof(float) * maxDensities.size());
+
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+
+    if (!file.good())
+    {
+        VH_LOG_ERROR("Failed to write volume brick file: {}", cacheFilepath);
+        return false;
+    }
+
+    VH_LOG_DEBUG("Volume bricked: {} of {} bricks have data, {} MB on disk", header.StoredBrickCount, totalBrickCount, (float)(header.MaxDensitiesOffset + sizeof(float) * maxDensities.size()) / (1024.0f * 1024.0f));
+    return true;
+}
+
+static uint64_t GetVolumeGridDataSize(const PathTracer::VolumeGridData& gridData)
+{
+    return gridData.DensityNanoGrid.size() + gridData.TemperatureNanoGrid.size() + sizeof(float) * gridData.MaxDensities.size();
+}
+
+// Same file imported with different settings produces a different grid, so the settings are part of the key
+static std::string GetVolumeGridKey(const std::string& filepath, const PathTracer::VolumeImportSettings& importSettings)
+{
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::weakly_canonical(filepath, error);
+    std::string key = error ? filepath : path.string();
+
+    if (importSettings.Streamed)
+    {
+        key += "|streamed|" + std::to_string(importSettings.BrickPoolSizeMB);
+        return key;
+    }
+
+    key += "|" + std::to_string((int)importSettings.Quantization);
+    if (importSettings.Quantization == PathTracer::GridQuantization::FPN)
+        key += "|" + std::to_string(importSettings.Tolerance);
+
+    return key;
+}
+
+void PathTracer::UploadVolumeGridData(Volume& volume, const VolumeGridData& gridData, int densityDataIndex, VulkanHelper::CommandBuffer commandBuffer)
+{
+    volume.BrickStreamer = nullptr;
+    volume.CornerMin = gridData.CornerMin;
+    volume.CornerMax = gridData.CornerMax;
+    volume.MaxDensityInTheGrid = gridData.MaxDensityInTheGrid;
+
+    // New buffers are created every time instead of reusing the old ones, the old ones
+    // are released with a frame delay so frames that are still in flight can finish reading them
+    {
         VulkanHelper::Buffer::Config bufferConfig{};
         bufferConfig.Device = m_Device;
         bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
         bufferConfig.DebugName = "NanoVDB Density Grid";
-        bufferConfig.Size = nanoGridHandleDensity.buffer().size();
+        bufferConfig.Size = gridData.DensityNanoGrid.size();
         
         volume.VolumeNanoBufferDensity = VulkanHelper::Buffer::New(bufferConfig).Value();
 
-        UploadDataToBuffer(volume.VolumeNanoBufferDensity, nanoGridHandleDensity.buffer().data(), (uint32_t)nanoGridHandleDensity.buffer().size(), 0, commandBuffer);
+        UploadDataToBuffer(volume.VolumeNanoBufferDensity, (void*)gridData.DensityNanoGrid.data(), gridData.DensityNanoGrid.size(), 0, commandBuffer);
     }
 
-    // Temperature
-    nanovdb::GridHandle<nanovdb::HostBuffer> nanoGridHandleTemperature;
-    if (temperatureGrid)
+    volume.VolumeNanoBufferTemperature = VulkanHelper::Buffer();
+    if (!gridData.TemperatureNanoGrid.empty())
     {
-        openvdb::FloatGrid::Ptr floatGridTemperature = openvdb::gridPtrCast<openvdb::FloatGrid>(temperatureGrid);
-        nanoGridHandleTemperature = nanovdb::tools::createNanoGrid(*floatGridTemperature);
-
         VulkanHelper::Buffer::Config bufferConfig{};
         bufferConfig.Device = m_Device;
         bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
-        bufferConfig.Size = nanoGridHandleTemperature.buffer().size();
+        bufferConfig.Size = gridData.TemperatureNanoGrid.size();
         bufferConfig.DebugName = "NanoVDB Temperature Grid";
         
         volume.VolumeNanoBufferTemperature = VulkanHelper::Buffer::New(bufferConfig).Value();
 
-        VH_LOG_DEBUG("Uploading NanoVDB volume temperature data, size: {} MB", ((float)nanoGridHandleTemperature.buffer().size()) / (1024.0f * 1024.0f));
-
-        UploadDataToBuffer(volume.VolumeNanoBufferTemperature, nanoGridHandleTemperature.buffer().data(), (uint32_t)nanoGridHandleTemperature.buffer().size(), 0, commandBuffer);
+        UploadDataToBuffer(volume.VolumeNanoBufferTemperature, (void*)gridData.TemperatureNanoGrid.data(), gridData.TemperatureNanoGrid.size(), 0, commandBuffer);
     }
 
     VulkanHelper::Buffer::Config bufferConfig{};
     bufferConfig.Device = m_Device;
-    bufferConfig.Size = sizeof(float) * volumeMaxDensities.size();
+    bufferConfig.Size = sizeof(float) * gridData.MaxDensities.size();
     bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
     bufferConfig.DebugName = "VolumeMaxDensities";
 
     volume.MaxDensitiesBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
 
-    UploadDataToBuffer(volume.MaxDensitiesBuffer, volumeMaxDensities.data(), (uint32_t)bufferConfig.Size, 0, commandBuffer);
+    UploadDataToBuffer(volume.MaxDensitiesBuffer, (void*)gridData.MaxDensities.data(), bufferConfig.Size, 0, commandBuffer);
         
-    static int densityDataIndex = 0;
     VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(15, (uint32_t)densityDataIndex, &volume.VolumeNanoBufferDensity) == VulkanHelper::VHResult::OK, "Failed to add volume density textures buffer to descriptor set");
-    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(16, (uint32_t)densityDataIndex, temperatureGrid ? &volume.VolumeNanoBufferTemperature : nullptr) == VulkanHelper::VHResult::OK, "Failed to add volume temperature textures buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(16, (uint32_t)densityDataIndex, volume.VolumeNanoBufferTemperature != nullptr ? &volume.VolumeNanoBufferTemperature : nullptr) == VulkanHelper::VHResult::OK, "Failed to add volume temperature textures buffer to descriptor set");
     VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(17, (uint32_t)densityDataIndex, &volume.MaxDensitiesBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume max densities buffer to descriptor set");
     volume.DensityDataIndex = densityDataIndex;
-    densityDataIndex = (densityDataIndex + 1) % (int)MAX_HETEROGENEOUS_VOLUMES;
 
-    SetVolume(volumeIndex, volume, commandBuffer);
+    m_VolumeGridManager.SetGrid(
+        densityDataIndex,
+        { volume.VolumeNanoBufferDensity, volume.VolumeNanoBufferTemperature, volume.MaxDensitiesBuffer },
+        { gridData.CornerMin, gridData.CornerMax, gridData.MaxDensityInTheGrid },
+        GetVolumeGridDataSize(gridData)
+    );
 }
 
-void PathTracer::RemoveDensityDataFromVolume(uint32_t volumeIndex, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AssignResidentVolumeGrid(Volume& volume, int densityDataIndex)
 {
-    auto& volume = m_Volumes[volumeIndex];
-    volume.VolumeNanoBufferDensity = VulkanHelper::Buffer();
-    volume.VolumeNanoBufferTemperature = VulkanHelper::Buffer();
-    volume.DensityDataIndex = -1;
-    volume.MaxDensitiesBuffer = VulkanHelper::Buffer();
-    volume.CornerMin = glm::vec3(-1.0f);
-    volume.CornerMax = glm::vec3(1.0f);
-    SetVolume(volumeIndex, volume, commandBuffer);
+    const VolumeGridManager::GridBuffers& buffers = m_VolumeGridManager.GetBuffers(densityDataIndex);
+    const VolumeGridManager::GridInfo& info = m_VolumeGridManager.GetInfo(densityDataIndex);
+    volume.VolumeNanoBufferDensity = buffers.Density;
+    volume.VolumeNanoBufferTemperature = buffers.Temperature;
+    volume.MaxDensitiesBuffer = buffers.MaxDensities;
+    volume.BrickStreamer = buffers.BrickStreamer;
+    volume.CornerMin = info.CornerMin;
+    volume.CornerMax = info.CornerMax;
+    volume.MaxDensityInTheGrid = info.MaxDensityInTheGrid;
+    volume.DensityDataIndex = densityDataIndex;
 }
 
-void PathTracer::RemoveVolume(uint32_t index, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AcquireVolumeGrids(const Volume& volume)
 {
-    // It will remove the volume from the array and move all subsequent volumes down to fill the gap
-    uint32_t volumesToMove = (uint32_t)m_Volumes.size() - index - 1;
-    m_Volumes.erase(m_Volumes.begin() + index);
-    if (volumesToMove > 0)
+    if (volume.Sequence != nullptr)
     {
-        std::vector<VolumeGPU> volumes(volumesToMove);
-        DownloadDataFromBuffer(m_VolumesBuffer, volumes.data(), sizeof(VolumeGPU) * volumesToMove, (index + 1) * sizeof(VolumeGPU), commandBuffer);
-        UploadDataToBuffer(m_VolumesBuffer, volumes.data(), sizeof(VolumeGPU) * volumesToMove, index * sizeof(VolumeGPU), commandBuffer);
+        m_VolumeGridManager.AddReference(volume.Sequence->DensityDataIndices[0]);
+        m_VolumeGridManager.AddReference(volume.Sequence->DensityDataIndices[1]);
+    }
+    else if (volume.DensityDataIndex != -1)
+    {
+        m_VolumeGridManager.AddReference(volume.DensityDataIndex);
     }
-
-    uint32_t volumeCount = (uint32_t)m_Volumes.size();
-
-    // Update Uniform Buffer
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &volumeCount, sizeof(uint32_t), offsetof(PathTracerUniform, VolumesCount), commandBuffer);
-    ResetPathTracing();
-}
-
-void PathTracer::SetVolume(uint32_t index, const Volume& volume, VulkanHelper::CommandBuffer commandBuffer)
-{
-    m_Volumes[index] = volume;
-    VolumeGPU volumeGPU(volume);
-    UploadDataToBuffer(m_VolumesBuffer, &volumeGPU, sizeof(VolumeGPU), index * sizeof(VolumeGPU), commandBuffer);
-    ResetPathTracing();
 }
 
-VulkanHelper::ImageView PathTracer::LoadDefaultTexture(VulkanHelper::CommandBuffer commandBuffer, bool normal, bool onlySingleChannel)
+void PathTracer::ReleaseVolumeGrids(const Volume& volume)
 {
-    std::vector<uint8_t> textureData(4);
-    if (normal)
+    if (volume.Sequence != nullptr)
     {
-        // Default normal map is (0.5, 0.5, 1.0) in RGB
-        textureData[0] = 128;
-        textureData[1] = 128;
-        textureData[2] = 255;
-        textureData[3] = 255;
+        m_VolumeGridManager.Release(volume.Sequence->DensityDataIndices[0]);
+        m_VolumeGridManager.Release(volume.Sequence->DensityDataIndices[1]);
     }
-    else
+    else if (volume.DensityDataIndex != -1)
     {
-        // Default white texture is (1.0, 1.0, 1.0) in RGBA
-        textureData[0] = 255;
-        textureData[1] = 255;
-        textureData[2] = 255;
-        textureData[3] = 255;
+        m_VolumeGridManager.Release(volume.DensityDataIndex);
     }
+}
 
-    if (onlySingleChannel)
+void PathTracer::AddDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer)
+{
+    if (volumeIndex >= m_Volumes.size())
     {
-        // Default white texture is (1.0) in R
-        textureData.resize(1);
-        textureData[0] = 255;
+        VH_LOG_ERROR("Volume index out of range: {}/{}", volumeIndex, m_Volumes.size());
+        return;
     }
 
-    VulkanHelper::Image::Config imageConfig{};
-    imageConfig.Device = m_Device;
-    imageConfig.Width = 1;
-    imageConfig.Height = 1;
-    imageConfig.Format = onlySingleChannel ? VulkanHelper::Format::R8_UNORM : VulkanHelper::Format::R8G8B8A8_UNORM;
-    imageConfig.Usage = VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_DST_BIT;
+    auto& volume = m_Volumes[volumeIndex];
+    std::string key = GetVolumeGridKey(filepath, importSettings);
 
-    VulkanHelper::Image textureImage = VulkanHelper::Image::New(imageConfig).Value();
+    // Grid may be used by another volume or still be resident from an earlier import,
+    // in that case the buffers are shared and there's nothing to convert or upload
+    int densityDataIndex = m_VolumeGridManager.Acquire(key);
+    if (densityDataIndex != -1)
+    {
+        VH_LOG_DEBUG("Sharing resident volume grid: {}", filepath);
 
-    // Create staging buffer
-    VulkanHelper::Buffer::Config stagingBufferConfig{};
-    stagingBufferConfig.Device = m_Device;
-    stagingBufferConfig.Size = textureData.size() * sizeof(uint8_t);
-    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
-    stagingBufferConfig.CpuMapable = true;
-    stagingBufferConfig.DebugName = "Default Texture Staging Buffer";
+        ReleaseVolumeGrids(volume);
+        volume.Sequence = nullptr;
+        AssignResidentVolumeGrid(volume, densityDataIndex);
 
-    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
+        SetVolume(volumeIndex, volume, commandBuffer);
+        return;
+    }
 
-    VH_ASSERT(stagingBuffer.UploadData(textureData.data(), textureData.size() * sizeof(uint8_t), 0) == VulkanHelper::VHResult::OK, "Failed to upload texture data");
+    if (importSettings.Streamed)
+    {
+        AddStreamedDensityDataToVolume(volumeIndex, filepath, key, importSettings, commandBuffer);
+        return;
+    }
 
-    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_DST_OPTIMAL, commandBuffer);
+    std::shared_ptr<VolumeGridData> gridData = LoadVolumeGridData(filepath, importSettings);
+    if (gridData == nullptr)
+        return;
 
-    VH_ASSERT(stagingBuffer.CopyToImage(
-        commandBuffer,
-        textureImage
-    ) == VulkanHelper::VHResult::OK, "Failed to copy staging buffer to image");
+    // Old grid is released first so that its slot can be reused if this was the last reference
+    ReleaseVolumeGrids(volume);
+    volume.Sequence = nullptr;
+    volume.DensityDataIndex = -1;
 
-    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+    densityDataIndex = m_VolumeGridManager.Allocate(key, GetVolumeGridDataSize(*gridData));
+    if (densityDataIndex == -1)
+    {
+        RemoveDensityDataFromVolume(volumeIndex, commandBuffer);
+        return;
+    }
 
-    VulkanHelper::ImageView::Config imageViewConfig{};
-    imageViewConfig.image = textureImage;
-    imageViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
-    imageViewConfig.BaseLayer = 0;
-    imageViewConfig.LayerCount = 1;
+    UploadVolumeGridData(volume, *gridData, densityDataIndex, commandBuffer);
 
-    return VulkanHelper::ImageView::New(imageViewConfig).Value();
+    SetVolume(volumeIndex, volume, commandBuffer);
 }
 
-void PathTracer::SetSkyMIS(bool value, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AddStreamedDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, const std::string& key, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_EnableEnvMapMIS = value;
-    ResetPathTracing();
-    ReloadShaders(commandBuffer);
-}
+    // Converting a big grid takes a while, so the bricks are cached on disk until the VDB file changes
+    std::error_code error;
+    std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filepath, error);
+    std::string canonicalFilepath = error ? filepath : canonicalPath.string();
+    std::filesystem::path cacheFilepath = std::filesystem::temp_directory_path() / "VulkanPathTracer"
+        / (std::filesystem::path(filepath).stem().string() + "_" + std::to_string(std::hash<std::string>{}(canonicalFilepath)) + ".vbrk");
+
+    bool cacheValid = std::filesystem::exists(cacheFilepath, error)
+        && std::filesystem::exists(filepath, error)
+        && std::filesystem::last_write_time(cacheFilepath, error) >= std::filesystem::last_write_time(filepath, error);
+
+    if (!cacheValid)
+    {
+        openvdb::GridBase::Ptr densityGrid;
+        openvdb::GridBase::Ptr temperatureGrid;
+        if (!ReadVDBGrids(filepath, densityGrid, temperatureGrid))
+            return;
 
-void PathTracer::SetMeshMIS(bool value, VulkanHelper::CommandBuffer commandBuffer)
-{
-    m_EnableMeshMIS = value;
-    ResetPathTracing();
-    ReloadShaders(commandBuffer);
-}
+        if (temperatureGrid)
+            VH_LOG_WARN("Temperature grids aren't supported for streamed volumes, only density is loaded");
 
-void PathTracer::SetEnvMapShownDirectly(bool value, VulkanHelper::CommandBuffer commandBuffer)
-{
-    m_ShowEnvMapDirectly = value;
-    ResetPathTracing();
-    ReloadShaders(commandBuffer);
-}
+        if (!WriteVolumeBrickFile(*openvdb::gridPtrCast<openvdb::FloatGrid>(densityGrid), cacheFilepath.string()))
+            return;
+    }
+    else
+    {
+        VH_LOG_DEBUG("Using cached volume bricks: {}", cacheFilepath.string());
+    }
 
-void PathTracer::SetUseOnlyGeometryNormals(bool useOnlyGeometryNormals, VulkanHelper::CommandBuffer commandBuffer)
-{
+    VolumeBrickStreamer::Config streamerConfig{};
+    streamerConfig.Device = m_Device;
+    streamerConfig.CacheFilepath = cacheFilepath.string();
+    streamerConfig.PoolSize = (uint64_t)importSettings.BrickPoolSizeMB * 1024 * 1024;
+    std::shared_ptr<VolumeBrickStreamer> streamer = VolumeBrickStreamer::New(streamerConfig);
+    if (streamer == nullptr)
+        return;
+
+    auto& volume = m_Volumes[volumeIndex];
+    ReleaseVolumeGrids(volume);
+    volume.Sequence = nullptr;
+    volume.DensityDataIndex = -1;
+
+    int densityDataIndex = m_VolumeGridManager.Allocate(key, streamer->GetGpuMemorySize());
+    if (densityDataIndex == -1)
+    {
+        RemoveDensityDataFromVolume(volumeIndex, commandBuffer);
+        return;
+    }
+
+    const VolumeBrickStreamer::FileHeader& header = streamer->GetHeader();
+    volume.CornerMin = header.CornerMin;
+    volume.CornerMax = header.CornerMax;
+    volume.MaxDensityInTheGrid = header.MaxDensityInTheGrid;
+    volume.VolumeNanoBufferDensity = VulkanHelper::Buffer();
+    volume.VolumeNanoBufferTemperature = VulkanHelper::Buffer();
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(float) * streamer->GetMaxDensities().size();
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.DebugName = "VolumeMaxDensities";
+    volume.MaxDensitiesBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+    UploadDataToBuffer(volume.MaxDensitiesBuffer, (void*)streamer->GetMaxDensities().data(), bufferConfig.Size, 0, commandBuffer);
+
+    VulkanHelper::Buffer pageTableBuffer = streamer->GetPageTableBuffer();
+    VulkanHelper::Buffer brickPoolBuffer = streamer->GetBrickPoolBuffer();
+    VulkanHelper::Buffer feedbackBuffer = streamer->GetFeedbackBuffer();
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(15, (uint32_t)densityDataIndex, nullptr) == VulkanHelper::VHResult::OK, "Failed to add volume density textures buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(16, (uint32_t)densityDataIndex, nullptr) == VulkanHelper::VHResult::OK, "Failed to add volume temperature textures buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(17, (uint32_t)densityDataIndex, &volume.MaxDensitiesBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume max densities buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(21, (uint32_t)densityDataIndex, &pageTableBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume brick page table buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(22, (uint32_t)densityDataIndex, &brickPoolBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume brick pool buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(23, (uint32_t)densityDataIndex, &feedbackBuffer) == VulkanHelper::VHResult::OK, "Failed to add volume brick feedback buffer to descriptor set");
+
+    volume.DensityDataIndex = densityDataIndex;
+    volume.BrickStreamer = streamer;
+
+    m_VolumeGridManager.SetGrid(
+        densityDataIndex,
+        { VulkanHelper::Buffer(), VulkanHelper::Buffer(), volume.MaxDensitiesBuffer, streamer },
+        { header.CornerMin, header.CornerMax, header.MaxDensityInTheGrid },
+        streamer->GetGpuMemorySize()
+    );
+
+    SetVolume(volumeIndex, volume, commandBuffer);
+}
+
+void PathTracer::UpdateVolumeBrickStreaming(VulkanHelper::CommandBuffer commandBuffer)
+{
+    // Volumes sharing a grid share the streamer too, it has to be updated only once
+    bool bricksUploaded = false;
+    std::unordered_set<VolumeBrickStreamer*> updatedStreamers;
+    for (auto& volume : m_Volumes)
+    {
+        if (volume.BrickStreamer != nullptr && updatedStreamers.insert(volume.BrickStreamer.get()).second)
+            bricksUploaded |= volume.BrickStreamer->Update(commandBuffer);
+    }
+
+    // Samples taken with average densities of missing bricks would stay in the image forever, so start over.
+    // Once the working set is resident (or the pool is full of bricks in use) nothing gets uploaded anymore
+    if (bricksUploaded)
+        ResetPathTracing();
+}
+
+std::vector<std::string> PathTracer::FindVolumeSequenceFrames(const std::string& filepath)
+{
+    std::filesystem::path path(filepath);
+    std::string stem = path.stem().string();
+    std::string extension = path.extension().string();
+
+    // Split "fire.0001" into "fire." and "0001"
+    size_t digitsStart = stem.size();
+    while (digitsStart > 0 && std::isdigit((unsigned char)stem[digitsStart - 1]))
+        digitsStart--;
+
+    if (digitsStart == stem.size())
+    {
+        VH_LOG_WARN("File {} has no frame number, loading it as a single frame sequence", filepath);
+        return { filepath };
+    }
+
+    std::string prefix = stem.substr(0, digitsStart);
+
+    std::vector<std::pair<uint32_t, std::string>> frames;
+    for (const auto& entry : std::filesystem::directory_iterator(path.parent_path()))
+    {
+        if (!entry.is_regular_file() || entry.path().extension().string() != extension)
+            continue;
+
+        std::string entryStem = entry.path().stem().string();
+        if (entryStem.size() <= prefix.size() || entryStem.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        std::string frameNumber = entryStem.substr(prefix.size());
+        if (!std::all_of(frameNumber.begin(), frameNumber.end(), [](char c) { return std::isdigit((unsigned char)c); }))
+            continue;
+
+        frames.push_back({ (uint32_t)std::stoul(frameNumber), entry.path().string() });
+    }
+
+    std::sort(frames.begin(), frames.end());
+
+    std::vector<std::string> framePaths;
+    framePaths.reserve(frames.size());
+    for (auto& frame : frames)
+        framePaths.push_back(std::move(frame.second));
+
+    return framePaths;
+}
+
+void PathTracer::AddDensitySequenceToVolume(uint32_t volumeIndex, const std::string& filepath, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer)
+{
+    if (volumeIndex >= m_Volumes.size())
+    {
+        VH_LOG_ERROR("Volume index out of range: {}/{}", volumeIndex, m_Volumes.size());
+        return;
+    }
+
+    std::vector<std::string> frames = FindVolumeSequenceFrames(filepath);
+    if (frames.empty())
+    {
+        VH_LOG_ERROR("No VDB sequence frames found for: {}", filepath);
+        return;
+    }
+
+    VH_LOG_DEBUG("Found {} frames in VDB sequence", frames.size());
+
+    // First frame is loaded synchronously, everything after that is prefetched
+    std::shared_ptr<VolumeGridData> gridData = LoadVolumeGridData(frames[0], importSettings);
+    if (gridData == nullptr)
+        return;
+
+    auto& volume = m_Volumes[volumeIndex];
+    ReleaseVolumeGrids(volume);
+    volume.Sequence = nullptr;
+    volume.DensityDataIndex = -1;
+
+    // Frames are never reused so sequence slots have no key, the back slot starts out
+    // with the size of the first frame and is adjusted once the next frame is uploaded
+    uint64_t frameSize = GetVolumeGridDataSize(*gridData);
+    std::shared_ptr<VolumeSequence> sequence = std::make_shared<VolumeSequence>();
+    sequence->Frames = std::move(frames);
+    sequence->ImportSettings = importSettings;
+    sequence->DensityDataIndices[0] = m_VolumeGridManager.Allocate("", frameSize);
+    sequence->DensityDataIndices[1] = m_VolumeGridManager.Allocate("", frameSize);
+
+    if (sequence->DensityDataIndices[0] == -1 || sequence->DensityDataIndices[1] == -1)
+    {
+        if (sequence->DensityDataIndices[0] != -1)
+            m_VolumeGridManager.Release(sequence->DensityDataIndices[0]);
+        if (sequence->DensityDataIndices[1] != -1)
+            m_VolumeGridManager.Release(sequence->DensityDataIndices[1]);
+
+        RemoveDensityDataFromVolume(volumeIndex, commandBuffer);
+        return;
+    }
+
+    UploadVolumeGridData(volume, *gridData, sequence->DensityDataIndices[sequence->FrontSlot], commandBuffer);
+    volume.Sequence = sequence;
+
+    if (sequence->Frames.size() > 1)
+        PrefetchVolumeSequenceFrame(*sequence, 1);
+
+    SetVolume(volumeIndex, volume, commandBuffer);
+}
+
+void PathTracer::PrefetchVolumeSequenceFrame(VolumeSequence& sequence, uint32_t frame)
+{
+    sequence.PrefetchedFrame = frame;
+    sequence.Prefetch = m_ThreadPool->PushTask([filepath = sequence.Frames[frame], importSettings = sequence.ImportSettings]() {
+        return LoadVolumeGridData(filepath, importSettings);
+    });
+}
+
+// Returns true if a new frame was swapped in
+bool PathTracer::SwapVolumeSequenceFrame(uint32_t volumeIndex, bool waitForPrefetch, VulkanHelper::CommandBuffer commandBuffer)
+{
+    auto& volume = m_Volumes[volumeIndex];
+    VolumeSequence& sequence = *volume.Sequence;
+
+    if (sequence.Frames.size() < 2 || !sequence.Prefetch.valid())
+        return false;
+
+    if (!waitForPrefetch && sequence.Prefetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    std::shared_ptr<VolumeGridData> gridData = sequence.Prefetch.get();
+    uint32_t loadedFrame = sequence.PrefetchedFrame;
+
+    // Start converting the next frame right away so it overlaps with rendering of this one
+    PrefetchVolumeSequenceFrame(sequence, (loadedFrame + 1) % (uint32_t)sequence.Frames.size());
+
+    if (gridData == nullptr)
+    {
+        // Keep showing the previous data, error has already been logged
+        sequence.CurrentFrame = loadedFrame;
+        sequence.CurrentFrameFailed = true;
+        return false;
+    }
+
+    sequence.CurrentFrameFailed = false;
+
+    sequence.FrontSlot = 1 - sequence.FrontSlot;
+    UploadVolumeGridData(volume, *gridData, sequence.DensityDataIndices[sequence.FrontSlot], commandBuffer);
+    sequence.CurrentFrame = loadedFrame;
+
+    SetVolume(volumeIndex, volume, commandBuffer);
+
+    // Copies of this volume play the same sequence, so they just switch to the new slot
+    for (uint32_t i = 0; i < (uint32_t)m_Volumes.size(); i++)
+    {
+        if (i == volumeIndex || m_Volumes[i].Sequence != volume.Sequence)
+            continue;
+
+        Volume& copy = m_Volumes[i];
+        AssignResidentVolumeGrid(copy, sequence.DensityDataIndices[sequence.FrontSlot]);
+        SetVolume(i, copy, commandBuffer);
+    }
+
+    return true;
+}
+
+void PathTracer::SetVolumeSequencePlaying(uint32_t volumeIndex, bool playing)
+{
+    if (volumeIndex >= m_Volumes.size() || m_Volumes[volumeIndex].Sequence == nullptr)
+    {
+        VH_LOG_ERROR("Volume {} doesn't have a sequence attached", volumeIndex);
+        return;
+    }
+
+    m_Volumes[volumeIndex].Sequence->Playing = playing;
+}
+
+void PathTracer::UpdateVolumeSequences(VulkanHelper::CommandBuffer commandBuffer)
+{
+    // Copies of a volume share the sequence, it has to be advanced only once
+    std::unordered_set<VolumeSequence*> updatedSequences;
+    for (uint32_t i = 0; i < (uint32_t)m_Volumes.size(); i++)
+    {
+        if (m_Volumes[i].Sequence == nullptr || !m_Volumes[i].Sequence->Playing || !updatedSequences.insert(m_Volumes[i].Sequence.get()).second)
+            continue;
+
+        SwapVolumeSequenceFrame(i, false, commandBuffer);
+    }
+}
+
+bool PathTracer::StepVolumeSequences(VulkanHelper::CommandBuffer commandBuffer)
+{
+    bool allLoaded = true;
+    std::unordered_set<VolumeSequence*> steppedSequences;
+    for (uint32_t i = 0; i < (uint32_t)m_Volumes.size(); i++)
+    {
+        if (m_Volumes[i].Sequence == nullptr || !steppedSequences.insert(m_Volumes[i].Sequence.get()).second)
+            continue;
+
+        SwapVolumeSequenceFrame(i, true, commandBuffer);
+        if (m_Volumes[i].Sequence->CurrentFrameFailed)
+            allLoaded = false;
+    }
+
+    return allLoaded;
+}
+
+void PathTracer::RewindVolumeSequences(VulkanHelper::CommandBuffer commandBuffer)
+{
+    for (uint32_t i = 0; i < (uint32_t)m_Volumes.size(); i++)
+    {
+        if (m_Volumes[i].Sequence == nullptr)
+            continue;
+
+        VolumeSequence& sequence = *m_Volumes[i].Sequence;
+        if (sequence.CurrentFrame == 0)
+            continue;
+
+        // Whatever was prefetched is dropped, the worker will just finish converting it for nothing
+        if (sequence.PrefetchedFrame != 0)
+            PrefetchVolumeSequenceFrame(sequence, 0);
+
+        SwapVolumeSequenceFrame(i, true, commandBuffer);
+    }
+}
+
+uint32_t PathTracer::GetLongestVolumeSequenceLength() const
+{
+    uint32_t length = 0;
+    for (const auto& volume : m_Volumes)
+    {
+        if (volume.Sequence != nullptr)
+            length = glm::max(length, (uint32_t)volume.Sequence->Frames.size());
+    }
+
+    return length;
+}
+
+void PathTracer::RemoveDensityDataFromVolume(uint32_t volumeIndex, VulkanHelper::CommandBuffer commandBuffer)
+{
+    auto& volume = m_Volumes[volumeIndex];
+    ReleaseVolumeGrids(volume);
+    volume.VolumeNanoBufferDensity = VulkanHelper::Buffer();
+    volume.VolumeNanoBufferTemperature = VulkanHelper::Buffer();
+    volume.DensityDataIndex = -1;
+    volume.MaxDensitiesBuffer = VulkanHelper::Buffer();
+    volume.Sequence = nullptr;
+    volume.BrickStreamer = nullptr;
+    volume.CornerMin = glm::vec3(-1.0f);
+    volume.CornerMax = glm::vec3(1.0f);
+    SetVolume(volumeIndex, volume, commandBuffer);
+}
+
+void PathTracer::RemoveVolume(uint32_t index, VulkanHelper::CommandBuffer commandBuffer)
+{
+    // It will remove the volume from the array and move all subsequent volumes down to fill the gap
+    uint32_t volumesToMove = (uint32_t)m_Volumes.size() - index - 1;
+    ReleaseVolumeGrids(m_Volumes[index]);
+    m_Volumes.erase(m_Volumes.begin() + index);
+    if (volumesToMove > 0)
+    {
+        std::vector<VolumeGPU> volumes(volumesToMove);
+        DownloadDataFromBuffer(m_VolumesBuffer, volumes.data(), sizeof(VolumeGPU) * volumesToMove, (index + 1) * sizeof(VolumeGPU), commandBuffer);
+        UploadDataToBuffer(m_VolumesBuffer, volumes.data(), sizeof(VolumeGPU) * volumesToMove, index * sizeof(VolumeGPU), commandBuffer);
+    }
+
+    uint32_t volumeCount = (uint32_t)m_Volumes.size();
+
+    // Update Uniform Buffer
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &volumeCount, sizeof(uint32_t), offsetof(PathTracerUniform, VolumesCount), commandBuffer);
+    RebuildVolumeBVH(commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetVolume(uint32_t index, const Volume& volume, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_Volumes[index] = volume;
+    VolumeGPU volumeGPU(volume);
+    UploadDataToBuffer(m_VolumesBuffer, &volumeGPU, sizeof(VolumeGPU), index * sizeof(VolumeGPU), commandBuffer);
+    RebuildVolumeBVH(commandBuffer);
+    ResetPathTracing();
+}
+
+VulkanHelper::ImageView PathTracer::LoadDefaultTexture(VulkanHelper::CommandBuffer commandBuffer, bool normal, bool onlySingleChannel)
+{
+    std::vector<uint8_t> textureData(4);
+    if (normal)
+    {
+        // Default normal map is (0.5, 0.5, 1.0) in RGB
+        textureData[0] = 128;
+        textureData[1] = 128;
+        textureData[2] = 255;
+        textureData[3] = 255;
+    }
+    else
+    {
+        // Default white texture is (1.0, 1.0, 1.0) in RGBA
+        textureData[0] = 255;
+        textureData[1] = 255;
+        textureData[2] = 255;
+        textureData[3] = 255;
+    }
+
+    if (onlySingleChannel)
+    {
+        // Default white texture is (1.0) in R
+        textureData.resize(1);
+        textureData[0] = 255;
+    }
+
+    VulkanHelper::Image::Config imageConfig{};
+    imageConfig.Device = m_Device;
+    imageConfig.Width = 1;
+    imageConfig.Height = 1;
+    imageConfig.Format = onlySingleChannel ? VulkanHelper::Format::R8_UNORM : VulkanHelper::Format::R8G8B8A8_UNORM;
+    imageConfig.Usage = VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_DST_BIT;
+
+    VulkanHelper::Image textureImage = VulkanHelper::Image::New(imageConfig).Value();
+
+    // Create staging buffer
+    VulkanHelper::Buffer::Config stagingBufferConfig{};
+    stagingBufferConfig.Device = m_Device;
+    stagingBufferConfig.Size = textureData.size() * sizeof(uint8_t);
+    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    stagingBufferConfig.CpuMapable = true;
+    stagingBufferConfig.DebugName = "Default Texture Staging Buffer";
+
+    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
+
+    VH_ASSERT(stagingBuffer.UploadData(textureData.data(), textureData.size() * sizeof(uint8_t), 0) == VulkanHelper::VHResult::OK, "Failed to upload texture data");
+
+    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_DST_OPTIMAL, commandBuffer);
+
+    VH_ASSERT(stagingBuffer.CopyToImage(
+        commandBuffer,
+        textureImage
+    ) == VulkanHelper::VHResult::OK, "Failed to copy staging buffer to image");
+
+    textureImage.TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+
+    VulkanHelper::ImageView::Config imageViewConfig{};
+    imageViewConfig.image = textureImage;
+    imageViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
+    imageViewConfig.BaseLayer = 0;
+    imageViewConfig.LayerCount = 1;
+
+    return VulkanHelper::ImageView::New(imageViewConfig).Value();
+}
+
+void PathTracer::SetSkyMIS(bool value, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_EnableEnvMapMIS = value;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetMeshMIS(bool value, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_EnableMeshMIS = value;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetLightTree(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_LightTree = enabled;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetEnvMapShownDirectly(bool value, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_ShowEnvMapDirectly = value;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetUseOnlyGeometryNormals(bool useOnlyGeometryNormals, VulkanHelper::CommandBuffer commandBuffer)
+{
     m_UseOnlyGeometryNormals = useOnlyGeometryNormals;
     ResetPathTracing();
-    ReloadShaders(commandBuffer);
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetUseEnergyCompensation(bool useEnergyCompensation, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_UseEnergyCompensation = useEnergyCompensation;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetFurnaceTestMode(bool furnaceTestMode, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_FurnaceTestMode = furnaceTestMode;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetSkyIntensity(float environmentIntensity, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_SkyIntensity = environmentIntensity;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_SkyIntensity, sizeof(float), offsetof(PathTracerUniform, SkyIntensity), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetUseRayQueries(bool useRayQueries, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_UseRayQueries = useRayQueries;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetCameraViewInverse(const glm::mat4& view, VulkanHelper::CommandBuffer commandBuffer)
+{
+    // Reprojection history is stored with the old camera
+    ResetPathTracingForCameraChange(commandBuffer);
+
+    m_CameraViewInverse = view;
+
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_CameraViewInverse, sizeof(glm::mat4), offsetof(PathTracerUniform, CameraViewInverse), commandBuffer);
+}
+
+void PathTracer::SetCameraProjectionInverse(const glm::mat4& projection, VulkanHelper::CommandBuffer commandBuffer)
+{
+    // Reprojection history is stored with the old camera
+    ResetPathTracingForCameraChange(commandBuffer);
+
+    m_CameraProjectionInverse = projection;
+
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_CameraProjectionInverse, sizeof(glm::mat4), offsetof(PathTracerUniform, CameraProjectionInverse), commandBuffer);
+}
+
+void PathTracer::SetPhaseFunction(PhaseFunction phaseFunction, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_PhaseFunction = phaseFunction;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetSplitScreenCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_ScreenChunkCount = count;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &count, sizeof(uint32_t), offsetof(PathTracerUniform, ScreenChunkCount), commandBuffer);
+    m_PreviewActive = false; // Uniform doesn't hold the preview settings anymore, the next preview frame uploads them again
+    ResetPathTracing();
+}
+
+void PathTracer::SetEnableAtmosphere(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_EnableAtmosphere = enabled;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetPlanetRadius(float radius, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_PlanetRadius = radius;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &radius, sizeof(float), offsetof(PathTracerUniform, PlanetRadius), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetAtmosphereHeight(float height, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AtmosphereHeight = height;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &height, sizeof(float), offsetof(PathTracerUniform, AtmosphereHeight), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetRayleighScatteringCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_RayleighScatteringCoefficientMultiplier = multiplier;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, RayleighScatteringCoefficientMultiplier), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetMieScatteringCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_MieScatteringCoefficientMultiplier = multiplier;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, MieScatteringCoefficientMultiplier), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetOzoneAbsorptionCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_OzoneAbsorptionCoefficientMultiplier = multiplier;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, OzoneAbsorptionCoefficientMultiplier), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetPlanetPosition(const glm::vec3& position, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_PlanetPosition = position;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&position, sizeof(glm::vec3), offsetof(PathTracerUniform, PlanetPosition), commandBuffer);
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetRayleighDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_RayleighDensityFalloff = falloff;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, RayleighDensityFalloff), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetMieDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_MieDensityFalloff = falloff;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, MieDensityFalloff), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetOzoneDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_OzoneDensityFalloff = falloff;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, OzoneDensityFalloff), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetOzonePeak(float altitude, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_OzonePeak = altitude;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &altitude, sizeof(float), offsetof(PathTracerUniform, OzonePeak), commandBuffer);
+    m_AtmosphereTransmittanceLUTPending = true;
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetSunColor(const glm::vec3& color, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_SunColor = color;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&color, sizeof(glm::vec3), offsetof(PathTracerUniform, SunColor), commandBuffer);
+    m_ApproximateSkyPending = true;
+    ResetPathTracing();
+}
+
+void PathTracer::SetEmissiveMeshSamplingPDFBias(float bias, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_EmissiveMeshSamplingPDFBias = bias;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &bias, sizeof(float), offsetof(PathTracerUniform, EmissiveMeshSamplingPDFBias), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetAtmosphereTransmittanceEstimator(TransmittanceEstimator estimator, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AtmosphereTransmittanceEstimator = estimator;
+    uint32_t value = (uint32_t)estimator;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &value, sizeof(uint32_t), offsetof(PathTracerUniform, AtmosphereTransmittanceEstimator), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetAtmosphereResidualControlFraction(float fraction, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AtmosphereResidualControlFraction = fraction;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &fraction, sizeof(float), offsetof(PathTracerUniform, AtmosphereResidualControlFraction), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetUseAtmosphereTransmittanceLUT(bool useLUT, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_UseAtmosphereTransmittanceLUT = useLUT;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetVolumeMemoryBudget(uint64_t budget)
+{
+    m_VolumeGridManager.SetMemoryBudget(budget);
+}
+
+void PathTracer::SetIntegrator(Integrator integrator, VulkanHelper::CommandBuffer commandBuffer)
+{
+    if (integrator == Integrator::INLINE_RAY_QUERY && !m_Device.AreRayQueriesSupported())
+    {
+        VH_LOG_WARN("Ray queries are not supported by the current device. Inline ray query integrator can't be used.");
+        return;
+    }
+
+    if (integrator == Integrator::WAVEFRONT && !m_WavefrontResourcesCreated)
+        CreateWavefrontResources();
+
+    m_Integrator = integrator;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetWavefrontPathPoolSize(uint32_t pathCount, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_WavefrontPathPoolSize = glm::max(pathCount, WAVEFRONT_WORKGROUP_SIZE);
+
+    if (m_WavefrontResourcesCreated)
+    {
+        // Pipelines have to be recreated since the descriptor set changes
+        CreateWavefrontResources();
+        ReloadShaders(commandBuffer);
+    }
+
+    ResetPathTracing();
+}
+
+void PathTracer::CreateWavefrontResources()
+{
+    const uint64_t pathCount = m_WavefrontPathPoolSize;
+    const std::array<uint64_t, 8> bufferSizes = {
+        sizeof(WavefrontPathState) * pathCount,
+        sizeof(WavefrontHitInfo) * pathCount,
+        sizeof(WavefrontShadowRay) * pathCount * 2, // Sky and emissive mesh ray for every path
+        sizeof(uint32_t) * pathCount * 2, // Two extend queues used alternately
+        sizeof(uint32_t) * pathCount,
+        sizeof(uint32_t) * pathCount,
+        sizeof(uint32_t) * pathCount,
+        sizeof(WavefrontQueueCounters) * 3 // Ring of counters indexed by bounce
+    };
+
+    const std::array<const char*, 8> bufferNames = {
+        "Wavefront Paths",
+        "Wavefront Hits",
+        "Wavefront Shadow Rays",
+        "Wavefront Extend Queues",
+        "Wavefront Surface Queue",
+        "Wavefront Volume Queue",
+        "Wavefront Connect Queue",
+        "Wavefront Queue Counters"
+    };
+
+    for (size_t i = 0; i < m_WavefrontBuffers.size(); i++)
+    {
+        VulkanHelper::Buffer::Config bufferConfig{};
+        bufferConfig.Device = m_Device;
+        bufferConfig.Size = bufferSizes[i];
+        bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+        bufferConfig.DebugName = bufferNames[i];
+        m_WavefrontBuffers[i] = VulkanHelper::Buffer::New(bufferConfig).Value();
+    }
+
+    VulkanHelper::ShaderStages wavefrontStages = VulkanHelper::ShaderStages::RAYGEN_BIT | VulkanHelper::ShaderStages::CLOSEST_HIT_BIT | VulkanHelper::ShaderStages::MISS_BIT | VulkanHelper::ShaderStages::COMPUTE_BIT;
+
+    std::array<VulkanHelper::DescriptorSet::BindingDescription, 8> bindingDescriptions{};
+    for (uint32_t i = 0; i < (uint32_t)bindingDescriptions.size(); i++)
+        bindingDescriptions[i] = VulkanHelper::DescriptorSet::BindingDescription{i, 1, wavefrontStages, VulkanHelper::DescriptorType::STORAGE_BUFFER};
+
+    VulkanHelper::DescriptorSet::Config descriptorSetConfig{};
+    descriptorSetConfig.Bindings = bindingDescriptions.data();
+    descriptorSetConfig.BindingCount = static_cast<uint32_t>(bindingDescriptions.size());
+
+    m_WavefrontDescriptorSet = m_DescriptorPool.AllocateDescriptorSet(descriptorSetConfig).Value();
+
+    for (uint32_t i = 0; i < (uint32_t)m_WavefrontBuffers.size(); i++)
+        VH_ASSERT(m_WavefrontDescriptorSet.AddBuffer(i, 0, &m_WavefrontBuffers[i]) == VulkanHelper::VHResult::OK, "Failed to add wavefront buffer to descriptor set");
+
+    m_WavefrontResourcesCreated = true;
+}
+
+void PathTracer::CreateWavefrontPipelines(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    // Expects the shader session to be already initialized with the current defines
+    auto generateShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/Generate.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+    auto extendShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/Extend.slang", VulkanHelper::ShaderStages::RAYGEN_BIT});
+    auto extendHitShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/ExtendHit.slang", VulkanHelper::ShaderStages::CLOSEST_HIT_BIT});
+    auto extendMissShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/ExtendMiss.slang", VulkanHelper::ShaderStages::MISS_BIT});
+    auto shadowMissShaderRes = VulkanHelper::Shader::New({m_Device, "MissShadow.slang", VulkanHelper::ShaderStages::MISS_BIT});
+    auto shadeSurfaceShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/ShadeSurface.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+    auto shadeVolumeShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/ShadeVolume.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+    auto connectShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/Connect.slang", VulkanHelper::ShaderStages::RAYGEN_BIT});
+    auto accumulateShaderRes = VulkanHelper::Shader::New({m_Device, "Wavefront/Accumulate.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!generateShaderRes.HasValue() || !extendShaderRes.HasValue() || !extendHitShaderRes.HasValue() || !extendMissShaderRes.HasValue() || !shadowMissShaderRes.HasValue() ||
+        !shadeSurfaceShaderRes.HasValue() || !shadeVolumeShaderRes.HasValue() || !connectShaderRes.HasValue() || !accumulateShaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile wavefront integrator shaders, falling back to the megakernel");
+        m_Integrator = Integrator::MEGAKERNEL;
+        return;
+    }
+
+    auto createComputePipeline = [this](const VulkanHelper::Shader& shader)
+    {
+        VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+        pipelineConfig.Device = m_Device;
+        pipelineConfig.ComputeShader = shader;
+        pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet, m_WavefrontDescriptorSet };
+        pipelineConfig.PushConstant = &m_WavefrontPushConstant;
+
+        return VulkanHelper::Pipeline::New(pipelineConfig).Value();
+    };
+
+    // Both ray tracing stages share hit and miss shaders, shadow rays use the second miss shader like in the megakernel
+    auto createRayTracingPipeline = [&](const VulkanHelper::Shader& rayGenShader)
+    {
+        VulkanHelper::Pipeline::RayTracingConfig pipelineConfig{};
+        pipelineConfig.Device = m_Device;
+        pipelineConfig.RayGenShaders.PushBack(rayGenShader);
+        pipelineConfig.HitShaders.PushBack(extendHitShaderRes.Value());
+        pipelineConfig.MissShaders.PushBack(extendMissShaderRes.Value());
+        pipelineConfig.MissShaders.PushBack(shadowMissShaderRes.Value());
+        pipelineConfig.DescriptorSets.PushBack(m_PathTracerDescriptorSet);
+        pipelineConfig.DescriptorSets.PushBack(m_WavefrontDescriptorSet);
+        pipelineConfig.PushConstant = &m_WavefrontPushConstant;
+        pipelineConfig.CommandBuffer = &commandBuffer;
+
+        return VulkanHelper::Pipeline::New(pipelineConfig).Value();
+    };
+
+    m_WavefrontGeneratePipeline = createComputePipeline(generateShaderRes.Value());
+    m_WavefrontExtendPipeline = createRayTracingPipeline(extendShaderRes.Value());
+    m_WavefrontShadeSurfacePipeline = createComputePipeline(shadeSurfaceShaderRes.Value());
+    m_WavefrontShadeVolumePipeline = createComputePipeline(shadeVolumeShaderRes.Value());
+    m_WavefrontConnectPipeline = createRayTracingPipeline(connectShaderRes.Value());
+    m_WavefrontAccumulatePipeline = createComputePipeline(accumulateShaderRes.Value());
+}
+
+void PathTracer::PathTraceWavefront(VulkanHelper::CommandBuffer& commandBuffer, uint32_t frameCount, uint32_t seed, uint32_t chunkIndex)
+{
+    const uint32_t width = m_OutputImageView.GetImage().GetWidth();
+    const uint32_t height = m_OutputImageView.GetImage().GetHeight();
+
+    // Exact size of the current chunk, chunks on the right and bottom edge can be smaller
+    const uint32_t chunkCount = GetActiveChunkCount();
+    const uint32_t chunkOffsetX = chunkIndex % chunkCount;
+    const uint32_t chunkOffsetY = chunkIndex / chunkCount;
+    const uint32_t chunkWidth = (width - glm::min(chunkOffsetX, width) + chunkCount - 1) / chunkCount;
+    const uint32_t chunkHeight = (height - glm::min(chunkOffsetY, height) + chunkCount - 1) / chunkCount;
+    const uint32_t pixelCount = chunkWidth * chunkHeight;
+
+    PushConstantData data{};
+    data.FrameCount = frameCount;
+    data.Seed = seed;
+    data.ChunkIndex = chunkIndex;
+
+    auto setPushConstant = [&]()
+    {
+        VH_ASSERT(m_WavefrontPushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+    };
+
+    auto dispatchCompute = [&](VulkanHelper::Pipeline& pipeline)
+    {
+        setPushConstant();
+        pipeline.Bind(commandBuffer);
+        pipeline.Dispatch(commandBuffer, (data.PathCount + WAVEFRONT_WORKGROUP_SIZE - 1) / WAVEFRONT_WORKGROUP_SIZE, 1, 1);
+    };
+
+    auto dispatchRays = [&](VulkanHelper::Pipeline& pipeline)
+    {
+        setPushConstant();
+        pipeline.Bind(commandBuffer);
+        pipeline.RayTrace(commandBuffer, data.PathCount, 1);
+    };
+
+    // Every sample of the frame is a separate set of waves, so every path in a wave belongs to a different pixel
+    for (uint32_t sample = 0; sample < GetActiveSamplesPerFrame(); sample++)
+    {
+        data.SampleIndex = GetFirstSampleIndex() + sample;
+
+        for (uint32_t pathOffset = 0; pathOffset < pixelCount; pathOffset += m_WavefrontPathPoolSize)
+        {
+            data.PathOffset = pathOffset;
+            data.PathCount = glm::min(m_WavefrontPathPoolSize, pixelCount - pathOffset);
+            data.Bounce = 0;
+
+            dispatchCompute(m_WavefrontGeneratePipeline);
+            WavefrontBarrier(commandBuffer);
+
+            // Queue sizes are only known on the GPU, so every bounce is dispatched for the whole wave
+            // and threads past the end of the queue exit immediately
+            for (uint32_t bounce = 0; bounce < m_MaxDepth; bounce++)
+            {
+                data.Bounce = bounce;
+
+                dispatchRays(m_WavefrontExtendPipeline);
+                WavefrontBarrier(commandBuffer);
+
+                dispatchCompute(m_WavefrontShadeSurfacePipeline);
+                dispatchCompute(m_WavefrontShadeVolumePipeline);
+                WavefrontBarrier(commandBuffer);
+
+                dispatchRays(m_WavefrontConnectPipeline);
+                WavefrontBarrier(commandBuffer);
+            }
+
+            dispatchCompute(m_WavefrontAccumulatePipeline);
+            m_OutputImageView.GetImage().Barrier(
+                commandBuffer, 0, 1,
+                VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+                VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+                VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+                VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+            );
+            WavefrontBarrier(commandBuffer);
+        }
+    }
+}
+
+void PathTracer::WavefrontBarrier(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    for (auto& buffer : m_WavefrontBuffers)
+    {
+        buffer.Barrier(
+            commandBuffer,
+            VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+        );
+    }
+}
+
+void PathTracer::CreateInlineRayQueryPipeline()
+{
+    // Expects the shader session to be already initialized with the current defines
+    auto shaderRes = VulkanHelper::Shader::New({m_Device, "PathTraceInline.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!shaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile inline ray query integrator shader, falling back to the megakernel");
+        m_Integrator = Integrator::MEGAKERNEL;
+        return;
+    }
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.ComputeShader = shaderRes.Value();
+    pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet };
+    pipelineConfig.PushConstant = &m_InlineRayQueryPushConstant;
+
+    m_InlineRayQueryPipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+}
+
+void PathTracer::PathTraceInlineRayQuery(VulkanHelper::CommandBuffer& commandBuffer, uint32_t frameCount, uint32_t seed, uint32_t chunkIndex)
+{
+    PushConstantData data{};
+    data.FrameCount = frameCount;
+    data.Seed = seed;
+    data.ChunkIndex = chunkIndex;
+    data.SampleIndex = GetFirstSampleIndex();
+
+    VH_ASSERT(m_InlineRayQueryPushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+
+    const uint32_t chunkWidth = (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetWidth() / (float)GetActiveChunkCount());
+    const uint32_t chunkHeight = (uint32_t)glm::ceil((float)m_OutputImageView.GetImage().GetHeight() / (float)GetActiveChunkCount());
+
+    m_InlineRayQueryPipeline.Bind(commandBuffer);
+    m_InlineRayQueryPipeline.Dispatch(commandBuffer, (chunkWidth + 7) / 8, (chunkHeight + 7) / 8, 1);
+
+    m_OutputImageView.GetImage().Barrier(
+        commandBuffer, 0, 1,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+}
+
+uint32_t PathTracer::GetConvergenceTileCount() const
+{
+    const uint32_t tilesX = (m_Width + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE;
+    const uint32_t tilesY = (m_Height + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE;
+    return tilesX * tilesY;
+}
+
+uint32_t PathTracer::GetAdaptiveMinFrames() const
+{
+    // Variance needs at least two frames, has to match GetAdaptiveMinFrames() in AdaptiveSampling.slang
+    return glm::max((m_AdaptiveMinSamples + m_SamplesPerFrame - 1) / m_SamplesPerFrame, 2u);
+}
+
+void PathTracer::CreateAdaptiveSamplingBuffers()
+{
+    VulkanHelper::Buffer::Config momentsBufferConfig{};
+    momentsBufferConfig.Device = m_Device;
+    momentsBufferConfig.Size = sizeof(glm::vec2) * (uint64_t)m_Width * (uint64_t)m_Height;
+    momentsBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT; // Read back by the EXR export
+    momentsBufferConfig.DebugName = "Sample Moments";
+    m_SampleMomentsBuffer = VulkanHelper::Buffer::New(momentsBufferConfig).Value();
+
+    VulkanHelper::Buffer::Config maskBufferConfig{};
+    maskBufferConfig.Device = m_Device;
+    maskBufferConfig.Size = sizeof(uint32_t) * (GetConvergenceTileCount() + 2); // Group counter and generation at the end
+    maskBufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+    maskBufferConfig.CpuMapable = true;
+    maskBufferConfig.DebugName = "Convergence Mask";
+    m_ConvergenceMaskBuffer = VulkanHelper::Buffer::New(maskBufferConfig).Value();
+
+    ClearConvergenceMask();
+}
+
+void PathTracer::ClearConvergenceMask()
+{
+    // Every tile starts active, so shaders compiled with adaptive sampling don't skip pixels until a convergence pass
+    // writes the mask. Generation 0 is never recorded, so nothing is read back before the first pass is done
+    std::vector<uint32_t> mask(GetConvergenceTileCount() + 2, 1);
+    mask[GetConvergenceTileCount()] = 0;
+    mask[GetConvergenceTileCount() + 1] = 0;
+    VH_ASSERT(m_ConvergenceMaskBuffer.UploadData(mask.data(), mask.size() * sizeof(uint32_t), 0) == VulkanHelper::VHResult::OK, "Failed to clear convergence mask");
+
+    m_ActiveTileCount = GetConvergenceTileCount();
+    m_ConvergenceReadbackPending = false;
+}
+
+void PathTracer::CreateConvergencePipeline()
+{
+    // Expects the shader session to be already initialized with the current defines
+    auto shaderRes = VulkanHelper::Shader::New({m_Device, "Convergence.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!shaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile convergence shader, adaptive sampling is disabled");
+        m_AdaptiveSampling = false;
+
+        // Path tracing shaders may already be compiled with adaptive sampling, they keep reading the mask until the next reload
+        ClearConvergenceMask();
+        return;
+    }
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.ComputeShader = shaderRes.Value();
+    pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet };
+    pipelineConfig.PushConstant = &m_ConvergencePushConstant;
+
+    m_ConvergencePipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+}
+
+void PathTracer::UpdateConvergenceMask(VulkanHelper::CommandBuffer& commandBuffer, uint32_t chunkIndex)
+{
+    // The mask is read without waiting for the GPU, so the count of active tiles lags behind the convergence pass.
+    // The last group of the pass writes its generation after the mask, and until it's there the mask isn't touched
+    if (m_ConvergenceReadbackPending)
+    {
+        const uint32_t tileCount = GetConvergenceTileCount();
+        const uint32_t* mask = (const uint32_t*)m_ConvergenceMaskBuffer.Map().Value();
+        if (mask[tileCount + 1] == m_ConvergenceGeneration)
+        {
+            m_ActiveTileCount = (uint32_t)std::count_if(mask, mask + tileCount, [](uint32_t active) { return active != 0; });
+            m_ConvergenceReadbackPending = false;
+        }
+        m_ConvergenceMaskBuffer.Unmap();
+    }
+
+    // Update the mask once all chunks of a frame are done, every few frames after reaching the minimum sample count
+    const uint32_t minFrames = GetAdaptiveMinFrames();
+    if (chunkIndex != 0 || m_FrameCount < minFrames || (m_FrameCount - minFrames) % CONVERGENCE_UPDATE_INTERVAL != 0)
+        return;
+
+    m_OutputImageView.GetImage().Barrier(
+        commandBuffer, 0, 1,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+    m_SampleMomentsBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    // Generations aren't reset, so a pass recorded before a reset can't be taken for the current one
+    m_ConvergenceGeneration++;
+    if (m_ConvergenceGeneration == 0)
+        m_ConvergenceGeneration++;
+
+    PushConstantData data{};
+    data.ConvergenceGeneration = m_ConvergenceGeneration;
+    VH_ASSERT(m_ConvergencePushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+
+    m_ConvergencePipeline.Bind(commandBuffer);
+    m_ConvergencePipeline.Dispatch(
+        commandBuffer,
+        (m_Width + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE,
+        (m_Height + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE,
+        1
+    );
+
+    m_ConvergenceMaskBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    m_ConvergenceMaskBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::HOST_READ_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::HOST_BIT
+    );
+
+    m_ConvergenceReadbackPending = true;
+}
+
+void PathTracer::SetAdaptiveSampling(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AdaptiveSampling = enabled;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetAdaptiveErrorThreshold(float threshold, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AdaptiveErrorThreshold = threshold;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &threshold, sizeof(float), offsetof(PathTracerUniform, AdaptiveErrorThreshold), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::SetAdaptiveMinSamples(uint32_t minSamples, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AdaptiveMinSamples = minSamples;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &minSamples, sizeof(uint32_t), offsetof(PathTracerUniform, AdaptiveMinSamples), commandBuffer);
+    ResetPathTracing();
+}
+
+void PathTracer::UpdateSchedule(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    uint32_t chunkCount = m_ScreenChunkCount;
+    uint32_t samplesPerFrame = m_SamplesPerFrame;
+
+    // Adaptive sampling derives the first frame with a valid convergence mask from the samples per frame and reprojection
+    // weights the history by its frame count, so they have to stay fixed
+    if (!m_TileScheduler.Update(chunkCount, samplesPerFrame, !m_AdaptiveSampling && !m_TemporalReprojection))
+        return;
+
+    // Accumulation continues, every pixel is still rendered exactly once per frame
+    if (chunkCount != m_ScreenChunkCount)
+    {
+        m_ScreenChunkCount = chunkCount;
+        UploadDataToBuffer(m_PathTracerUniformBuffer, &chunkCount, sizeof(uint32_t), offsetof(PathTracerUniform, ScreenChunkCount), commandBuffer);
+    }
+
+    if (samplesPerFrame != m_SamplesPerFrame)
+    {
+        m_SamplesPerFrame = samplesPerFrame;
+        UploadDataToBuffer(m_PathTracerUniformBuffer, &samplesPerFrame, sizeof(uint32_t), offsetof(PathTracerUniform, SampleCount), commandBuffer);
+    }
+}
+
+void PathTracer::ReadDispatchTimestamps()
+{
+    // Results are polled without waiting, slots that aren't done yet are checked again with the next dispatch
+    for (uint32_t slot = 0; slot < (uint32_t)m_DispatchTimings.size(); slot++)
+    {
+        DispatchTiming& timing = m_DispatchTimings[slot];
+        if (!timing.Pending)
+            continue;
+
+        std::array<uint64_t, 2> timestamps{};
+        if (m_DispatchTimestamps.GetResults(slot * 2, 2, timestamps.data()) != VulkanHelper::VHResult::OK)
+            continue;
+
+        const float milliseconds = (float)((double)(timestamps[1] - timestamps[0]) * (double)m_Device.GetTimestampPeriod() / 1e6);
+        m_TileScheduler.AddDispatchTime(milliseconds, timing.ChunkCount, timing.SamplesPerFrame);
+        timing.Pending = false;
+    }
+}
+
+void PathTracer::SetAutomaticScheduling(bool enabled)
+{
+    m_AutomaticScheduling = enabled;
+    m_TileScheduler.Reset();
+}
+
+void PathTracer::SetTargetDispatchTime(float milliseconds)
+{
+    m_TargetDispatchTime = milliseconds;
+
+    if (!m_SchedulerThroughputMode)
+        m_TileScheduler.SetTargetDispatchTime(milliseconds);
+}
+
+void PathTracer::SetSchedulerThroughputMode(bool enabled)
+{
+    if (m_SchedulerThroughputMode == enabled)
+        return;
+
+    m_SchedulerThroughputMode = enabled;
+    m_TileScheduler.SetTargetDispatchTime(enabled ? THROUGHPUT_DISPATCH_TIME : m_TargetDispatchTime);
+}
+
+void PathTracer::SetPreviewActive(bool active, VulkanHelper::CommandBuffer& commandBuffer)
+{
+    m_PreviewActive = active;
+
+    uint32_t chunkCount = GetActiveChunkCount();
+    uint32_t samplesPerFrame = GetActiveSamplesPerFrame();
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &chunkCount, sizeof(uint32_t), offsetof(PathTracerUniform, ScreenChunkCount), commandBuffer);
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &samplesPerFrame, sizeof(uint32_t), offsetof(PathTracerUniform, SampleCount), commandBuffer);
+
+    // Preview frames aren't accumulated, so the full resolution starts from scratch. Reset time is kept
+    // as it is, so that this doesn't count as a change that would start the preview again
+    m_FrameCount = 0;
+    m_ChunkIndex = 0;
+    m_SamplesAccumulated = 0;
+    m_ResetCount++;
+    m_ActiveTileCount = GetConvergenceTileCount();
+    m_ConvergenceReadbackPending = false;
+}
+
+void PathTracer::SetPreviewScale(uint32_t scale)
+{
+    m_PreviewScale = scale;
+    ResetPathTracing();
+}
+
+void PathTracer::SetAOVsEnabled(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_AOVsEnabled = enabled;
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::SetTemporalReprojection(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_TemporalReprojection = enabled;
+    CreateReprojectionBuffers();
+    AddReprojectionBuffersToDescriptorSet();
+    ResetPathTracing();
+    ReloadShaders(commandBuffer);
+}
+
+void PathTracer::CreateReprojectionBuffers()
+{
+    // History takes as much memory as the output and both AOVs together, so it's only allocated while it's used.
+    // Otherwise the buffers are just big enough to keep the descriptors valid
+    const uint64_t pixelCount = m_TemporalReprojection ? (uint64_t)m_Width * (uint64_t)m_Height : 1;
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(glm::vec4) * pixelCount;
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.DebugName = "Reprojection History";
+    for (auto& buffer : m_ReprojectionHistoryBuffers)
+        buffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Size = sizeof(glm::vec2) * pixelCount;
+    bufferConfig.DebugName = "Reprojection History Moments";
+    m_ReprojectionHistoryMomentsBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    m_ReprojectionPending = false;
+}
+
+void PathTracer::AddReprojectionBuffersToDescriptorSet()
+{
+    for (uint32_t i = 0; i < (uint32_t)m_ReprojectionHistoryBuffers.size(); i++)
+        VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(29, i, &m_ReprojectionHistoryBuffers[i]) == VulkanHelper::VHResult::OK, "Failed to add reprojection history buffer to descriptor set");
+
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(30, 0, &m_ReprojectionHistoryMomentsBuffer) == VulkanHelper::VHResult::OK, "Failed to add reprojection history moments buffer to descriptor set");
+}
+
+void PathTracer::CreateReprojectionPipeline()
+{
+    // Expects the shader session to be already initialized with the current defines
+    auto shaderRes = VulkanHelper::Shader::New({m_Device, "Reproject.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!shaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile reprojection shader, camera changes will restart the accumulation");
+        m_ReprojectionPipelineCreated = false;
+        m_ReprojectionPending = false;
+        return;
+    }
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.ComputeShader = shaderRes.Value();
+    pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet };
+
+    m_ReprojectionPipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+    m_ReprojectionPipelineCreated = true;
+}
+
+void PathTracer::ResetPathTracingForCameraChange(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    // Wavefront integrator accumulates with the global sample index, so it can't continue per pixel histories
+    if (!m_TemporalReprojection || !m_ReprojectionPipelineCreated || m_Integrator == Integrator::WAVEFRONT)
+    {
+        ResetPathTracing();
+        return;
+    }
+
+    // When the camera moves again before the first frame from the new view is done, the stored history is still
+    // the latest finished accumulation and it's kept together with the camera it was rendered from
+    if (m_FrameCount > 0)
+        StoreReprojectionHistory(commandBuffer);
+    else if (!m_ReprojectionPending)
+    {
+        ResetPathTracing();
+        return;
+    }
+
+    // Reprojected image is good enough to be shown right away, so camera changes don't start the low resolution preview
+    const auto lastResetTime = m_LastResetTime;
+    ResetPathTracing();
+    m_LastResetTime = lastResetTime;
+    m_ReprojectionPending = true;
 }
 
-void PathTracer::SetUseEnergyCompensation(bool useEnergyCompensation, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::StoreReprojectionHistory(VulkanHelper::CommandBuffer& commandBuffer)
 {
-    m_UseEnergyCompensation = useEnergyCompensation;
+    std::array<VulkanHelper::Image, 3> images = { m_OutputImageView.GetImage(), m_AlbedoImageView.GetImage(), m_NormalImageView.GetImage() };
+    for (uint32_t i = 0; i < (uint32_t)images.size(); i++)
+    {
+        images[i].TransitionImageLayout(VulkanHelper::Image::Layout::TRANSFER_SRC_OPTIMAL, commandBuffer);
+        VH_ASSERT(m_ReprojectionHistoryBuffers[i].CopyFromImage(commandBuffer, images[i]) == VulkanHelper::VHResult::OK, "Failed to copy image to reprojection history");
+    }
+
+    m_SampleMomentsBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::TRANSFER_READ_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT
+    );
+    VH_ASSERT(m_ReprojectionHistoryMomentsBuffer.CopyFromBuffer(commandBuffer, m_SampleMomentsBuffer, 0, 0, sizeof(glm::vec2) * (uint64_t)m_Width * (uint64_t)m_Height) == VulkanHelper::VHResult::OK, "Failed to copy sample moments to reprojection history");
+    m_SampleMomentsBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::TRANSFER_READ_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    // Camera the history was rendered from, the new one is uploaded by the caller
+    glm::mat4 previousViewProjection = glm::inverse(m_CameraProjectionInverse) * glm::inverse(m_CameraViewInverse);
+    glm::vec4 previousCameraPosition = m_CameraViewInverse[3];
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &previousViewProjection, sizeof(glm::mat4), offsetof(PathTracerUniform, PreviousViewProjection), commandBuffer);
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &previousCameraPosition, sizeof(glm::vec4), offsetof(PathTracerUniform, PreviousCameraPosition), commandBuffer);
+}
+
+void PathTracer::ReprojectHistory(VulkanHelper::CommandBuffer& commandBuffer)
+{
+    std::array<VulkanHelper::Image, 3> images = { m_OutputImageView.GetImage(), m_AlbedoImageView.GetImage(), m_NormalImageView.GetImage() };
+    for (VulkanHelper::Image& image : images)
+    {
+        image.Barrier(
+            commandBuffer, 0, 1,
+            VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+            VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+        );
+    }
+    m_SampleMomentsBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+    for (auto& buffer : m_ReprojectionHistoryBuffers)
+        buffer.Barrier(commandBuffer, VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT, VulkanHelper::PipelineStages::TRANSFER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
+    m_ReprojectionHistoryMomentsBuffer.Barrier(commandBuffer, VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT, VulkanHelper::PipelineStages::TRANSFER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
+
+    m_ReprojectionPipeline.Bind(commandBuffer);
+    m_ReprojectionPipeline.Dispatch(commandBuffer, (m_Width + 7) / 8, (m_Height + 7) / 8, 1);
+
+    for (VulkanHelper::Image& image : images)
+    {
+        image.Barrier(
+            commandBuffer, 0, 1,
+            VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+        );
+    }
+    m_SampleMomentsBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+}
+
+void PathTracer::SetReSTIR(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+{
+    m_ReSTIR = enabled;
+    CreateReservoirBuffers();
+    AddReservoirBuffersToDescriptorSet();
     ResetPathTracing();
     ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetFurnaceTestMode(bool furnaceTestMode, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetReSTIRUnbiased(bool unbiased, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_FurnaceTestMode = furnaceTestMode;
+    m_ReSTIRUnbiased = unbiased;
     ResetPathTracing();
     ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetSkyIntensity(float environmentIntensity, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetReSTIRCandidateCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_SkyIntensity = environmentIntensity;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_SkyIntensity, sizeof(float), offsetof(PathTracerUniform, SkyIntensity), commandBuffer);
+    m_ReSTIRCandidateCount = glm::max(count, 1u);
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_ReSTIRCandidateCount, sizeof(uint32_t), offsetof(PathTracerUniform, ReSTIRCandidateCount), commandBuffer);
     ResetPathTracing();
 }
 
-void PathTracer::SetUseRayQueries(bool useRayQueries, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetReSTIRSpatialSampleCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_UseRayQueries = useRayQueries;
+    m_ReSTIRSpatialSampleCount = glm::min(count, MAX_RESTIR_SPATIAL_SAMPLES);
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_ReSTIRSpatialSampleCount, sizeof(uint32_t), offsetof(PathTracerUniform, ReSTIRSpatialSampleCount), commandBuffer);
     ResetPathTracing();
-    ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetCameraViewInverse(const glm::mat4& view, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetReSTIRSpatialRadius(float radius, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_CameraViewInverse = view;
-
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_CameraViewInverse, sizeof(glm::mat4), offsetof(PathTracerUniform, CameraViewInverse), commandBuffer);
-
+    m_ReSTIRSpatialRadius = radius;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &radius, sizeof(float), offsetof(PathTracerUniform, ReSTIRSpatialRadius), commandBuffer);
     ResetPathTracing();
 }
 
-void PathTracer::SetCameraProjectionInverse(const glm::mat4& projection, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetReSTIRHistoryLimit(float limit, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_CameraProjectionInverse = projection;
-
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_CameraProjectionInverse, sizeof(glm::mat4), offsetof(PathTracerUniform, CameraProjectionInverse), commandBuffer);
-
+    m_ReSTIRHistoryLimit = limit;
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &limit, sizeof(float), offsetof(PathTracerUniform, ReSTIRHistoryLimit), commandBuffer);
     ResetPathTracing();
 }
 
-void PathTracer::SetPhaseFunction(PhaseFunction phaseFunction, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetPathGuiding(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_PhaseFunction = phaseFunction;
+    m_PathGuiding = enabled;
+    CreateGuidingBuffers();
+    AddGuidingBuffersToDescriptorSet();
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_GuidingSelectionProbability, sizeof(float), offsetof(PathTracerUniform, GuidingSelectionProbability), commandBuffer);
     ResetPathTracing();
     ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetSplitScreenCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetGuidingTrainingFrames(uint32_t frames)
 {
-    m_ScreenChunkCount = count;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &count, sizeof(uint32_t), offsetof(PathTracerUniform, ScreenChunkCount), commandBuffer);
+    m_GuidingTrainingFrames = frames;
     ResetPathTracing();
 }
 
-void PathTracer::SetEnableAtmosphere(bool enabled, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetGuidingSelectionProbability(float probability, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_EnableAtmosphere = enabled;
+    m_GuidingSelectionProbability = glm::clamp(probability, 0.0f, 0.95f); // BSDF sampling has to stay possible for the MIS
+    UploadDataToBuffer(m_PathTracerUniformBuffer, &m_GuidingSelectionProbability, sizeof(float), offsetof(PathTracerUniform, GuidingSelectionProbability), commandBuffer);
     ResetPathTracing();
-    ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetPlanetRadius(float radius, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::SetSamplerType(SamplerType type, VulkanHelper::CommandBuffer commandBuffer)
 {
-    m_PlanetRadius = radius;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &radius, sizeof(float), offsetof(PathTracerUniform, PlanetRadius), commandBuffer);
+    m_SamplerType = type;
     ResetPathTracing();
+    ReloadShaders(commandBuffer);
 }
 
-void PathTracer::SetAtmosphereHeight(float height, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::CreateGuidingBuffers()
 {
-    m_AtmosphereHeight = height;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &height, sizeof(float), offsetof(PathTracerUniform, AtmosphereHeight), commandBuffer);
-    ResetPathTracing();
+    // Guide is cleared by the update pass before it's used, so the contents don't have to be initialized.
+    // Same as the reservoirs, the buffers are only allocated while they're used
+    const uint64_t binCount = m_PathGuiding ? (uint64_t)GUIDING_GRID_RESOLUTION * GUIDING_GRID_RESOLUTION * GUIDING_GRID_RESOLUTION * GUIDING_BIN_COUNT : 1;
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(uint32_t) * binCount;
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+    bufferConfig.DebugName = "Guiding Training";
+    m_GuidingTrainingBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Size = sizeof(float) * binCount;
+    bufferConfig.DebugName = "Guiding Radiance";
+    m_GuidingRadianceBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.DebugName = "Guiding Distribution";
+    m_GuidingDistributionBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    m_GuidingResetPending = true;
 }
 
-void PathTracer::SetRayleighScatteringCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AddGuidingBuffersToDescriptorSet()
 {
-    m_RayleighScatteringCoefficientMultiplier = multiplier;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, RayleighScatteringCoefficientMultiplier), commandBuffer);
-    ResetPathTracing();
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(35, 0, &m_GuidingTrainingBuffer) == VulkanHelper::VHResult::OK, "Failed to add guiding training buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(36, 0, &m_GuidingRadianceBuffer) == VulkanHelper::VHResult::OK, "Failed to add guiding radiance buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(37, 0, &m_GuidingDistributionBuffer) == VulkanHelper::VHResult::OK, "Failed to add guiding distribution buffer to descriptor set");
 }
 
-void PathTracer::SetMieScatteringCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::CreateAtmosphereTransmittancePipeline()
 {
-    m_MieScatteringCoefficientMultiplier = multiplier;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, MieScatteringCoefficientMultiplier), commandBuffer);
-    ResetPathTracing();
+    // Expects the shader session to be already initialized with the current defines
+    auto shaderRes = VulkanHelper::Shader::New({m_Device, "AtmosphereTransmittance.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!shaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile atmosphere transmittance shader, transmittance LUT won't be updated");
+        m_AtmosphereTransmittancePipelineCreated = false;
+        return;
+    }
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.ComputeShader = shaderRes.Value();
+    pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet };
+
+    m_AtmosphereTransmittancePipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+    m_AtmosphereTransmittancePipelineCreated = true;
 }
 
-void PathTracer::SetOzoneAbsorptionCoefficientMultiplier(const glm::vec3& multiplier, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::UpdateAtmosphereTransmittanceLUT(VulkanHelper::CommandBuffer& commandBuffer)
 {
-    m_OzoneAbsorptionCoefficientMultiplier = multiplier;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&multiplier, sizeof(glm::vec3), offsetof(PathTracerUniform, OzoneAbsorptionCoefficientMultiplier), commandBuffer);
-    ResetPathTracing();
+    // LUT is updated even when the shaders don't read it, so it's always in the layout the descriptor set expects
+    m_AtmosphereTransmittanceLUT.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+    m_AtmosphereTransmittanceLUT.GetImage().Barrier(
+        commandBuffer, 0, 1,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    if (m_AtmosphereTransmittancePipelineCreated)
+    {
+        m_AtmosphereTransmittancePipeline.Bind(commandBuffer);
+        m_AtmosphereTransmittancePipeline.Dispatch(commandBuffer, ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH / 8, ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT / 8, 1);
+    }
+
+    m_AtmosphereTransmittanceLUT.GetImage().Barrier(
+        commandBuffer, 0, 1,
+        VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+        VulkanHelper::AccessFlags::SHADER_READ_BIT,
+        VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
 }
 
-void PathTracer::SetPlanetPosition(const glm::vec3& position, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::CreateGuidingPipeline(VulkanHelper::CommandBuffer& commandBuffer)
 {
-    m_PlanetPosition = position;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&position, sizeof(glm::vec3), offsetof(PathTracerUniform, PlanetPosition), commandBuffer);
-    ResetPathTracing();
+    // Expects the shader session to be already initialized with the current defines
+    auto shaderRes = VulkanHelper::Shader::New({m_Device, "GuidingUpdate.slang", VulkanHelper::ShaderStages::COMPUTE_BIT});
+
+    if (!shaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile guiding update shader, path guiding is disabled");
+        m_PathGuiding = false;
+
+        // Path tracing shaders may already be compiled with guiding, without a selection probability they never sample
+        // the guide that isn't cleared or trained anymore. SetPathGuiding() restores it
+        float selectionProbability = 0.0f;
+        UploadDataToBuffer(m_PathTracerUniformBuffer, &selectionProbability, sizeof(float), offsetof(PathTracerUniform, GuidingSelectionProbability), commandBuffer);
+        return;
+    }
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig{};
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.ComputeShader = shaderRes.Value();
+    pipelineConfig.DescriptorSets = { m_PathTracerDescriptorSet };
+    pipelineConfig.PushConstant = &m_GuidingPushConstant;
+
+    m_GuidingPipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
 }
 
-void PathTracer::SetRayleighDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::UpdateGuiding(VulkanHelper::CommandBuffer& commandBuffer, bool clear)
 {
-    m_RayleighDensityFalloff = falloff;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, RayleighDensityFalloff), commandBuffer);
-    ResetPathTracing();
+    // Splats are merged into the float histograms after every training dispatch. A single dispatch can still splat more
+    // into a bin than the 32 bit counters hold, Guiding.slang saturates them instead of letting them wrap around
+    std::array<VulkanHelper::Buffer*, 3> buffers = { &m_GuidingTrainingBuffer, &m_GuidingRadianceBuffer, &m_GuidingDistributionBuffer };
+    for (VulkanHelper::Buffer* buffer : buffers)
+    {
+        buffer->Barrier(
+            commandBuffer,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR,
+            VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+        );
+    }
+
+    PushConstantData data{};
+    data.GuidingClear = clear ? 1 : 0;
+    VH_ASSERT(m_GuidingPushConstant.SetData(&data, sizeof(PushConstantData)) == VulkanHelper::VHResult::OK, "Failed to set push constant data");
+
+    const uint32_t cellCount = GUIDING_GRID_RESOLUTION * GUIDING_GRID_RESOLUTION * GUIDING_GRID_RESOLUTION;
+    m_GuidingPipeline.Bind(commandBuffer);
+    m_GuidingPipeline.Dispatch(commandBuffer, (cellCount + 63) / 64, 1, 1);
+
+    for (VulkanHelper::Buffer* buffer : buffers)
+    {
+        buffer->Barrier(
+            commandBuffer,
+            VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT,
+            VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+            VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR
+        );
+    }
 }
 
-void PathTracer::SetMieDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::CreateReservoirBuffers()
 {
-    m_MieDensityFalloff = falloff;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, MieDensityFalloff), commandBuffer);
-    ResetPathTracing();
+    // Shaders clear the reservoir of every pixel they render, so the contents don't have to be initialized.
+    // Same as the reprojection history, the buffers are only allocated while they're used
+    const uint64_t pixelCount = m_ReSTIR ? (uint64_t)m_Width * (uint64_t)m_Height : 1;
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(Reservoir) * pixelCount;
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+    bufferConfig.DebugName = "ReSTIR Reservoirs";
+    for (auto& buffer : m_ReservoirBuffers)
+        buffer = VulkanHelper::Buffer::New(bufferConfig).Value();
 }
 
-void PathTracer::SetOzoneDensityFalloff(float falloff, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AddReservoirBuffersToDescriptorSet()
 {
-    m_OzoneDensityFalloff = falloff;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &falloff, sizeof(float), offsetof(PathTracerUniform, OzoneDensityFalloff), commandBuffer);
-    ResetPathTracing();
+    for (uint32_t i = 0; i < (uint32_t)m_ReservoirBuffers.size(); i++)
+        VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(31, i, &m_ReservoirBuffers[i]) == VulkanHelper::VHResult::OK, "Failed to add reservoir buffer to descriptor set");
 }
 
-void PathTracer::SetOzonePeak(float altitude, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::BuildEmissiveTriangleTable(VulkanHelper::CommandBuffer& commandBuffer)
 {
-    m_OzonePeak = altitude;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &altitude, sizeof(float), offsetof(PathTracerUniform, OzonePeak), commandBuffer);
-    ResetPathTracing();
+    std::vector<EmissiveTriangleEntry> triangles;
+    triangles.reserve(m_EmissiveTriangleCount);
+    std::vector<double> weights;
+    weights.reserve(m_EmissiveTriangleCount);
+    std::vector<double> trianglePowers;
+    trianglePowers.reserve(m_EmissiveTriangleCount);
+    std::vector<uint32_t> instanceOffsets(m_SceneMeshInstances.size(), UINT32_MAX);
+    std::vector<float> meshPowers(m_EmissiveMeshes.size());
+
+    // Roots of the instance trees are the items of the top level
+    std::vector<std::pair<LightBounds, uint32_t>> instanceItems;
+    instanceItems.reserve(m_EmissiveMeshes.size());
+
+    double weightSum = 0.0;
+    for (uint32_t i = 0; i < (uint32_t)m_EmissiveMeshes.size(); i++)
+    {
+        const EmissiveMeshEntry& emissiveMesh = m_EmissiveMeshes[i];
+        instanceOffsets[emissiveMesh.InstanceIndex] = (uint32_t)triangles.size();
+
+        // Power is the brightest channel, same as the importance of the environment map texels.
+        // Emissive textures aren't taken into account, they only modulate the color inside of the triangle
+        const glm::vec3 emissiveColor = m_Materials[emissiveMesh.MaterialIndex].EmissiveColor;
+        meshPowers[i] = std::max(glm::max(emissiveColor.r, glm::max(emissiveColor.g, emissiveColor.b)), 0.0f);
+
+        const MeshInfoEntry& meshInfo = m_SceneMeshInfo[emissiveMesh.MeshIndex];
+        for (uint32_t j = 0; j < emissiveMesh.TriangleCount; j++)
+        {
+            const glm::vec3 v0 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[j * 3 + 0]], 1.0f));
+            const glm::vec3 v1 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[j * 3 + 1]], 1.0f));
+            const glm::vec3 v2 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[j * 3 + 2]], 1.0f));
+            const float area = glm::length(glm::cross(v1 - v0, v2 - v0)) * 0.5f;
+            const double weight = (double)area * (double)meshPowers[i];
+
+            triangles.push_back({
+                .Alias = (uint32_t)triangles.size(),
+                .Importance = 0.0f,
+                .EmissiveMeshIndex = i,
+                .TriangleIndex = j,
+                .PDF = 0.0f,
+                .Area = area,
+                .LightTreeLeaf = UINT32_MAX
+            });
+            weights.push_back(weight);
+            trianglePowers.push_back(meshPowers[i]);
+            weightSum += weight;
+        }
+
+        const std::vector<LightTreeNode>& instanceTree = GetInstanceLightTree(emissiveMesh);
+        if (!instanceTree.empty() && meshPowers[i] > 0.0f)
+        {
+            LightBounds bounds;
+            bounds.BoundsMin = instanceTree[0].BoundsMin;
+            bounds.BoundsMax = instanceTree[0].BoundsMax;
+            bounds.Axis = instanceTree[0].Axis;
+            bounds.CosThetaO = instanceTree[0].CosThetaO;
+            bounds.Power = instanceTree[0].Power * meshPowers[i];
+            instanceItems.push_back({ bounds, i });
+        }
+    }
+
+    // Same construction as the alias map of the environment map. Every entry is filled up to the average
+    // weight by the entry itself and its alias, so sampling only takes a single lookup
+    const uint32_t triangleCount = (uint32_t)triangles.size();
+    if (weightSum > 0.0)
+    {
+        const double average = weightSum / double(triangleCount);
+        std::vector<double> importance(triangleCount);
+        std::vector<uint32_t> lowEnergy;
+        std::vector<uint32_t> highEnergy;
+        for (uint32_t i = 0; i < triangleCount; i++)
+        {
+            importance[i] = weights[i] / average;
+
+            // Triangles are sampled uniformly over their area, so the area cancels out of the PDF
+            triangles[i].PDF = (float)(trianglePowers[i] / weightSum);
+
+            if (importance[i] < 1.0)
+                lowEnergy.push_back(i);
+            else
+                highEnergy.push_back(i);
+        }
+
+        while (!lowEnergy.empty() && !highEnergy.empty())
+        {
+            const uint32_t lowEnergyIndex = lowEnergy.back();
+            const uint32_t highEnergyIndex = highEnergy.back();
+            lowEnergy.pop_back();
+
+            triangles[lowEnergyIndex].Alias = highEnergyIndex;
+            triangles[lowEnergyIndex].Importance = (float)importance[lowEnergyIndex];
+
+            importance[highEnergyIndex] -= 1.0 - importance[lowEnergyIndex];
+            if (importance[highEnergyIndex] < 1.0)
+            {
+                highEnergy.pop_back();
+                lowEnergy.push_back(highEnergyIndex);
+            }
+        }
+
+        // Whatever is left over is only off by rounding errors
+        for (uint32_t i : lowEnergy)
+            triangles[i].Importance = 1.0f;
+        for (uint32_t i : highEnergy)
+            triangles[i].Importance = 1.0f;
+    }
+
+    // Top level of the light tree is built over the instances, its leaves are then replaced with the cached instance trees
+    std::vector<LightTreeNode> topLevelNodes;
+    if (!instanceItems.empty())
+        BuildLightTree(instanceItems, 0, (uint32_t)instanceItems.size(), UINT32_MAX, topLevelNodes);
+
+    std::vector<LightTreeNode> lightTree;
+    std::function<void(uint32_t, uint32_t)> flattenLightTree = [&](uint32_t topLevelIndex, uint32_t parent)
+    {
+        const LightTreeNode& topLevelNode = topLevelNodes[topLevelIndex];
+        if (topLevelNode.IsLeaf == 0)
+        {
+            const uint32_t nodeIndex = (uint32_t)lightTree.size();
+            lightTree.push_back(topLevelNode);
+            lightTree[nodeIndex].Parent = parent;
+
+            flattenLightTree(topLevelIndex + 1, nodeIndex);
+            lightTree[nodeIndex].ChildOrTriangle = (uint32_t)lightTree.size();
+            flattenLightTree(topLevelNode.ChildOrTriangle, nodeIndex);
+            return;
+        }
+
+        const uint32_t emissiveMeshIndex = topLevelNode.ChildOrTriangle;
+        const EmissiveMeshEntry& emissiveMesh = m_EmissiveMeshes[emissiveMeshIndex];
+        const uint32_t base = (uint32_t)lightTree.size();
+        for (LightTreeNode node : m_InstanceLightTrees[emissiveMesh.InstanceIndex])
+        {
+            node.Power *= meshPowers[emissiveMeshIndex];
+            node.Parent = node.Parent == UINT32_MAX ? parent : node.Parent + base;
+            if (node.IsLeaf != 0)
+            {
+                node.ChildOrTriangle += instanceOffsets[emissiveMesh.InstanceIndex];
+                triangles[node.ChildOrTriangle].LightTreeLeaf = (uint32_t)lightTree.size();
+            }
+            else
+            {
+                node.ChildOrTriangle += base;
+            }
+
+            lightTree.push_back(node);
+        }
+    };
+
+    if (!topLevelNodes.empty())
+        flattenLightTree(0, UINT32_MAX);
+    else
+        lightTree.push_back({ .Power = 0.0f, .ChildOrTriangle = UINT32_MAX, .Parent = UINT32_MAX, .IsLeaf = 1 }); // Nothing to sample
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = m_Device;
+    bufferConfig.Size = sizeof(EmissiveTriangleEntry) * std::max(triangleCount, 1u);
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+    bufferConfig.DebugName = "Emissive Triangles";
+    m_EmissiveTrianglesBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Size = sizeof(LightTreeNode) * lightTree.size();
+    bufferConfig.DebugName = "Light Tree";
+    m_LightTreeBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    if (triangleCount > 0)
+        UploadDataToBuffer(m_EmissiveTrianglesBuffer, triangles.data(), sizeof(EmissiveTriangleEntry) * triangles.size(), 0, commandBuffer);
+
+    UploadDataToBuffer(m_LightTreeBuffer, lightTree.data(), sizeof(LightTreeNode) * lightTree.size(), 0, commandBuffer);
+
+    if (!instanceOffsets.empty())
+        UploadDataToBuffer(m_InstanceEmissiveOffsetsBuffer, instanceOffsets.data(), sizeof(uint32_t) * instanceOffsets.size(), 0, commandBuffer);
 }
 
-void PathTracer::SetSunColor(const glm::vec3& color, VulkanHelper::CommandBuffer commandBuffer)
+void PathTracer::AddEmissiveTrianglesToDescriptorSet()
 {
-    m_SunColor = color;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, (void*)&color, sizeof(glm::vec3), offsetof(PathTracerUniform, SunColor), commandBuffer);
-    ResetPathTracing();
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(32, 0, &m_EmissiveTrianglesBuffer) == VulkanHelper::VHResult::OK, "Failed to add emissive triangles buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(33, 0, &m_InstanceEmissiveOffsetsBuffer) == VulkanHelper::VHResult::OK, "Failed to add instance emissive offsets buffer to descriptor set");
+    VH_ASSERT(m_PathTracerDescriptorSet.AddBuffer(34, 0, &m_LightTreeBuffer) == VulkanHelper::VHResult::OK, "Failed to add light tree buffer to descriptor set");
 }
 
-void PathTracer::SetEmissiveMeshSamplingPDFBias(float bias, VulkanHelper::CommandBuffer commandBuffer)
+PathTracer::LightBounds PathTracer::UnionLightBounds(const LightBounds& a, const LightBounds& b)
 {
-    m_EmissiveMeshSamplingPDFBias = bias;
-    UploadDataToBuffer(m_PathTracerUniformBuffer, &bias, sizeof(float), offsetof(PathTracerUniform, EmissiveMeshSamplingPDFBias), commandBuffer);
-    ResetPathTracing();
-}
\ No newline at end of file
+    if (a.Power <= 0.0f)
+        return b;
+    if (b.Power <= 0.0f)
+        return a;
+
+    LightBounds bounds;
+    bounds.BoundsMin = glm::min(a.BoundsMin, b.BoundsMin);
+    bounds.BoundsMax = glm::max(a.BoundsMax, b.BoundsMax);
+    bounds.Power = a.Power + b.Power;
+
+    // Smallest cone containing the cones of both bounds
+    const float pi = std::numbers::pi_v<float>;
+    const float thetaA = std::acos(glm::clamp(a.CosThetaO, -1.0f, 1.0f));
+    const float thetaB = std::acos(glm::clamp(b.CosThetaO, -1.0f, 1.0f));
+    const float thetaD = std::acos(glm::clamp(glm::dot(a.Axis, b.Axis), -1.0f, 1.0f));
+    if (std::min(thetaD + thetaB, pi) <= thetaA)
+    {
+        bounds.Axis = a.Axis;
+        bounds.CosThetaO = a.CosThetaO;
+        return bounds;
+    }
+    if (std::min(thetaD + thetaA, pi) <= thetaB)
+    {
+        bounds.Axis = b.Axis;
+        bounds.CosThetaO = b.CosThetaO;
+        return bounds;
+    }
+
+    const float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+    const glm::vec3 rotationAxis = glm::cross(a.Axis, b.Axis);
+    if (thetaO >= pi || glm::dot(rotationAxis, rotationAxis) <= 0.0f)
+    {
+        bounds.Axis = a.Axis;
+        bounds.CosThetaO = -1.0f; // Whole sphere
+        return bounds;
+    }
+
+    bounds.Axis = glm::normalize(glm::angleAxis(thetaO - thetaA, glm::normalize(rotationAxis)) * a.Axis);
+    bounds.CosThetaO = std::cos(thetaO);
+    return bounds;
+}
+
+void PathTracer::BuildLightTree(std::vector<std::pair<LightBounds, uint32_t>>& items, uint32_t start, uint32_t end, uint32_t parent, std::vector<LightTreeNode>& nodes)
+{
+    const uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.push_back({});
+
+    LightBounds bounds;
+    glm::vec3 centroidMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 centroidMax = glm::vec3(-std::numeric_limits<float>::max());
+    for (uint32_t i = start; i < end; i++)
+    {
+        bounds = UnionLightBounds(bounds, items[i].first);
+
+        const glm::vec3 centroid = (items[i].first.BoundsMin + items[i].first.BoundsMax) * 0.5f;
+        centroidMin = glm::min(centroidMin, centroid);
+        centroidMax = glm::max(centroidMax, centroid);
+    }
+
+    if (end - start == 1)
+    {
+        nodes[nodeIndex] = { bounds.BoundsMin, bounds.Power, bounds.BoundsMax, bounds.CosThetaO, bounds.Axis, items[start].second, parent, 1 };
+        return;
+    }
+
+    // Cost of a group of lights from "Importance Sampling of Many Lights with Adaptive Tree Splitting" (Conty Estevez, Kulla), the
+    // orientation term is the solid angle the group can emit to. Emission of the triangles covers the whole hemisphere
+    const float pi = std::numbers::pi_v<float>;
+    const glm::vec3 extent = bounds.BoundsMax - bounds.BoundsMin;
+    auto evaluateCost = [&](const LightBounds& group, int axis)
+    {
+        const float thetaO = std::acos(glm::clamp(group.CosThetaO, -1.0f, 1.0f));
+        const float thetaW = std::min(thetaO + pi * 0.5f, pi);
+        const float sinThetaO = std::sqrt(std::max(0.0f, 1.0f - group.CosThetaO * group.CosThetaO));
+        const float orientation = 2.0f * pi * (1.0f - group.CosThetaO) + pi * 0.5f * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + group.CosThetaO);
+
+        const glm::vec3 groupExtent = group.BoundsMax - group.BoundsMin;
+        const float surfaceArea = 2.0f * (groupExtent.x * groupExtent.y + groupExtent.y * groupExtent.z + groupExtent.z * groupExtent.x);
+
+        // Splits across the longest axis are preferred
+        const float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+        const float regularization = extent[axis] > 0.0f ? maxExtent / extent[axis] : 1.0f;
+
+        return group.Power * orientation * surfaceArea * regularization;
+    };
+
+    constexpr uint32_t bucketCount = 12;
+    auto getBucket = [&](const LightBounds& item, int axis)
+    {
+        const float centroid = (item.BoundsMin[axis] + item.BoundsMax[axis]) * 0.5f;
+        const float relative = (centroid - centroidMin[axis]) / (centroidMax[axis] - centroidMin[axis]);
+        return std::min((uint32_t)(relative * (float)bucketCount), bucketCount - 1);
+    };
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint32_t bestBucket = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroidMax[axis] <= centroidMin[axis])
+            continue;
+
+        std::array<LightBounds, bucketCount> buckets{};
+        std::array<uint32_t, bucketCount> bucketItemCounts{};
+        for (uint32_t i = start; i < end; i++)
+        {
+            const uint32_t bucket = getBucket(items[i].first, axis);
+            buckets[bucket] = UnionLightBounds(buckets[bucket], items[i].first);
+            bucketItemCounts[bucket]++;
+        }
+
+        for (uint32_t split = 0; split < bucketCount - 1; split++)
+        {
+            LightBounds below;
+            LightBounds above;
+            uint32_t belowCount = 0;
+            uint32_t aboveCount = 0;
+            for (uint32_t i = 0; i <= split; i++)
+            {
+                below = UnionLightBounds(below, buckets[i]);
+                belowCount += bucketItemCounts[i];
+            }
+            for (uint32_t i = split + 1; i < bucketCount; i++)
+            {
+                above = UnionLightBounds(above, buckets[i]);
+                aboveCount += bucketItemCounts[i];
+            }
+
+            if (belowCount == 0 || aboveCount == 0)
+                continue;
+
+            const float cost = evaluateCost(below, axis) + evaluateCost(above, axis);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBucket = split;
+            }
+        }
+    }
+
+    // Lights with all centroids at the same point can't be split by position, so they're just split in half
+    uint32_t mid = (start + end) / 2;
+    if (bestAxis != -1)
+    {
+        auto midIt = std::partition(items.begin() + start, items.begin() + end, [&](const std::pair<LightBounds, uint32_t>& item) {
+            return getBucket(item.first, bestAxis) <= bestBucket;
+        });
+        mid = (uint32_t)(midIt - items.begin());
+    }
+
+    BuildLightTree(items, start, mid, nodeIndex, nodes);
+    const uint32_t secondChild = (uint32_t)nodes.size();
+    BuildLightTree(items, mid, end, nodeIndex, nodes);
+
+    nodes[nodeIndex] = { bounds.BoundsMin, bounds.Power, bounds.BoundsMax, bounds.CosThetaO, bounds.Axis, secondChild, parent, 0 };
+}
+
+const std::vector<PathTracer::LightTreeNode>& PathTracer::GetInstanceLightTree(const EmissiveMeshEntry& emissiveMesh)
+{
+    auto cached = m_InstanceLightTrees.find(emissiveMesh.InstanceIndex);
+    if (cached != m_InstanceLightTrees.end())
+        return cached->second;
+
+    const MeshInfoEntry& meshInfo = m_SceneMeshInfo[emissiveMesh.MeshIndex];
+
+    // Degenerate triangles can't be hit or sampled, so they're left out
+    std::vector<std::pair<LightBounds, uint32_t>> items;
+    items.reserve(emissiveMesh.TriangleCount);
+    for (uint32_t i = 0; i < emissiveMesh.TriangleCount; i++)
+    {
+        const glm::vec3 v0 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[i * 3 + 0]], 1.0f));
+        const glm::vec3 v1 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[i * 3 + 1]], 1.0f));
+        const glm::vec3 v2 = glm::vec3(emissiveMesh.Transform * glm::vec4(meshInfo.Positions[meshInfo.Indices[i * 3 + 2]], 1.0f));
+
+        const glm::vec3 crossProduct = glm::cross(v1 - v0, v2 - v0);
+        const float area = glm::length(crossProduct) * 0.5f;
+        if (area <= 0.0f)
+            continue;
+
+        LightBounds bounds;
+        bounds.BoundsMin = glm::min(v0, glm::min(v1, v2));
+        bounds.BoundsMax = glm::max(v0, glm::max(v1, v2));
+        bounds.Axis = crossProduct / (area * 2.0f);
+        bounds.CosThetaO = 1.0f;
+        bounds.Power = area;
+        items.push_back({ bounds, i });
+    }
+
+    std::vector<LightTreeNode>& nodes = m_InstanceLightTrees[emissiveMesh.InstanceIndex];
+    if (!items.empty())
+    {
+        nodes.reserve(items.size() * 2 - 1);
+        BuildLightTree(items, 0, (uint32_t)items.size(), UINT32_MAX, nodes);
+    }
+
+    return nodes;
+}
@@ -3,12 +3,24 @@
 #include "Vulkan/Buffer.h"
 #include "Vulkan/CommandPool.h"
 #include "VulkanHelper.h"
+#include "VolumeGridManager.h"
+#include "VolumeBrickStreamer.h"
+#include "TileScheduler.h"
 
+#include <array>
+#include <limits>
+#include <chrono>
 #include <unordered_map>
+#include <future>
+#include <memory>
 
 class PathTracer
 {
 public:
+    struct VolumeSequence;
+
+    constexpr static uint32_t MAX_SPLIT_SCREEN_COUNT = 4; // Automatic scheduling doesn't split the screen any further either
+
     struct Material
     {
         glm::vec3 BaseColor = glm::vec3(1.0f);
@@ -33,6 +45,14 @@ public:
         uint32_t EmissiveTextureIndex = 0;
     };
 
+    // How shadow rays estimate transmittance through heterogeneous volumes and the atmosphere
+    enum class TransmittanceEstimator
+    {
+        DELTA_TRACKING = 0, // Binary, either 0 or 1, cheapest but the noisiest
+        RATIO_TRACKING = 1,
+        RESIDUAL_RATIO_TRACKING = 2 // Part of the majorant is used as a control density and integrated analytically
+    };
+
     struct Volume
     {
         // AABB
@@ -66,11 +86,70 @@ public:
 
         float GridSharpness = 1.0f; // Used to adjust density sampling from NanoVDB grids
 
+        TransmittanceEstimator Estimator = TransmittanceEstimator::DELTA_TRACKING;
+        float ResidualControlFraction = 0.5f; // Fraction of the block majorant used as control density for residual ratio tracking
+
         VulkanHelper::Buffer VolumeNanoBufferDensity;
         VulkanHelper::Buffer VolumeNanoBufferTemperature;
 
         // Heterogeneous volumes are split into 32x32x32 regions for skipping empty space
         VulkanHelper::Buffer MaxDensitiesBuffer;
+
+        // Set if the density data comes from a VDB sequence, shared between copies of the volume
+        std::shared_ptr<VolumeSequence> Sequence;
+
+        // Set if the density data is streamed in bricks instead of being fully resident
+        std::shared_ptr<VolumeBrickStreamer> BrickStreamer;
+    };
+
+    enum class GridQuantization
+    {
+        NONE = 0, // Full fp32
+        FP16 = 1,
+        FP8 = 2,
+        FPN = 3 // Variable bit rate, bit count per leaf is chosen so that the error stays under the tolerance
+    };
+
+    struct VolumeImportSettings
+    {
+        GridQuantization Quantization = GridQuantization::NONE;
+        float Tolerance = 0.005f; // Max error for FPN, relative to the max value in the grid
+
+        // Streams the density grid from disk in bricks, for grids that don't fit into VRAM.
+        // Bricks are always stored as fp32, so quantization is ignored
+        bool Streamed = false;
+        uint32_t BrickPoolSizeMB = 1024;
+    };
+
+    // Density data converted from an OpenVDB file, ready to be uploaded to the GPU.
+    // It doesn't touch any vulkan objects so it can be created on worker threads.
+    struct VolumeGridData
+    {
+        glm::vec3 CornerMin = glm::vec3(-1.0f);
+        glm::vec3 CornerMax = glm::vec3(1.0f);
+        float MaxDensityInTheGrid = 0.0f;
+
+        std::vector<uint8_t> DensityNanoGrid;
+        std::vector<uint8_t> TemperatureNanoGrid; // Empty if there's no temperature grid
+        std::vector<float> MaxDensities;
+    };
+
+    struct VolumeSequence
+    {
+        std::vector<std::string> Frames;
+        VolumeImportSettings ImportSettings;
+        uint32_t CurrentFrame = 0;
+        bool Playing = false;
+        bool CurrentFrameFailed = false; // Previous frame's data is still shown
+
+        // Frames are uploaded alternately into these two slots, so the slot that's currently
+        // being rendered is never rebound while the next frame is being uploaded
+        int DensityDataIndices[2] = { -1, -1 };
+        uint32_t FrontSlot = 0;
+
+        // Next frame converted on the thread pool while the current one renders
+        std::future<std::shared_ptr<VolumeGridData>> Prefetch;
+        uint32_t PrefetchedFrame = 0;
     };
 
     enum class PhaseFunction
@@ -80,6 +159,25 @@ public:
         HENYEY_GREENSTEIN_PLUS_DRAINE = 2
     };
 
+    // How paths are traced. Megakernel runs the whole path in a single ray generation shader, wavefront splits
+    // it into stages (generate, extend, shade surface, shade volume, connect shadow rays, accumulate) that pass
+    // paths to each other through queues, so that threads of a single dispatch don't diverge as much.
+    // Inline ray query runs the whole path in a compute shader and traces with ray queries, it requires ray query support
+    enum class Integrator
+    {
+        MEGAKERNEL = 0,
+        WAVEFRONT = 1,
+        INLINE_RAY_QUERY = 2
+    };
+
+    // Source of the random numbers of the paths. PCG is independent for every decision, Sobol gives every decision of
+    // every bounce its own dimension of an Owen scrambled low discrepancy sequence, with the error spread as blue noise over the pixels
+    enum class SamplerType
+    {
+        PCG = 0,
+        SOBOL = 1
+    };
+
     [[nodiscard]] static PathTracer New(const VulkanHelper::Device& device, VulkanHelper::ThreadPool* threadPool);
 
     void SetScene(const std::string& sceneFilePath);
@@ -92,6 +190,9 @@ public:
     void ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer);
 
     [[nodiscard]] inline VulkanHelper::ImageView GetOutputImageView() const { return m_OutputImageView; }
+    [[nodiscard]] inline VulkanHelper::ImageView GetAlbedoImageView() const { return m_AlbedoImageView; }
+    [[nodiscard]] inline VulkanHelper::ImageView GetNormalImageView() const { return m_NormalImageView; }
+    [[nodiscard]] inline VulkanHelper::Buffer GetSampleMomentsBuffer() const { return m_SampleMomentsBuffer; }
     [[nodiscard]] inline VulkanHelper::Image GetOutputImage() const { return m_OutputImageView.GetImage(); }
 
     [[nodiscard]] inline const std::vector<Material>& GetMaterials() const { return m_Materials; }
@@ -106,6 +207,7 @@ public:
     void SetPhaseFunction(PhaseFunction phaseFunction, VulkanHelper::CommandBuffer commandBuffer);
 
     [[nodiscard]] inline uint32_t GetSamplesAccumulated() const { return m_SamplesAccumulated; }
+    [[nodiscard]] inline uint32_t GetResetCount() const { return m_ResetCount; }
     [[nodiscard]] inline uint32_t GetSamplesPerFrame() const { return m_SamplesPerFrame; }
     [[nodiscard]] inline uint32_t GetMaxSamplesAccumulated() const { return m_MaxSamplesAccumulated; }
     [[nodiscard]] inline uint32_t GetMaxDepth() const { return m_MaxDepth; }
@@ -131,6 +233,7 @@ public:
     [[nodiscard]] inline PhaseFunction GetPhaseFunction() const { return m_PhaseFunction; }
     [[nodiscard]] inline uint32_t GetSplitScreenCount() const { return m_ScreenChunkCount; }
     [[nodiscard]] inline bool IsAtmosphereEnabled() const { return m_EnableAtmosphere; }
+    [[nodiscard]] inline bool IsApproximateSkyEnabled() const { return m_ApproximateSky; }
     [[nodiscard]] inline const glm::vec3& GetPlanetPosition() const { return m_PlanetPosition; }
     [[nodiscard]] inline float GetPlanetRadius() const { return m_PlanetRadius; }
     [[nodiscard]] inline float GetAtmosphereHeight() const { return m_AtmosphereHeight; }
@@ -144,6 +247,36 @@ public:
     [[nodiscard]] inline const glm::vec3& GetSunColor() const { return m_SunColor; }
     [[nodiscard]] inline bool IsMeshMISEnabled() const { return m_EnableMeshMIS; }
     [[nodiscard]] inline float GetEmissiveMeshSamplingPDFBias() const { return m_EmissiveMeshSamplingPDFBias; }
+    [[nodiscard]] inline bool IsLightTreeEnabled() const { return m_LightTree; }
+    [[nodiscard]] inline TransmittanceEstimator GetAtmosphereTransmittanceEstimator() const { return m_AtmosphereTransmittanceEstimator; }
+    [[nodiscard]] inline float GetAtmosphereResidualControlFraction() const { return m_AtmosphereResidualControlFraction; }
+    [[nodiscard]] inline bool UseAtmosphereTransmittanceLUT() const { return m_UseAtmosphereTransmittanceLUT; }
+    [[nodiscard]] inline const VolumeGridManager& GetVolumeGridManager() const { return m_VolumeGridManager; }
+    [[nodiscard]] inline Integrator GetIntegrator() const { return m_Integrator; }
+    [[nodiscard]] inline uint32_t GetWavefrontPathPoolSize() const { return m_WavefrontPathPoolSize; }
+    [[nodiscard]] inline bool IsAdaptiveSamplingEnabled() const { return m_AdaptiveSampling; }
+    [[nodiscard]] inline bool AreSampleMomentsTracked() const { return m_AdaptiveSampling && m_Integrator != Integrator::WAVEFRONT; } // Wavefront integrator doesn't update them
+    [[nodiscard]] inline bool AreAOVsEnabled() const { return m_AOVsEnabled; }
+    [[nodiscard]] inline bool IsTemporalReprojectionEnabled() const { return m_TemporalReprojection; }
+    [[nodiscard]] inline bool IsReSTIREnabled() const { return m_ReSTIR; }
+    [[nodiscard]] inline bool IsReSTIRUnbiased() const { return m_ReSTIRUnbiased; }
+    [[nodiscard]] inline uint32_t GetReSTIRCandidateCount() const { return m_ReSTIRCandidateCount; }
+    [[nodiscard]] inline uint32_t GetReSTIRSpatialSampleCount() const { return m_ReSTIRSpatialSampleCount; }
+    [[nodiscard]] inline float GetReSTIRSpatialRadius() const { return m_ReSTIRSpatialRadius; }
+    [[nodiscard]] inline float GetReSTIRHistoryLimit() const { return m_ReSTIRHistoryLimit; }
+    [[nodiscard]] inline bool IsPathGuidingEnabled() const { return m_PathGuiding; }
+    [[nodiscard]] inline uint32_t GetGuidingTrainingFrames() const { return m_GuidingTrainingFrames; }
+    [[nodiscard]] inline float GetGuidingSelectionProbability() const { return m_GuidingSelectionProbability; }
+    [[nodiscard]] inline SamplerType GetSamplerType() const { return m_SamplerType; }
+    [[nodiscard]] inline float GetAdaptiveErrorThreshold() const { return m_AdaptiveErrorThreshold; }
+    [[nodiscard]] inline uint32_t GetAdaptiveMinSamples() const { return m_AdaptiveMinSamples; }
+    [[nodiscard]] inline uint32_t GetActiveTileCount() const { return m_ActiveTileCount; }
+    [[nodiscard]] uint32_t GetConvergenceTileCount() const;
+    [[nodiscard]] inline bool IsAutomaticSchedulingEnabled() const { return m_AutomaticScheduling; }
+    [[nodiscard]] inline float GetTargetDispatchTime() const { return m_TargetDispatchTime; }
+    [[nodiscard]] inline float GetAverageDispatchTime() const { return m_TileScheduler.GetAverageDispatchTime(m_ScreenChunkCount, m_SamplesPerFrame); }
+    [[nodiscard]] inline uint32_t GetPreviewScale() const { return m_PreviewScale; }
+    [[nodiscard]] inline bool IsPreviewActive() const { return m_PreviewActive; }
 
     void SetMaxSamplesAccumulated(uint32_t maxSamples);
     void SetMaxDepth(uint32_t maxDepth, VulkanHelper::CommandBuffer commandBuffer);
@@ -162,10 +295,27 @@ public:
     void SetFurnaceTestMode(bool furnaceTestMode, VulkanHelper::CommandBuffer commandBuffer);
     void SetSkyIntensity(float skyIntensity, VulkanHelper::CommandBuffer commandBuffer);
     void SetUseRayQueries(bool useRayQueries, VulkanHelper::CommandBuffer commandBuffer);
-    void AddDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, VulkanHelper::CommandBuffer commandBuffer);
+    void AddDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer);
     void RemoveDensityDataFromVolume(uint32_t volumeIndex, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Loads every file of a numbered sequence (e.g. fire.0001.vdb, fire.0002.vdb, ...) that the filepath belongs to
+    void AddDensitySequenceToVolume(uint32_t volumeIndex, const std::string& filepath, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer);
+    void SetVolumeSequencePlaying(uint32_t volumeIndex, bool playing);
+
+    // Swaps in the next frame of every playing sequence whose prefetch has already finished, never waits
+    void UpdateVolumeSequences(VulkanHelper::CommandBuffer commandBuffer);
+
+    // Advances every sequence by exactly one frame, waiting for the conversion if it's not done yet. Used for batch rendering,
+    // returns false if the new frame of any sequence failed to load
+    bool StepVolumeSequences(VulkanHelper::CommandBuffer commandBuffer);
+    void RewindVolumeSequences(VulkanHelper::CommandBuffer commandBuffer);
+    [[nodiscard]] uint32_t GetLongestVolumeSequenceLength() const;
     void SetSplitScreenCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer);
     void SetEnableAtmosphere(bool enable, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Atmosphere is baked into the environment map from precomputed LUTs instead of being path traced,
+    // the sky then costs the same as an HDRI. Has an effect only when the atmosphere is enabled
+    void SetApproximateSky(bool enable, VulkanHelper::CommandBuffer commandBuffer);
     void SetPlanetPosition(const glm::vec3& position, VulkanHelper::CommandBuffer commandBuffer);
     void SetPlanetRadius(float radius, VulkanHelper::CommandBuffer commandBuffer);
     void SetAtmosphereHeight(float height, VulkanHelper::CommandBuffer commandBuffer);
@@ -179,26 +329,173 @@ public:
     void SetSunColor(const glm::vec3& color, VulkanHelper::CommandBuffer commandBuffer);
     void SetMeshMIS(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
     void SetEmissiveMeshSamplingPDFBias(float bias, VulkanHelper::CommandBuffer commandBuffer);
-
-    void ResetPathTracing() { m_FrameCount = 0; m_DispatchCount = 0; m_SamplesAccumulated = 0; }
+    void SetLightTree(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+    void SetAtmosphereTransmittanceEstimator(TransmittanceEstimator estimator, VulkanHelper::CommandBuffer commandBuffer);
+    void SetAtmosphereResidualControlFraction(float fraction, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Shadow rays read the atmosphere transmittance from a LUT precomputed after every change of the atmosphere,
+    // instead of estimating it with the transmittance estimator
+    void SetUseAtmosphereTransmittanceLUT(bool useLUT, VulkanHelper::CommandBuffer commandBuffer);
+    void SetVolumeMemoryBudget(uint64_t budget);
+    void SetIntegrator(Integrator integrator, VulkanHelper::CommandBuffer commandBuffer);
+    void SetWavefrontPathPoolSize(uint32_t pathCount, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Stops rendering tiles whose relative error drops below the threshold, rendering is finished once every tile converges.
+    // Not supported by the wavefront integrator
+    void SetAdaptiveSampling(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+    void SetAdaptiveErrorThreshold(float threshold, VulkanHelper::CommandBuffer commandBuffer);
+    void SetAdaptiveMinSamples(uint32_t minSamples, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Picks the split screen count and samples per frame automatically so that a single dispatch takes about the target time
+    void SetAutomaticScheduling(bool enabled);
+    void SetTargetDispatchTime(float milliseconds);
+
+    // Nothing is displayed in throughput mode, so the scheduler uses much bigger dispatches
+    void SetSchedulerThroughputMode(bool enabled);
+
+    // Writes the first hit albedo and normal to the AOV images, they're only needed by the denoiser
+    void SetAOVsEnabled(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+
+    // While settings keep changing (e.g. camera is moving) only every scale-th pixel is rendered with a single sample
+    // and the image is upscaled, full resolution accumulation starts once nothing changes for a moment. 1 disables the preview
+    void SetPreviewScale(uint32_t scale);
+
+    // Camera changes reproject the accumulated image into the new view instead of discarding it. Pixels whose first hit
+    // is still visible keep their samples, disoccluded ones start from scratch. Not supported by the wavefront integrator
+    void SetTemporalReprojection(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+
+    // Direct light of the primary hits is picked from reservoirs of light samples that are reused between the neighbouring
+    // pixels and frames. Biased mode converges faster, unbiased mode doesn't darken the edges and is meant for final frames
+    void SetReSTIR(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+    void SetReSTIRUnbiased(bool unbiased, VulkanHelper::CommandBuffer commandBuffer);
+    void SetReSTIRCandidateCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer);
+    void SetReSTIRSpatialSampleCount(uint32_t count, VulkanHelper::CommandBuffer commandBuffer);
+    void SetReSTIRSpatialRadius(float radius, VulkanHelper::CommandBuffer commandBuffer); // In pixels
+    void SetReSTIRHistoryLimit(float limit, VulkanHelper::CommandBuffer commandBuffer); // In multiples of the candidate count
+
+    // Indirect bounces of diffuse and glossy surfaces are sampled either from the BSDF or from a guide of the incoming radiance,
+    // which is learned from the paths of the first training frames after every reset. Only the megakernel integrator uses it
+    void SetPathGuiding(bool enabled, VulkanHelper::CommandBuffer commandBuffer);
+    void SetGuidingTrainingFrames(uint32_t frames);
+    void SetGuidingSelectionProbability(float probability, VulkanHelper::CommandBuffer commandBuffer); // Probability of sampling the guide instead of the BSDF
+
+    void SetSamplerType(SamplerType type, VulkanHelper::CommandBuffer commandBuffer);
+
+    void ResetPathTracing()
+    {
+        m_FrameCount = 0;
+        m_DispatchCount = 0;
+        m_ChunkIndex = 0;
+        m_SamplesAccumulated = 0;
+        m_ResetCount++;
+        m_ActiveTileCount = GetConvergenceTileCount();
+        m_ConvergenceReadbackPending = false;
+        m_LastResetTime = std::chrono::high_resolution_clock::now();
+        m_ReprojectionPending = false;
+        m_GuidingResetPending = true;
+    }
 
 private:
+    // Has to match the alias map in Bindings.slang
+    struct AliasMapEntry
+    {
+        uint32_t Alias; // Alias pointing to another texel
+        float Importance; // Importance of the current texel
+    };
+
+    void InitializeShaderSession();
     void CreateOutputImageView();
+    void CreateAdaptiveSamplingBuffers();
+    void ClearConvergenceMask();
+    void CreateConvergencePipeline();
+    void UpdateConvergenceMask(VulkanHelper::CommandBuffer& commandBuffer, uint32_t chunkIndex);
+    void UpdateSchedule(VulkanHelper::CommandBuffer& commandBuffer);
+    void ReadDispatchTimestamps();
+    void SetPreviewActive(bool active, VulkanHelper::CommandBuffer& commandBuffer);
+    void CreateReprojectionBuffers();
+    void CreateReprojectionPipeline();
+    void AddReprojectionBuffersToDescriptorSet();
+    void ResetPathTracingForCameraChange(VulkanHelper::CommandBuffer& commandBuffer);
+    void StoreReprojectionHistory(VulkanHelper::CommandBuffer& commandBuffer);
+    void ReprojectHistory(VulkanHelper::CommandBuffer& commandBuffer);
+    void CreateReservoirBuffers();
+    void AddReservoirBuffersToDescriptorSet();
+    void BuildEmissiveTriangleTable(VulkanHelper::CommandBuffer& commandBuffer);
+    void AddEmissiveTrianglesToDescriptorSet();
+    void CreateGuidingBuffers();
+    void AddGuidingBuffersToDescriptorSet();
+    void CreateGuidingPipeline(VulkanHelper::CommandBuffer& commandBuffer);
+    void UpdateGuiding(VulkanHelper::CommandBuffer& commandBuffer, bool clear);
+    void CreateAtmosphereTransmittancePipeline();
+    void UpdateAtmosphereTransmittanceLUT(VulkanHelper::CommandBuffer& commandBuffer);
+    [[nodiscard]] inline uint32_t GetActiveChunkCount() const { return m_PreviewActive ? m_PreviewScale : m_ScreenChunkCount; }
+    [[nodiscard]] inline uint32_t GetActiveSamplesPerFrame() const { return m_PreviewActive ? 1 : m_SamplesPerFrame; }
+
+    // Preview dispatches never accumulate, so they walk through the sequence by the dispatch count instead
+    [[nodiscard]] inline uint32_t GetFirstSampleIndex() const { return m_PreviewActive ? (uint32_t)m_DispatchCount : m_SamplesAccumulated; }
+    [[nodiscard]] uint32_t GetAdaptiveMinFrames() const;
     void LoadEnvironmentMap(const std::string& filePath, VulkanHelper::CommandBuffer commandBuffer);
+    void UploadEnvironmentMap(const float* pixels, const std::vector<AliasMapEntry>& aliasMap, uint32_t width, uint32_t height, VulkanHelper::CommandBuffer commandBuffer);
+    void AddEnvironmentMapToDescriptorSet();
+    void UpdateApproximateSky(VulkanHelper::CommandBuffer commandBuffer);
+    void StartApproximateSkyBake();
+
+    [[nodiscard]] static std::vector<AliasMapEntry> CreateEnvironmentMapAliasMap(float* pixels, uint32_t width, uint32_t height); // Alpha of the pixels is overwritten with the PDF
     VulkanHelper::ImageView LoadTexture(const std::string& filePath, bool onlySingleChannel, VulkanHelper::CommandBuffer commandBuffer);
     VulkanHelper::ImageView LoadLookupTable(const char* filepath, glm::uvec3 tableSize, VulkanHelper::CommandBuffer& commandBuffer);
     VulkanHelper::ImageView LoadDefaultTexture(VulkanHelper::CommandBuffer commandBuffer, bool normal, bool onlySingleChannel);
 
+    [[nodiscard]] static std::shared_ptr<VolumeGridData> LoadVolumeGridData(const std::string& filepath, const VolumeImportSettings& importSettings);
+    [[nodiscard]] static std::vector<std::string> FindVolumeSequenceFrames(const std::string& filepath);
+    void UploadVolumeGridData(Volume& volume, const VolumeGridData& gridData, int densityDataIndex, VulkanHelper::CommandBuffer commandBuffer);
+    void AssignResidentVolumeGrid(Volume& volume, int densityDataIndex);
+    void AcquireVolumeGrids(const Volume& volume);
+    void ReleaseVolumeGrids(const Volume& volume);
+    void AddStreamedDensityDataToVolume(uint32_t volumeIndex, const std::string& filepath, const std::string& key, const VolumeImportSettings& importSettings, VulkanHelper::CommandBuffer commandBuffer);
+    void UpdateVolumeBrickStreaming(VulkanHelper::CommandBuffer commandBuffer);
+    void CreateWavefrontResources();
+    void CreateWavefrontPipelines(VulkanHelper::CommandBuffer& commandBuffer);
+    void PathTraceWavefront(VulkanHelper::CommandBuffer& commandBuffer, uint32_t frameCount, uint32_t seed, uint32_t chunkIndex);
+    void WavefrontBarrier(VulkanHelper::CommandBuffer& commandBuffer);
+    void CreateInlineRayQueryPipeline();
+    void PathTraceInlineRayQuery(VulkanHelper::CommandBuffer& commandBuffer, uint32_t frameCount, uint32_t seed, uint32_t chunkIndex);
+    void PrefetchVolumeSequenceFrame(VolumeSequence& sequence, uint32_t frame);
+    bool SwapVolumeSequenceFrame(uint32_t volumeIndex, bool waitForPrefetch, VulkanHelper::CommandBuffer commandBuffer);
+
     constexpr static uint32_t MAX_EMISSIVE_MESHES = 10000;
     constexpr static uint32_t MAX_ENTITIES = 10000;
     constexpr static uint32_t MAX_INSTANCES = 100000;
     constexpr static uint32_t MAX_HETEROGENEOUS_VOLUMES = 100;
+    constexpr static uint64_t DEFAULT_VOLUME_MEMORY_BUDGET = 4ull * 1024 * 1024 * 1024;
+    constexpr static uint32_t WAVEFRONT_WORKGROUP_SIZE = 64;
+    constexpr static uint32_t DEFAULT_WAVEFRONT_PATH_POOL_SIZE = 512 * 1024; // ~140 MB of path state and queues
+    constexpr static uint32_t CONVERGENCE_TILE_SIZE = 16; // Has to match AdaptiveSampling.slang
+    constexpr static uint32_t CONVERGENCE_UPDATE_INTERVAL = 8; // In frames
+    constexpr static float THROUGHPUT_DISPATCH_TIME = 250.0f; // In milliseconds, still far from the ~2 s after which drivers reset the device
+    constexpr static float PREVIEW_SETTLE_TIME = 200.0f; // In milliseconds without any reset after which the preview switches to full resolution
+    constexpr static uint32_t MAX_RESTIR_SPATIAL_SAMPLES = 8; // Has to match ReSTIR.slang
+    constexpr static uint32_t GUIDING_GRID_RESOLUTION = 32; // Has to match Guiding.slang
+    constexpr static uint32_t GUIDING_BIN_COUNT = 64; // Has to match Guiding.slang
+    constexpr static uint32_t ATMOSPHERE_TRANSMITTANCE_LUT_WIDTH = 256; // Has to match Atmosphere.slang
+    constexpr static uint32_t ATMOSPHERE_TRANSMITTANCE_LUT_HEIGHT = 64; // Has to match Atmosphere.slang
+    constexpr static uint32_t APPROXIMATE_SKY_WIDTH = 1024;
+    constexpr static uint32_t APPROXIMATE_SKY_HEIGHT = 512;
+    constexpr static float SUN_ANGULAR_RADIUS = 0.004675f; // Has to match Sampler.slang
+
+    // Sea level coefficients of the earth atmosphere for red, green and blue, in 1/m. Passed to the shaders through the
+    // uniform buffer and to the sky baker, both scale them by the multipliers
+    inline static const glm::vec3 RAYLEIGH_SCATTERING_COEFFICIENT = glm::vec3(5.802f, 13.558f, 33.100f) * 1e-6f;
+    inline static const glm::vec3 MIE_SCATTERING_COEFFICIENT = glm::vec3(3.996f) * 1e-6f;
+    inline static const glm::vec3 MIE_ABSORPTION_COEFFICIENT = glm::vec3(4.40f) * 1e-6f;
+    inline static const glm::vec3 OZONE_ABSORPTION_COEFFICIENT = glm::vec3(0.650f, 1.881f, 0.085f) * 1e-6f;
 
     glm::mat4 m_CameraViewInverse = glm::mat4(1.0f);
     glm::mat4 m_CameraProjectionInverse = glm::mat4(1.0f);
     uint64_t m_DispatchCount = 0;
+    uint32_t m_ChunkIndex = 0; // Chunk of the screen rendered by the next dispatch, frame is finished once all chunks are rendered
     uint32_t m_FrameCount = 0;
     uint32_t m_SamplesAccumulated = 0;
+    uint32_t m_ResetCount = 0; // Incremented every time the accumulation starts from scratch
     uint32_t m_SamplesPerFrame = 1;
     uint32_t m_MaxSamplesAccumulated = 5000;
     uint32_t m_MaxDepth = 200;
@@ -210,6 +507,7 @@ private:
     float m_SkyRotationAltitude = 0.0f;
     bool m_EnableEnvMapMIS = true;
     bool m_EnableMeshMIS = true;
+    bool m_LightTree = true;
     bool m_ShowEnvMapDirectly = true;
     bool m_UseOnlyGeometryNormals = false;
     bool m_UseEnergyCompensation = true;
@@ -219,6 +517,9 @@ private:
     PhaseFunction m_PhaseFunction = PhaseFunction::HENYEY_GREENSTEIN;
     uint32_t m_ScreenChunkCount = 1;
     bool m_EnableAtmosphere = false;
+    bool m_ApproximateSky = false;
+    bool m_ApproximateSkyBaked = false; // Environment map currently holds the baked sky instead of the file
+    bool m_ApproximateSkyPending = false; // Sky is rebaked once the current bake, if any, is done
     glm::vec3 m_PlanetPosition = glm::vec3(0.0f, 6360e3f + 1000.0f, 0.0f); // In meters
     float m_PlanetRadius = 6360e3f; // In meters
     float m_AtmosphereHeight = 100e3f; // In meters
@@ -231,6 +532,52 @@ private:
     float m_OzoneDensityFalloff = 5000.0f; // In meters
     float m_OzonePeak = 22000.0f; // In meters
     float m_EmissiveMeshSamplingPDFBias = 0.0f;
+    TransmittanceEstimator m_AtmosphereTransmittanceEstimator = TransmittanceEstimator::DELTA_TRACKING;
+    float m_AtmosphereResidualControlFraction = 0.5f;
+    bool m_UseAtmosphereTransmittanceLUT = true;
+    bool m_AtmosphereTransmittanceLUTPending = true; // LUT is recomputed before the next dispatch
+    Integrator m_Integrator = Integrator::MEGAKERNEL;
+    uint32_t m_WavefrontPathPoolSize = DEFAULT_WAVEFRONT_PATH_POOL_SIZE;
+    bool m_AdaptiveSampling = false;
+    float m_AdaptiveErrorThreshold = 0.01f;
+    uint32_t m_AdaptiveMinSamples = 64;
+    uint32_t m_ActiveTileCount = 0;
+    uint32_t m_ConvergenceGeneration = 0; // Written by the GPU after the mask, the mask can be read once it's there
+    bool m_ConvergenceReadbackPending = false;
+    bool m_AutomaticScheduling = false;
+    bool m_SchedulerThroughputMode = false;
+    float m_TargetDispatchTime = 16.0f; // In milliseconds
+    TileScheduler m_TileScheduler;
+
+    // GPU time of the dispatches is read back a few frames later, every slot holds the begin and end timestamp of one of them
+    struct DispatchTiming
+    {
+        bool Pending = false;
+        uint32_t ChunkCount = 1;
+        uint32_t SamplesPerFrame = 1;
+    };
+    VulkanHelper::QueryPool m_DispatchTimestamps;
+    std::array<DispatchTiming, 8> m_DispatchTimings;
+    uint32_t m_DispatchTimingSlot = 0;
+    uint32_t m_PreviewScale = 1;
+    bool m_PreviewActive = false;
+    std::chrono::high_resolution_clock::time_point m_LastResetTime;
+    bool m_AOVsEnabled = false;
+    bool m_TemporalReprojection = false;
+    bool m_ReprojectionPending = false; // History is merged once the first frame from the new view is finished
+    bool m_ReSTIR = false;
+    bool m_ReSTIRUnbiased = false;
+    uint32_t m_ReSTIRCandidateCount = 8;
+    uint32_t m_ReSTIRSpatialSampleCount = 4;
+    float m_ReSTIRSpatialRadius = 16.0f;
+    float m_ReSTIRHistoryLimit = 20.0f;
+    bool m_PathGuiding = false;
+    uint32_t m_GuidingTrainingFrames = 32;
+    float m_GuidingSelectionProbability = 0.5f;
+    bool m_GuidingResetPending = true; // Guide is cleared before the first dispatch after a reset
+    glm::vec3 m_SceneBoundsMin = glm::vec3(0.0f);
+    glm::vec3 m_SceneBoundsMax = glm::vec3(0.0f);
+    SamplerType m_SamplerType = SamplerType::PCG;
 
     uint64_t m_TotalVertexCount = 0;
     uint64_t m_TotalIndexCount = 0;
@@ -238,12 +585,34 @@ private:
     VulkanHelper::Device m_Device;
 
     VulkanHelper::ImageView m_OutputImageView;
-    uint32_t m_Width;
-    uint32_t m_Height;
+    VulkanHelper::ImageView m_AlbedoImageView;
+    VulkanHelper::ImageView m_NormalImageView;
+    uint32_t m_Width = 0;
+    uint32_t m_Height = 0;
 
     VulkanHelper::ImageView m_EnvMapTexture;
     VulkanHelper::Buffer m_EnvAliasMap;
 
+    // Approximate sky is baked on the thread pool from the transmittance LUT read back a few frames earlier, only one bake
+    // runs at a time and the environment map is swapped once it's done
+    enum class SkyBakeState
+    {
+        IDLE,
+        READBACK,
+        BAKING
+    };
+    struct SkyBakeJob
+    {
+        std::vector<float> Pixels;
+        std::vector<AliasMapEntry> AliasMap;
+    };
+    constexpr static uint32_t SKY_BAKE_READBACK_DELAY = 4; // In frames, so that the copy is read after the GPU is done with it
+    VulkanHelper::Buffer m_SkyBakeReadbackBuffer;
+    SkyBakeState m_SkyBakeState = SkyBakeState::IDLE;
+    uint32_t m_SkyBakeReadbackFrames = 0; // Left until the readback buffer can be read
+    std::shared_ptr<SkyBakeJob> m_SkyBakeJob;
+    std::future<void> m_SkyBakeTask;
+
     std::vector<VulkanHelper::ImageView> m_SceneTextures;
     std::unordered_map<uint64_t, uint64_t> m_SceneTexturePathToIndex;
     std::vector<VulkanHelper::Mesh> m_SceneMeshes;
@@ -252,6 +621,10 @@ private:
     struct MeshInfoEntry
     {
         uint32_t TriangleCount;
+
+        // Object space triangles kept on the CPU, the light sampling structures need them whenever a mesh starts emitting
+        std::vector<glm::vec3> Positions;
+        std::vector<uint32_t> Indices;
     };
     std::vector<MeshInfoEntry> m_SceneMeshInfo;
 
@@ -265,6 +638,33 @@ private:
 
     VulkanHelper::Pipeline m_PathTracerPipeline;
 
+    // Adaptive sampling
+    VulkanHelper::Buffer m_SampleMomentsBuffer;
+    VulkanHelper::Buffer m_ConvergenceMaskBuffer; // Cpu mapable so that converged tiles can be counted, ends with a group counter and the generation
+    VulkanHelper::PushConstant m_ConvergencePushConstant;
+    VulkanHelper::Pipeline m_ConvergencePipeline;
+
+    // Temporal reprojection, history buffers hold the color, albedo and normal images and the sample moments
+    std::array<VulkanHelper::Buffer, 3> m_ReprojectionHistoryBuffers;
+    VulkanHelper::Buffer m_ReprojectionHistoryMomentsBuffer;
+    VulkanHelper::Pipeline m_ReprojectionPipeline;
+    bool m_ReprojectionPipelineCreated = false; // Camera changes reset the accumulation if the shader fails to compile
+
+    // Reservoirs of the primary hits, frames alternate between the two buffers
+    std::array<VulkanHelper::Buffer, 2> m_ReservoirBuffers;
+
+    // Path guiding, fixed point training splats, merged radiance histograms and their CDFs for every cell of the grid
+    VulkanHelper::Buffer m_GuidingTrainingBuffer;
+    VulkanHelper::Buffer m_GuidingRadianceBuffer;
+    VulkanHelper::Buffer m_GuidingDistributionBuffer;
+    VulkanHelper::PushConstant m_GuidingPushConstant;
+    VulkanHelper::Pipeline m_GuidingPipeline;
+
+    // Transmittance from every altitude and zenith angle to the top of the atmosphere
+    VulkanHelper::ImageView m_AtmosphereTransmittanceLUT;
+    VulkanHelper::Pipeline m_AtmosphereTransmittancePipeline;
+    bool m_AtmosphereTransmittancePipelineCreated = false; // LUT isn't written if the shader fails to compile
+
     VulkanHelper::DescriptorPool m_DescriptorPool;
     VulkanHelper::DescriptorSet m_PathTracerDescriptorSet;
 
@@ -273,12 +673,27 @@ private:
         glm::mat4 CameraViewInverse;
         glm::mat4 CameraProjectionInverse;
 
+        // Camera that the temporal reprojection history was rendered from
+        glm::mat4 PreviousViewProjection;
+        glm::vec4 PreviousCameraPosition;
+
         // Atmosphere parameters float4 to ensure alignment
         glm::vec4 PlanetPosition;
         glm::vec4 RayleighScatteringCoefficientMultiplier;
         glm::vec4 MieScatteringCoefficientMultiplier;
         glm::vec4 OzoneAbsorptionCoefficientMultiplier;
         glm::vec4 SunColor;
+
+        // Sea level coefficients of the atmosphere, scaled by the multipliers above
+        glm::vec4 RayleighScatteringCoefficient;
+        glm::vec4 MieScatteringCoefficient;
+        glm::vec4 MieAbsorptionCoefficient;
+        glm::vec4 OzoneAbsorptionCoefficient;
+
+        // Bounds of the path guiding grid
+        glm::vec4 GuidingBoundsMin;
+        glm::vec4 GuidingBoundsMax;
+
         float PlanetRadius;
         float AtmosphereHeight;
         float RayleighDensityFalloff;
@@ -299,6 +714,29 @@ private:
         uint32_t EmissiveMeshCount;
         uint32_t TotalEmissiveTriangleCount;
         float EmissiveMeshSamplingPDFBias;
+        uint32_t AtmosphereTransmittanceEstimator;
+        float AtmosphereResidualControlFraction;
+        uint32_t AdaptiveMinSamples;
+        float AdaptiveErrorThreshold;
+        uint32_t ReSTIRCandidateCount;
+        uint32_t ReSTIRSpatialSampleCount;
+        float ReSTIRSpatialRadius;
+        float ReSTIRHistoryLimit;
+        float GuidingSelectionProbability;
+    };
+
+    // Has to match Reservoir in Bindings.slang, scalar layout
+    struct Reservoir
+    {
+        glm::vec3 LightPosition;
+        uint32_t LightNormal;
+        glm::vec3 LightRadiance;
+        uint32_t LightMesh;
+        uint32_t LightTriangle;
+        float W;
+        float M;
+        uint32_t SurfaceNormal;
+        glm::vec3 SurfacePosition;
     };
 
     struct PushConstantData
@@ -306,10 +744,95 @@ private:
         uint32_t FrameCount;
         uint32_t Seed;
         uint32_t ChunkIndex;
+        uint32_t SampleIndex; // Index of the first sample of the dispatch, selects the points of the Sobol sampler
+
+        // Only used by the wavefront integrator
+        uint32_t PathOffset;
+        uint32_t PathCount;
+        uint32_t Bounce;
+
+        // Only used by the megakernel and the guiding update
+        uint32_t GuidingTraining; // 1 while the paths splat their radiance into the guide
+        uint32_t GuidingClear; // 1 if the update clears the guide instead of merging the splats
+
+        // Only used by the convergence pass
+        uint32_t ConvergenceGeneration;
     };
     VulkanHelper::Buffer m_PathTracerUniformBuffer;
     VulkanHelper::PushConstant m_PathTracerPushConstant;
 
+    // Wavefront integrator, layouts have to match the structs in RTCommon.slang, Integrator.slang and Wavefront/WavefrontCommon.slang
+    struct WavefrontPathState
+    {
+        glm::vec3 Origin;
+        uint32_t PixelIndex;
+        glm::vec3 Direction;
+        uint32_t Depth;
+        glm::vec3 Throughput;
+        float PDF;
+        glm::vec3 Radiance;
+        uint32_t VolumeDepth;
+        glm::vec3 BxDF;
+        glm::vec3 Emitted;
+        uint32_t InMedium;
+        glm::vec3 MediumColor;
+        float MediumDensity;
+        float MediumAnisotropy;
+        uint32_t SamplerSeed;
+        uint32_t SamplerPixel;
+        uint32_t SamplerSampleIndex;
+        uint32_t SamplerDimension;
+        uint32_t SamplerDimensionEnd;
+        glm::vec3 FirstHitAlbedo;
+        glm::vec3 FirstHitNormal;
+        float FirstHitDistance;
+        uint32_t DirectLightResampled;
+        uint32_t Guidable;
+    };
+
+    struct WavefrontHitInfo
+    {
+        glm::vec2 Barycentrics;
+        uint32_t InstanceIndex;
+        uint32_t PrimitiveIndex;
+        float Distance;
+        int VolumeIndex;
+        int AtmosphereComponent;
+    };
+
+    struct WavefrontShadowRay
+    {
+        glm::vec3 Origin;
+        uint32_t TargetTriangle;
+        glm::vec3 Direction;
+        uint32_t TargetInstance;
+        glm::vec3 Contribution;
+        uint32_t TransmittanceDepth;
+    };
+
+    struct WavefrontQueueCounters
+    {
+        uint32_t Extend;
+        uint32_t Surface;
+        uint32_t Volume;
+        uint32_t Connect;
+    };
+
+    // Buffers in the order of their bindings: paths, hits, shadow rays, extend queues, surface queue, volume queue, connect queue, queue counters
+    std::array<VulkanHelper::Buffer, 8> m_WavefrontBuffers;
+    VulkanHelper::DescriptorSet m_WavefrontDescriptorSet;
+    VulkanHelper::PushConstant m_WavefrontPushConstant;
+    VulkanHelper::Pipeline m_WavefrontGeneratePipeline;
+    VulkanHelper::Pipeline m_WavefrontExtendPipeline;
+    VulkanHelper::Pipeline m_WavefrontShadeSurfacePipeline;
+    VulkanHelper::Pipeline m_WavefrontShadeVolumePipeline;
+    VulkanHelper::Pipeline m_WavefrontConnectPipeline;
+    VulkanHelper::Pipeline m_WavefrontAccumulatePipeline;
+    bool m_WavefrontResourcesCreated = false;
+
+    VulkanHelper::PushConstant m_InlineRayQueryPushConstant;
+    VulkanHelper::Pipeline m_InlineRayQueryPipeline;
+
     void UploadDataToBuffer(VulkanHelper::Buffer buffer, void* data, uint64_t size, uint64_t offset, VulkanHelper::CommandBuffer& commandBuffer, bool deleteStageAfterUpload = false);
     void DownloadDataFromBuffer(VulkanHelper::Buffer buffer, void* data, uint64_t size, uint64_t offset, VulkanHelper::CommandBuffer& commandBuffer);
 
@@ -318,6 +841,14 @@ private:
     VulkanHelper::Buffer m_MaterialsBuffer;
     VulkanHelper::Buffer m_MaterialAndMeshIndicesBuffer;
 
+    // Needed to reconstruct hits outside of the hit shaders
+    struct InstanceTransform
+    {
+        glm::mat4 ObjectToWorld;
+        glm::mat4 WorldToObject;
+    };
+    VulkanHelper::Buffer m_InstanceTransformsBuffer;
+
     struct EmissiveMeshEntry
     {
         uint32_t MeshIndex;
@@ -329,6 +860,54 @@ private:
     std::vector<EmissiveMeshEntry> m_EmissiveMeshes;
     VulkanHelper::Buffer m_EmissiveMeshesBuffer;
 
+    // Alias map over all emissive triangles, weighted by their area and emitted power.
+    // Triangles of every emissive mesh are stored next to each other in the order of m_EmissiveMeshes
+    struct EmissiveTriangleEntry
+    {
+        uint32_t Alias;
+        float Importance;
+        uint32_t EmissiveMeshIndex;
+        uint32_t TriangleIndex;
+        float PDF; // With respect to the area, the same for the whole triangle
+        float Area; // World space
+        uint32_t LightTreeLeaf; // UINT32_MAX if the triangle doesn't emit any power
+    };
+    VulkanHelper::Buffer m_EmissiveTrianglesBuffer;
+    VulkanHelper::Buffer m_InstanceEmissiveOffsetsBuffer; // First entry of every instance in the table, UINT32_MAX if it doesn't emit
+
+    // Bounding volume and orientation cone of a group of emissive triangles. Triangles emit on both sides over the whole hemisphere
+    struct LightBounds
+    {
+        glm::vec3 BoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 BoundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        glm::vec3 Axis = glm::vec3(0.0f, 0.0f, 1.0f);
+        float CosThetaO = 1.0f; // Cosine of the largest angle between the axis and the normals
+        float Power = 0.0f;
+    };
+
+    // Light tree over the emissive triangles, traversed stochastically by the shaders so that lights close
+    // to the shading point are picked more often. First child of every internal node is right after it
+    struct LightTreeNode
+    {
+        glm::vec3 BoundsMin;
+        float Power;
+        glm::vec3 BoundsMax;
+        float CosThetaO;
+        glm::vec3 Axis;
+        uint32_t ChildOrTriangle; // Second child for internal nodes, entry in the triangle table for leaves
+        uint32_t Parent; // UINT32_MAX for the root
+        uint32_t IsLeaf;
+    };
+    VulkanHelper::Buffer m_LightTreeBuffer;
+
+    // Trees of the triangles of every emissive instance, built with unit emission and cached so that toggling the emission
+    // of a material only rebuilds the top of the tree. Leaves point to triangles of the mesh and indices are relative to the instance tree
+    std::unordered_map<uint32_t, std::vector<LightTreeNode>> m_InstanceLightTrees;
+
+    static LightBounds UnionLightBounds(const LightBounds& a, const LightBounds& b);
+    static void BuildLightTree(std::vector<std::pair<LightBounds, uint32_t>>& items, uint32_t start, uint32_t end, uint32_t parent, std::vector<LightTreeNode>& nodes);
+    const std::vector<LightTreeNode>& GetInstanceLightTree(const EmissiveMeshEntry& emissiveMesh);
+
     std::vector<VulkanHelper::MeshInstance> m_SceneMeshInstances;
     uint32_t m_EmissiveTriangleCount = 0;
 
@@ -369,6 +948,12 @@ private:
 
         float GridSharpness = 1.0f;
 
+        int Estimator = 0;
+        float ResidualControlFraction = 0.5f;
+
+        int Bricked = 0;
+        glm::ivec3 VoxelCount = glm::ivec3(0); // Only used by bricked volumes
+
         VolumeGPU() = default;
 
         VolumeGPU(const Volume& volume)
@@ -392,13 +977,37 @@ private:
             , ApproximatedScatteringForClouds(volume.ApproximatedScatteringForClouds)
             , ApproximatedScatteringFalloff(volume.ApproximatedScatteringFalloff)
             , GridSharpness(volume.GridSharpness)
+            , Estimator((int)volume.Estimator)
+            , ResidualControlFraction(volume.ResidualControlFraction)
         {
             CornerMin = volume.Position + (volume.CornerMin * volume.Scale);
             CornerMax = volume.Position + (volume.CornerMax * volume.Scale);
             HasTemperatureData = volume.VolumeNanoBufferTemperature != nullptr;
+
+            if (volume.BrickStreamer != nullptr)
+            {
+                Bricked = 1;
+                VoxelCount = glm::ivec3(volume.BrickStreamer->GetHeader().VoxelCount);
+            }
         }
     };
 
     std::vector<Volume> m_Volumes;
     VulkanHelper::Buffer m_VolumesBuffer;
+
+    // Binary BVH over world space volume AABBs so rays only visit volumes they overlap. Every leaf holds exactly one volume
+    struct VolumeBVHNode
+    {
+        glm::vec3 CornerMin;
+        int LeftChild; // -1 for leaves, right child is always LeftChild + 1
+        glm::vec3 CornerMax;
+        int VolumeIndex; // -1 for inner nodes
+    };
+    std::vector<VolumeBVHNode> m_VolumeBVHNodes;
+    VulkanHelper::Buffer m_VolumeBVHBuffer;
+    void RebuildVolumeBVH(VulkanHelper::CommandBuffer commandBuffer);
+
+    // Owns descriptor slots of bindings 15, 16 and 17. Every volume with density data holds
+    // a reference to its slot, sequences hold references to both of their slots
+    VolumeGridManager m_VolumeGridManager;
 };
\ No newline at end of file
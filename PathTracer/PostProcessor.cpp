@@ -2,10 +2,14 @@
 
 #include <array>
 
-PostProcessor PostProcessor::New(VulkanHelper::Device device)
+PostProcessor PostProcessor::New(VulkanHelper::Device device, VulkanHelper::ThreadPool* threadPool)
 {
     PostProcessor postProcessor;
     postProcessor.m_Device = device;
+    postProcessor.m_Denoiser = Denoiser::New(device, threadPool);
+
+    // Other working formats are required to support storage images
+    postProcessor.m_PackedFormatSupported = device.IsStorageImageFormatSupported(VulkanHelper::Format::B10G11R11_UFLOAT_PACK32);
 
     std::array<VulkanHelper::DescriptorPool::PoolSize, 7> poolSizes = {
         VulkanHelper::DescriptorPool::PoolSize{VulkanHelper::DescriptorType::SAMPLER, 100000},
@@ -37,6 +41,7 @@ PostProcessor PostProcessor::New(VulkanHelper::Device device)
 
         postProcessor.m_TonemappingDescriptorSet = postProcessor.m_DescriptorPool.AllocateDescriptorSet({bindingDescriptions.data(), static_cast<uint32_t>(bindingDescriptions.size())}).Value();
 
+        InitializeShaderSession(postProcessor.m_WorkingFormat);
         VulkanHelper::Shader shader = VulkanHelper::Shader::New({
             device,
             "PostProcess/Tonemap.slang",
@@ -70,35 +75,26 @@ PostProcessor PostProcessor::New(VulkanHelper::Device device)
 
     // Bloom
     {
-        postProcessor.m_BloomSampler = VulkanHelper::Sampler::New({
-            device,
-            VulkanHelper::Sampler::AddressMode::CLAMP_TO_EDGE,
-            VulkanHelper::Sampler::Filter::LINEAR
-        }).Value();
-
         std::array<VulkanHelper::DescriptorSet::BindingDescription, 3> bindingDescriptions = {
-            VulkanHelper::DescriptorSet::BindingDescription{0, 1, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::STORAGE_IMAGE},
-            VulkanHelper::DescriptorSet::BindingDescription{1, 1, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::STORAGE_IMAGE},
-            VulkanHelper::DescriptorSet::BindingDescription{2, 1, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::SAMPLER}
+            VulkanHelper::DescriptorSet::BindingDescription{0, 1, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::SAMPLED_IMAGE}, // Chain input
+            VulkanHelper::DescriptorSet::BindingDescription{1, MAX_BLOOM_LEVELS, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::STORAGE_IMAGE}, // Mips
+            VulkanHelper::DescriptorSet::BindingDescription{2, 1, VulkanHelper::ShaderStages::COMPUTE_BIT, VulkanHelper::DescriptorType::STORAGE_BUFFER} // Group counter
         };
 
-        for (uint32_t i = 0; i < MAX_BLOOM_LEVELS; i++)
-        {
-            postProcessor.m_BloomDescriptorSets.push_back(postProcessor.m_DescriptorPool.AllocateDescriptorSet({ bindingDescriptions.data(), static_cast<uint32_t>(bindingDescriptions.size()) }).Value());
-            VH_ASSERT(postProcessor.m_BloomDescriptorSets[i].AddSampler(2, 0, &postProcessor.m_BloomSampler) == VulkanHelper::VHResult::OK, "Failed to add bloom sampler to descriptor set");
-        }
+        postProcessor.m_BloomDescriptorSet = postProcessor.m_DescriptorPool.AllocateDescriptorSet({ bindingDescriptions.data(), static_cast<uint32_t>(bindingDescriptions.size()) }).Value();
 
-        VulkanHelper::Shader downSampleShader = VulkanHelper::Shader::New({
-            device,
-            "PostProcess/BloomDownSample.slang",
-            VulkanHelper::ShaderStages::COMPUTE_BIT
-        }).Value();
+        VulkanHelper::Buffer::Config bufferConfig;
+        bufferConfig.Device = device;
+        bufferConfig.Size = sizeof(uint32_t);
+        bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+        bufferConfig.CpuMapable = true;
+        bufferConfig.DebugName = "BloomGroupCounterBuffer";
 
-        VulkanHelper::Shader upSampleShader = VulkanHelper::Shader::New({
-            device,
-            "PostProcess/BloomUpSample.slang",
-            VulkanHelper::ShaderStages::COMPUTE_BIT
-        }).Value();
+        postProcessor.m_BloomGroupCounterBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+        const uint32_t groupCounter = 0;
+        VH_ASSERT(postProcessor.m_BloomGroupCounterBuffer.UploadData(&groupCounter, sizeof(groupCounter), 0) == VulkanHelper::VHResult::OK, "Failed to clear bloom group counter");
+        VH_ASSERT(postProcessor.m_BloomDescriptorSet.AddBuffer(2, 0, &postProcessor.m_BloomGroupCounterBuffer) == VulkanHelper::VHResult::OK, "Failed to add bloom group counter to descriptor set");
 
         postProcessor.m_BloomPushConstant = VulkanHelper::PushConstant::New({
             VulkanHelper::ShaderStages::COMPUTE_BIT,
@@ -106,70 +102,18 @@ PostProcessor PostProcessor::New(VulkanHelper::Device device)
             sizeof(BloomPushData)
         }).Value();
 
-        VulkanHelper::Pipeline::ComputeConfig pipelineConfig;
-        pipelineConfig.Device = device;
-        pipelineConfig.PushConstant = &postProcessor.m_BloomPushConstant;
-        
-        for (uint32_t i = 0; i < MAX_BLOOM_LEVELS; i++)
-        {
-            pipelineConfig.DescriptorSets = { postProcessor.m_BloomDescriptorSets[i] };
-
-            pipelineConfig.ComputeShader = downSampleShader;
-            postProcessor.m_BloomDownSamplePipelines.push_back(VulkanHelper::Pipeline::New(pipelineConfig).Value());
-
-            pipelineConfig.ComputeShader = upSampleShader;
-            postProcessor.m_BloomUpSamplePipelines.push_back(VulkanHelper::Pipeline::New(pipelineConfig).Value());
-        }
+        postProcessor.CreateBloomPipelines(postProcessor.m_WorkingFormat);
     }
 
     return postProcessor;
 }
 
-void PostProcessor::SetInputImage(VulkanHelper::ImageView inputImageView)
+void PostProcessor::SetInputImage(VulkanHelper::ImageView inputImageView, VulkanHelper::ImageView albedoImageView, VulkanHelper::ImageView normalImageView)
 {
     m_InputImageView = inputImageView;
+    m_Denoiser.SetImages(inputImageView, albedoImageView, normalImageView);
 
-    // Bloom
-    {
-        glm::uvec2 currentSize = { m_InputImageView.GetWidth(), m_InputImageView.GetHeight() };
-        m_BloomViews.clear();
-        m_BloomViews.reserve(10);
-        for (uint32_t i = 0; i < MAX_BLOOM_LEVELS; i++)
-        {
-            VulkanHelper::Image::Config bloomImageConfig{};
-            bloomImageConfig.Device = m_Device;
-            bloomImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
-            bloomImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_SRC_BIT;
-            bloomImageConfig.Width = currentSize.x;
-            bloomImageConfig.Height = currentSize.y;
-
-            VulkanHelper::Image bloomImage = VulkanHelper::Image::New(bloomImageConfig).Value();
-            m_BloomViews.push_back(VulkanHelper::ImageView::New({ bloomImage, VulkanHelper::ImageView::ViewType::VIEW_2D }).Value());
-
-            if (currentSize.x % 2 != 0)
-                currentSize.x -= 1;
-            if (currentSize.y % 2 != 0)
-                currentSize.y -= 1;
-
-            currentSize /= 2;
-            if (currentSize.x < 2 || currentSize.y < 2)
-                break;
-        }
-
-        for (int i = 0; i < (int)m_BloomViews.size(); i++)
-        {
-            if (i == 0)
-            {
-                VH_ASSERT(m_BloomDescriptorSets[(size_t)i].AddImage(0, 0, &inputImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image input view to descriptor set");
-            }
-            else
-            {
-                VH_ASSERT(m_BloomDescriptorSets[(size_t)i].AddImage(0, 0, &m_BloomViews[(size_t)glm::max(i - 1, 0)], VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image input view to descriptor set");
-            }
-
-            VH_ASSERT(m_BloomDescriptorSets[(size_t)i].AddImage(1, 0, &m_BloomViews[(size_t)i], VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image output view to descriptor set");
-        }
-    }
+    CreateBloomImage();
 
     // Tonemapping
     {
@@ -184,64 +128,136 @@ void PostProcessor::SetInputImage(VulkanHelper::ImageView inputImageView)
 
         m_OutputImageView = VulkanHelper::ImageView::New({ outputImage, VulkanHelper::ImageView::ViewType::VIEW_2D }).Value();
 
-        VH_ASSERT(m_TonemappingDescriptorSet.AddImage(0, 0, &inputImageView, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add input image view to descriptor set");
         VH_ASSERT(m_TonemappingDescriptorSet.AddImage(1, 0, &m_OutputImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add output image view to descriptor set");
-        VH_ASSERT(m_TonemappingDescriptorSet.AddImage(3, 0, &m_BloomViews[0], VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image view to descriptor set");
     }
+
+    BindChainInput();
+}
+
+void PostProcessor::CreateBloomImage()
+{
+    // Vulkan rounds the odd sizes of the mips down the same way the chain always did
+    uint32_t mipCount = 1;
+    glm::uvec2 mipSize = { m_InputImageView.GetWidth(), m_InputImageView.GetHeight() };
+    while (mipCount < MAX_BLOOM_LEVELS && mipSize.x / 2 >= 2 && mipSize.y / 2 >= 2)
+    {
+        mipSize /= 2;
+        mipCount++;
+    }
+
+    VulkanHelper::Image::Config bloomImageConfig{};
+    bloomImageConfig.Device = m_Device;
+    bloomImageConfig.Usage = VulkanHelper::Image::Usage::STORAGE_BIT | VulkanHelper::Image::Usage::SAMPLED_BIT | VulkanHelper::Image::Usage::TRANSFER_SRC_BIT;
+    bloomImageConfig.Width = m_InputImageView.GetWidth();
+    bloomImageConfig.Height = m_InputImageView.GetHeight();
+    bloomImageConfig.MipLevels = mipCount;
+
+    switch (m_WorkingFormat)
+    {
+    case WorkingFormat::R16G16B16A16_SFLOAT:
+        bloomImageConfig.Format = VulkanHelper::Format::R16G16B16A16_SFLOAT;
+        break;
+    case WorkingFormat::B10G11R11_UFLOAT:
+        bloomImageConfig.Format = VulkanHelper::Format::B10G11R11_UFLOAT_PACK32;
+        break;
+    case WorkingFormat::R32G32B32A32_SFLOAT:
+        bloomImageConfig.Format = VulkanHelper::Format::R32G32B32A32_SFLOAT;
+        break;
+
+    default:
+        VH_ASSERT(false, "Unknown post process working format!");
+        break;
+    }
+
+    m_BloomImage = VulkanHelper::Image::New(bloomImageConfig).Value();
+
+    m_BloomViews.clear();
+    m_BloomViews.reserve(mipCount);
+    for (uint32_t i = 0; i < mipCount; i++)
+    {
+        VulkanHelper::ImageView::Config bloomViewConfig{};
+        bloomViewConfig.image = m_BloomImage;
+        bloomViewConfig.ViewType = VulkanHelper::ImageView::ViewType::VIEW_2D;
+        bloomViewConfig.BaseLayer = 0;
+        bloomViewConfig.LayerCount = 1;
+        bloomViewConfig.BaseMipLevel = i;
+        bloomViewConfig.MipLevelCount = 1;
+
+        m_BloomViews.push_back(VulkanHelper::ImageView::New(bloomViewConfig).Value());
+    }
+
+    // Chain can be shorter than the array, the rest of it points to the last mip and is never written
+    for (uint32_t i = 0; i < MAX_BLOOM_LEVELS; i++)
+    {
+        VulkanHelper::ImageView& mipView = m_BloomViews[glm::min(i, (uint32_t)m_BloomViews.size() - 1)];
+        VH_ASSERT(m_BloomDescriptorSet.AddImage(1, i, &mipView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom mip view to descriptor set");
+    }
+
+    VH_ASSERT(m_TonemappingDescriptorSet.AddImage(3, 0, &m_BloomViews[0], VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image view to descriptor set");
+}
+
+void PostProcessor::SetDenoiserEnabled(bool enabled)
+{
+    m_DenoiserEnabled = enabled;
+    BindChainInput();
+}
+
+void PostProcessor::BindChainInput()
+{
+    VulkanHelper::ImageView chainInputImageView = GetChainInputImageView();
+
+    VH_ASSERT(m_BloomDescriptorSet.AddImage(0, 0, &chainInputImageView, VulkanHelper::Image::Layout::GENERAL) == VulkanHelper::VHResult::OK, "Failed to add bloom image input view to descriptor set");
+    VH_ASSERT(m_TonemappingDescriptorSet.AddImage(0, 0, &chainInputImageView, VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL) == VulkanHelper::VHResult::OK, "Failed to add input image view to descriptor set");
 }
 
-void PostProcessor::PostProcess(VulkanHelper::CommandBuffer& commandBuffer)
+void PostProcessor::PostProcess(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated, uint32_t resetCount)
 {
-    m_MipCount = glm::clamp(m_MipCount, 1u, (uint32_t)m_BloomViews.size());
+    // Denoise
+    if (m_DenoiserEnabled)
+    {
+        m_Denoiser.Denoise(commandBuffer, samplesAccumulated, resetCount);
+    }
+
+    VulkanHelper::ImageView chainInputImageView = GetChainInputImageView();
 
     // Bloom
     {
-        m_InputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+        chainInputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
 
-        m_BloomPushData.FirstBatch = 1;
+        m_BloomImage.TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
+
+        const glm::uvec2 groupCount = (GetBloomMipSize(0) + BLOOM_TILE_SIZE - 1u) / BLOOM_TILE_SIZE;
+        m_BloomPushData.MipCount = glm::clamp(m_MipCount, 1u, (uint32_t)m_BloomViews.size());
+        m_BloomPushData.GroupCount = groupCount.x * groupCount.y;
         VH_ASSERT(m_BloomPushConstant.SetData(&m_BloomPushData, sizeof(BloomPushData)) == VulkanHelper::VHResult::OK, "Failed to set bloom push constant data");
 
-        // Down Sample pass
-        for (int i = 0; i < (int)m_MipCount; i++)
-        {
-            m_BloomViews[(size_t)i].GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
-            m_BloomViews[(size_t)glm::min(i + 1, (int)m_MipCount - 1)].GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
-
-            m_BloomDownSamplePipelines[(size_t)i].Bind(commandBuffer);
-            glm::uvec2 textureSize;
-            if (i == 0)
-            {
-                textureSize = {m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().GetWidth(), m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().GetHeight()};
-            }
-            else
-            {
-                textureSize = {m_BloomViews[(size_t)glm::max(i, 0)].GetImage().GetWidth(), m_BloomViews[(size_t)glm::max(i, 0)].GetImage().GetHeight()};
-            }
-            m_BloomDownSamplePipelines[(size_t)i].Dispatch(commandBuffer, (uint32_t)glm::ceil((float)textureSize.x / (float)8), (uint32_t)glm::ceil((float)textureSize.y / (float)8), 1);
-
-            m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().Barrier(commandBuffer, 0, 1, VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
-
-            m_BloomPushData.FirstBatch = 0;
-            VH_ASSERT(m_BloomPushConstant.SetData(&m_BloomPushData, sizeof(m_BloomPushData)) == VulkanHelper::VHResult::OK, "Failed to set bloom push constant data");
-        }
+        // Down sample pass, whole chain at once
+        m_BloomDownSamplePipeline.Bind(commandBuffer);
+        m_BloomDownSamplePipeline.Dispatch(commandBuffer, groupCount.x, groupCount.y, 1);
+
+        m_BloomImage.Barrier(commandBuffer, 0, (uint32_t)m_BloomViews.size(), VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
+        m_BloomGroupCounterBuffer.Barrier(commandBuffer, VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
 
         // Up sample pass
-        for (int i = (int)m_MipCount - 1; i > 0; i--)
+        for (int i = (int)m_BloomPushData.MipCount - 2; i >= 0; i--)
         {
-            m_BloomUpSamplePipelines[(size_t)i].Bind(commandBuffer);
-            glm::uvec2 textureSize = {m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().GetWidth(), m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().GetHeight()};
-            m_BloomUpSamplePipelines[(size_t)i].Dispatch(commandBuffer, (uint32_t)glm::ceil((float)textureSize.x / (float)8), (uint32_t)glm::ceil((float)textureSize.y / (float)8), 1);
-            m_BloomViews[(size_t)glm::max(i - 1, 0)].GetImage().Barrier(commandBuffer, 0, 1, VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
+            m_BloomPushData.Mip = (uint32_t)i;
+            VH_ASSERT(m_BloomPushConstant.SetData(&m_BloomPushData, sizeof(BloomPushData)) == VulkanHelper::VHResult::OK, "Failed to set bloom push constant data");
+
+            m_BloomUpSamplePipeline.Bind(commandBuffer);
+            glm::uvec2 textureSize = GetBloomMipSize((uint32_t)i);
+            m_BloomUpSamplePipeline.Dispatch(commandBuffer, (uint32_t)glm::ceil((float)textureSize.x / (float)8), (uint32_t)glm::ceil((float)textureSize.y / (float)8), 1);
+            m_BloomImage.Barrier(commandBuffer, 0, (uint32_t)m_BloomViews.size(), VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::AccessFlags::SHADER_READ_BIT | VulkanHelper::AccessFlags::SHADER_WRITE_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT, VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT);
         }
     }
 
     // Tonemap
     {
-        m_InputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+        chainInputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::SHADER_READ_ONLY_OPTIMAL, commandBuffer);
         m_OutputImageView.GetImage().TransitionImageLayout(VulkanHelper::Image::Layout::GENERAL, commandBuffer);
 
         m_TonemappingPipeline.Bind(commandBuffer);
-        m_TonemappingPipeline.Dispatch(commandBuffer, (uint32_t)glm::ceil((float)m_InputImageView.GetWidth() / (float)8), (uint32_t)glm::ceil((float)m_InputImageView.GetHeight() / (float)8), 1);
+        m_TonemappingPipeline.Dispatch(commandBuffer, (uint32_t)glm::ceil((float)chainInputImageView.GetWidth() / (float)8), (uint32_t)glm::ceil((float)chainInputImageView.GetHeight() / (float)8), 1);
     }
 }
 
@@ -264,6 +280,7 @@ void PostProcessor::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
 {
     // Tonemapping
     {
+        InitializeShaderSession(m_WorkingFormat);
         auto shaderRes = VulkanHelper::Shader::New({
             m_Device,
             "PostProcess/Tonemap.slang",
@@ -283,39 +300,86 @@ void PostProcessor::ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer)
         }
     }
 
-    // Bloom
+    CreateBloomPipelines(m_WorkingFormat);
+}
+
+void PostProcessor::SetWorkingFormat(WorkingFormat format)
+{
+    if (!IsWorkingFormatSupported(format))
     {
-        auto downSampleShaderRes = VulkanHelper::Shader::New({
-            m_Device,
-            "PostProcess/BloomDownSample.slang",
-            VulkanHelper::ShaderStages::COMPUTE_BIT
-        });
+        VH_LOG_WARN("B10G11R11 storage images aren't supported by the device, bloom falls back to RGBA16");
+        format = WorkingFormat::R16G16B16A16_SFLOAT;
+    }
 
-        auto upSampleShaderRes = VulkanHelper::Shader::New({
-            m_Device,
-            "PostProcess/BloomUpSample.slang",
-            VulkanHelper::ShaderStages::COMPUTE_BIT
-        });
+    // Storage image format is baked into the bloom shaders, so the image switches only once they compile
+    if (format == m_WorkingFormat || !CreateBloomPipelines(format))
+        return;
 
-        if (downSampleShaderRes.HasValue() && upSampleShaderRes.HasValue())
-        {
-            VulkanHelper::Shader downSampleShader = downSampleShaderRes.Value();
-            VulkanHelper::Shader upSampleShader = upSampleShaderRes.Value();
+    m_WorkingFormat = format;
+    if (!m_BloomViews.empty()) // Input image not set yet
+        CreateBloomImage();
+}
 
-            VulkanHelper::Pipeline::ComputeConfig pipelineConfig;
-            pipelineConfig.Device = m_Device;
-            pipelineConfig.PushConstant = &m_BloomPushConstant;
+void PostProcessor::InitializeShaderSession(WorkingFormat format)
+{
+    std::vector<VulkanHelper::Shader::Define> defines;
+    switch (format)
+    {
+    case WorkingFormat::R16G16B16A16_SFLOAT:
+        defines.push_back({"WORKING_FORMAT_R16G16B16A16_SFLOAT", "1"});
+        break;
+    case WorkingFormat::B10G11R11_UFLOAT:
+        defines.push_back({"WORKING_FORMAT_B10G11R11_UFLOAT", "1"});
+        break;
+    case WorkingFormat::R32G32B32A32_SFLOAT:
+        defines.push_back({"WORKING_FORMAT_R32G32B32A32_SFLOAT", "1"});
+        break;
+
+    default:
+        VH_ASSERT(false, "Unknown post process working format!");
+        break;
+    }
 
-            for (uint32_t i = 0; i < MAX_BLOOM_LEVELS; i++)
-            {
-                pipelineConfig.DescriptorSets = { m_BloomDescriptorSets[i] };
+    // Session is global and every user replaces it with its own defines right before compiling, so nothing
+    // depends on the order in which the path tracer and the post processor reload their shaders
+    VulkanHelper::Shader::InitializeSession("../../PathTracer/Shaders/", (uint32_t)defines.size(), defines.data());
+}
 
-                pipelineConfig.ComputeShader = downSampleShader;
-                m_BloomDownSamplePipelines[i] = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+bool PostProcessor::CreateBloomPipelines(WorkingFormat format)
+{
+    InitializeShaderSession(format);
 
-                pipelineConfig.ComputeShader = upSampleShader;
-                m_BloomUpSamplePipelines[i] = VulkanHelper::Pipeline::New(pipelineConfig).Value();
-            }
-        }
+    auto downSampleShaderRes = VulkanHelper::Shader::New({
+        m_Device,
+        "PostProcess/BloomDownSample.slang",
+        VulkanHelper::ShaderStages::COMPUTE_BIT
+    });
+
+    auto upSampleShaderRes = VulkanHelper::Shader::New({
+        m_Device,
+        "PostProcess/BloomUpSample.slang",
+        VulkanHelper::ShaderStages::COMPUTE_BIT
+    });
+
+    if (!downSampleShaderRes.HasValue() || !upSampleShaderRes.HasValue())
+    {
+        VH_LOG_ERROR("Failed to compile bloom shaders");
+        return false;
     }
-}
\ No newline at end of file
+
+    VulkanHelper::Shader downSampleShader = downSampleShaderRes.Value();
+    VulkanHelper::Shader upSampleShader = upSampleShaderRes.Value();
+
+    VulkanHelper::Pipeline::ComputeConfig pipelineConfig;
+    pipelineConfig.Device = m_Device;
+    pipelineConfig.PushConstant = &m_BloomPushConstant;
+    pipelineConfig.DescriptorSets = { m_BloomDescriptorSet };
+
+    pipelineConfig.ComputeShader = downSampleShader;
+    m_BloomDownSamplePipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+
+    pipelineConfig.ComputeShader = upSampleShader;
+    m_BloomUpSamplePipeline = VulkanHelper::Pipeline::New(pipelineConfig).Value();
+
+    return true;
+}
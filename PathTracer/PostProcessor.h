@@ -2,6 +2,8 @@
 
 #include "VulkanHelper.h"
 
+#include "Denoiser.h"
+
 class PostProcessor
 {
 public:
@@ -20,24 +22,57 @@ public:
         float FalloffRange = 5.0f;
     };
 
+    // Format of the bloom mip chain. B10G11R11 takes a quarter of the memory of the full float format but has no sign and
+    // only around 6 bits of mantissa, storage image support for it is optional so it falls back to RGBA16 where it's missing
+    enum class WorkingFormat
+    {
+        R16G16B16A16_SFLOAT = 0,
+        B10G11R11_UFLOAT = 1,
+        R32G32B32A32_SFLOAT = 2
+    };
+
     PostProcessor() = default;
 
-    static PostProcessor New(VulkanHelper::Device device);
+    static PostProcessor New(VulkanHelper::Device device, VulkanHelper::ThreadPool* threadPool);
+
+    // Albedo and normal are only used by the denoiser
+    void SetInputImage(VulkanHelper::ImageView inputImageView, VulkanHelper::ImageView albedoImageView, VulkanHelper::ImageView normalImageView);
 
-    void SetInputImage(VulkanHelper::ImageView inputImageView);
-    void PostProcess(VulkanHelper::CommandBuffer& commandBuffer);
+    // Reset count tells the denoiser when the input was reset
+    void PostProcess(VulkanHelper::CommandBuffer& commandBuffer, uint32_t samplesAccumulated, uint32_t resetCount);
     void SetTonemappingData(const TonemappingData& data, VulkanHelper::CommandBuffer& commandBuffer);
     void SetBloomData(const BloomData& data);
+    void SetWorkingFormat(WorkingFormat format); // Current format is kept if the bloom shaders fail to compile
     void ReloadShaders(VulkanHelper::CommandBuffer& commandBuffer);
 
+    // Denoiser runs before bloom and tonemapping, the path tracer has to write the AOVs for it
+    void SetDenoiserEnabled(bool enabled);
+
     VulkanHelper::ImageView GetOutputImageView() const { return m_OutputImageView; }
+    [[nodiscard]] inline bool IsDenoiserEnabled() const { return m_DenoiserEnabled; }
+    [[nodiscard]] inline uint32_t GetDenoisedSampleCount() const { return m_Denoiser.GetDenoisedSampleCount(); }
+    [[nodiscard]] inline WorkingFormat GetWorkingFormat() const { return m_WorkingFormat; }
+    [[nodiscard]] inline bool IsWorkingFormatSupported(WorkingFormat format) const { return format != WorkingFormat::B10G11R11_UFLOAT || m_PackedFormatSupported; }
 
 private:
+    // Image that bloom and tonemapping read, either the input or the denoised input
+    [[nodiscard]] inline VulkanHelper::ImageView GetChainInputImageView() const { return m_DenoiserEnabled ? m_Denoiser.GetOutputImageView() : m_InputImageView; }
+    void BindChainInput();
+
+    // Bloom chain is a single mipmapped image in the working format with a view per level
+    void CreateBloomImage();
+    static void InitializeShaderSession(WorkingFormat format); // Working format is baked into the storage image declarations
+    bool CreateBloomPipelines(WorkingFormat format); // Pipelines are replaced only if both shaders compile
+    [[nodiscard]] inline glm::uvec2 GetBloomMipSize(uint32_t mip) const { return glm::max(glm::uvec2(m_BloomImage.GetWidth(), m_BloomImage.GetHeight()) >> mip, glm::uvec2(1)); }
+
     VulkanHelper::Device m_Device;
 
     VulkanHelper::ImageView m_InputImageView;
     VulkanHelper::ImageView m_OutputImageView;
 
+    Denoiser m_Denoiser;
+    bool m_DenoiserEnabled = false;
+
     VulkanHelper::DescriptorPool m_DescriptorPool;
     VulkanHelper::DescriptorSet m_TonemappingDescriptorSet;
 
@@ -47,25 +82,31 @@ private:
     VulkanHelper::Buffer m_TonemappingBuffer;
     VulkanHelper::Buffer m_TonemappingStagingBuffer;
     
-    std::vector<VulkanHelper::Pipeline> m_BloomDownSamplePipelines;
-    std::vector<VulkanHelper::Pipeline> m_BloomUpSamplePipelines;
-    std::vector<VulkanHelper::ImageView> m_BloomViews;
+    // Down sampling produces the whole chain in a single dispatch, up sampling runs once per mip
+    VulkanHelper::Pipeline m_BloomDownSamplePipeline;
+    VulkanHelper::Pipeline m_BloomUpSamplePipeline;
+    VulkanHelper::Image m_BloomImage;
+    std::vector<VulkanHelper::ImageView> m_BloomViews; // One per mip of the bloom image
+    WorkingFormat m_WorkingFormat = WorkingFormat::R16G16B16A16_SFLOAT;
+    bool m_PackedFormatSupported = false; // B10G11R11 can be used as a storage image
 
-    std::vector<VulkanHelper::DescriptorSet> m_BloomDescriptorSets;
+    VulkanHelper::DescriptorSet m_BloomDescriptorSet;
+    VulkanHelper::Buffer m_BloomGroupCounterBuffer; // Finds the last down sampling group, reset by the shader
 
     struct BloomPushData
     {
         float BloomThreshold = 2.0f;
         float BloomStrength = 1.0f;
-        int FirstBatch = 1;
+        uint32_t MipCount = 10;
         float FalloffRange = 5.0f;
+        uint32_t Mip = 0; // Written by the up sampling
+        uint32_t GroupCount = 0; // Of the down sampling dispatch
     };
     BloomPushData m_BloomPushData{};
     uint32_t m_MipCount = 10;
 
     VulkanHelper::PushConstant m_BloomPushConstant;
 
-    VulkanHelper::Sampler m_BloomSampler;
-
-    constexpr static uint32_t MAX_BLOOM_LEVELS = 10;
+    constexpr static uint32_t MAX_BLOOM_LEVELS = 10; // Has to match BloomDownSample.slang and BloomUpSample.slang
+    constexpr static uint32_t BLOOM_TILE_SIZE = 64; // Has to match BloomDownSample.slang
 };
\ No newline at end of file
@@ -0,0 +1,433 @@
+#include "SkyBaker.h"
+
+#include <algorithm>
+#include <future>
+#include <numbers>
+
+constexpr static float PI = std::numbers::pi_v<float>;
+constexpr static float MIE_ANISOTROPY = 0.85f; // Has to match PhaseMie() in RTCommon.slang
+
+// Same as Rotate() in the shaders
+static glm::vec3 Rotate(const glm::vec3& v, const glm::vec3& axis, float theta)
+{
+    const float cosTheta = glm::cos(theta);
+    const float sinTheta = glm::sin(theta);
+    const glm::vec3 normalizedAxis = glm::normalize(axis);
+
+    return v * cosTheta + glm::cross(normalizedAxis, v) * sinTheta + normalizedAxis * glm::dot(normalizedAxis, v) * (1.0f - cosTheta);
+}
+
+static float RayleighPhase(float cosTheta)
+{
+    return 3.0f / (16.0f * PI) * (1.0f + cosTheta * cosTheta);
+}
+
+// Same approximation as PhaseMie() in RTCommon.slang
+static float MiePhase(float cosTheta)
+{
+    const float g = std::min(MIE_ANISOTROPY, 0.9381f);
+    const float k = 1.55f * g - 0.55f * g * g * g;
+    const float kCosTheta = k * cosTheta;
+    return (1.0f - k * k) / (4.0f * PI * (1.0f - kCosTheta) * (1.0f - kCosTheta));
+}
+
+// Integral of the transmittance over a segment with constant extinction
+static glm::vec3 IntegrateSegment(const glm::vec3& extinction, float length)
+{
+    glm::vec3 result;
+    for (int i = 0; i < 3; i++)
+        result[i] = extinction[i] > 0.0f ? (1.0f - glm::exp(-extinction[i] * length)) / extinction[i] : length;
+
+    return result;
+}
+
+// Equirectangular texel direction, same as in ImportanceSampleEnvMap() before the rotation
+static glm::vec3 GetEnvMapDirection(float u, float v)
+{
+    const float phi = u * 2.0f * PI - PI;
+    const float theta = v * PI;
+    return glm::vec3(glm::sin(phi) * glm::sin(theta), -glm::cos(theta), -glm::cos(phi) * glm::sin(theta));
+}
+
+glm::vec3 SkyBaker::LUT::Sample(glm::vec2 uv) const
+{
+    const float x = glm::clamp(uv.x * (float)Width - 0.5f, 0.0f, (float)(Width - 1));
+    const float y = glm::clamp(uv.y * (float)Height - 0.5f, 0.0f, (float)(Height - 1));
+
+    const uint32_t x0 = (uint32_t)x;
+    const uint32_t y0 = (uint32_t)y;
+    const uint32_t x1 = std::min(x0 + 1, Width - 1);
+    const uint32_t y1 = std::min(y0 + 1, Height - 1);
+    const float fx = x - (float)x0;
+    const float fy = y - (float)y0;
+
+    const glm::vec3 top = glm::mix(Texels[y0 * Width + x0], Texels[y0 * Width + x1], fx);
+    const glm::vec3 bottom = glm::mix(Texels[y1 * Width + x0], Texels[y1 * Width + x1], fx);
+    return glm::mix(top, bottom, fy);
+}
+
+SkyBaker SkyBaker::New(const Config& config)
+{
+    SkyBaker baker{};
+    baker.m_Config = config;
+
+    // LUTs only cover the inside of the atmosphere, views from space are moved down to its top
+    const float viewDistance = glm::length(config.ViewPosition);
+    baker.m_Up = viewDistance > 0.0f ? config.ViewPosition / viewDistance : glm::vec3(0.0f, 1.0f, 0.0f);
+    baker.m_ViewRadius = glm::clamp(viewDistance, config.PlanetRadius + 1.0f, baker.GetTopRadius() - 1.0f);
+    baker.m_SunCosZenith = glm::clamp(glm::dot(baker.GetSunDirection(), baker.m_Up), -1.0f, 1.0f);
+
+    // Alpha of the read back texels is unused, only the converted copy is kept
+    baker.m_TransmittanceLUT.Width = config.TransmittanceLUTWidth;
+    baker.m_TransmittanceLUT.Height = config.TransmittanceLUTHeight;
+    baker.m_TransmittanceLUT.Texels.reserve(config.TransmittanceLUT.size());
+    for (const glm::vec4& texel : config.TransmittanceLUT)
+        baker.m_TransmittanceLUT.Texels.push_back(glm::vec3(texel));
+    baker.m_Config.TransmittanceLUT.clear();
+
+    // Every LUT depends on the previous one
+    baker.ComputeMultipleScatteringLUT();
+    baker.ComputeSkyViewLUT();
+
+    return baker;
+}
+
+// Rows of the LUTs and of the environment map are independent, so they're computed in parallel
+void SkyBaker::ForEachRow(uint32_t rowCount, const std::function<void(uint32_t)>& computeRow) const
+{
+    if (m_Config.ThreadPool == nullptr)
+    {
+        for (uint32_t y = 0; y < rowCount; y++)
+            computeRow(y);
+
+        return;
+    }
+
+    std::vector<std::future<void>> tasks;
+    tasks.reserve(rowCount);
+    for (uint32_t y = 0; y < rowCount; y++)
+        tasks.push_back(m_Config.ThreadPool->PushTask([&computeRow, y]() { computeRow(y); }));
+
+    for (std::future<void>& task : tasks)
+        task.get();
+}
+
+SkyBaker::Medium SkyBaker::GetMedium(float height) const
+{
+    const float mieDensity = glm::exp(-height / m_Config.MieDensityFalloff);
+    const float ozoneDensity = glm::exp(-glm::abs(height - m_Config.OzonePeak) / m_Config.OzoneDensityFalloff);
+
+    Medium medium;
+    medium.Rayleigh = m_Config.RayleighScattering * glm::exp(-height / m_Config.RayleighDensityFalloff);
+    medium.Mie = m_Config.MieScattering * mieDensity;
+    medium.Extinction = medium.Rayleigh + medium.Mie + m_Config.MieAbsorption * mieDensity + m_Config.OzoneAbsorption * ozoneDensity;
+    return medium;
+}
+
+bool SkyBaker::IntersectsPlanet(float r, float mu) const
+{
+    return mu < 0.0f && r * r * (mu * mu - 1.0f) + m_Config.PlanetRadius * m_Config.PlanetRadius >= 0.0f;
+}
+
+float SkyBaker::GetRayLength(float r, float mu) const
+{
+    if (IntersectsPlanet(r, mu))
+        return std::max(-r * mu - glm::sqrt(std::max(r * r * (mu * mu - 1.0f) + m_Config.PlanetRadius * m_Config.PlanetRadius, 0.0f)), 0.0f);
+
+    const float top = GetTopRadius();
+    return std::max(-r * mu + glm::sqrt(std::max(r * r * (mu * mu - 1.0f) + top * top, 0.0f)), 0.0f);
+}
+
+// Same as GetTransmittanceLUTUV() in Atmosphere.slang
+glm::vec2 SkyBaker::GetTransmittanceUV(float r, float mu) const
+{
+    const float planetRadius = m_Config.PlanetRadius;
+    const float top = GetTopRadius();
+    const float H = glm::sqrt(std::max(top * top - planetRadius * planetRadius, 0.0f));
+    const float rho = glm::sqrt(std::max(r * r - planetRadius * planetRadius, 0.0f));
+
+    const float d = GetRayLength(r, mu);
+    const float dMin = top - r;
+    const float dMax = rho + H;
+
+    const glm::vec2 unitRange = glm::clamp(glm::vec2(dMax > dMin ? (d - dMin) / (dMax - dMin) : 0.0f, H > 0.0f ? rho / H : 0.0f), 0.0f, 1.0f);
+    const glm::vec2 size((float)m_TransmittanceLUT.Width, (float)m_TransmittanceLUT.Height);
+
+    // Texel centers are at the edges of the range
+    return 0.5f / size + unitRange * (1.0f - 1.0f / size);
+}
+
+glm::vec3 SkyBaker::GetTransmittance(float r, float mu) const
+{
+    if (IntersectsPlanet(r, mu))
+        return glm::vec3(0.0f);
+
+    return m_TransmittanceLUT.Sample(GetTransmittanceUV(r, mu));
+}
+
+glm::vec3 SkyBaker::GetMultipleScattering(float r, float muSun) const
+{
+    return m_MultipleScatteringLUT.Sample(glm::vec2(muSun * 0.5f + 0.5f, (r - m_Config.PlanetRadius) / m_Config.AtmosphereHeight));
+}
+
+// Same as SampleSunDisk() in Sampler.slang
+glm::vec3 SkyBaker::GetSunDirection() const
+{
+    const float azimuth = m_Config.SkyRotationAzimuth / 180.0f * PI;
+    const float altitude = m_Config.SkyRotationAltitude / 180.0f * PI;
+
+    const glm::vec3 sunDirection = Rotate(glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, 0.0f), altitude);
+    return Rotate(sunDirection, glm::vec3(0.0f, 1.0f, 0.0f), azimuth);
+}
+
+// Light scattered more than once is approximated as isotropic, with a unit illuminance from the sun. The second order
+// scattering and the fraction of light that is scattered again are gathered over the sphere around every texel, and the
+// infinite series of the higher orders is the geometric series 1 / (1 - fraction)
+void SkyBaker::ComputeMultipleScatteringLUT()
+{
+    m_MultipleScatteringLUT.Width = MULTIPLE_SCATTERING_LUT_SIZE;
+    m_MultipleScatteringLUT.Height = MULTIPLE_SCATTERING_LUT_SIZE;
+    m_MultipleScatteringLUT.Texels.resize(MULTIPLE_SCATTERING_LUT_SIZE * MULTIPLE_SCATTERING_LUT_SIZE);
+
+    const float isotropicPhase = 1.0f / (4.0f * PI);
+    const float directionCount = (float)(MULTIPLE_SCATTERING_DIRECTIONS * MULTIPLE_SCATTERING_DIRECTIONS);
+
+    ForEachRow(MULTIPLE_SCATTERING_LUT_SIZE, [&](uint32_t y)
+    {
+        for (uint32_t x = 0; x < MULTIPLE_SCATTERING_LUT_SIZE; x++)
+        {
+            const float muSun = ((float)x + 0.5f) / (float)MULTIPLE_SCATTERING_LUT_SIZE * 2.0f - 1.0f;
+            const float r = m_Config.PlanetRadius + ((float)y + 0.5f) / (float)MULTIPLE_SCATTERING_LUT_SIZE * m_Config.AtmosphereHeight;
+            const glm::vec3 position(0.0f, r, 0.0f);
+            const glm::vec3 sunDirection(glm::sqrt(std::max(1.0f - muSun * muSun, 0.0f)), muSun, 0.0f);
+
+            glm::vec3 secondOrder(0.0f);
+            glm::vec3 scatteredFraction(0.0f);
+            for (uint32_t i = 0; i < MULTIPLE_SCATTERING_DIRECTIONS; i++)
+            {
+                for (uint32_t j = 0; j < MULTIPLE_SCATTERING_DIRECTIONS; j++)
+                {
+                    const float cosTheta = 1.0f - 2.0f * ((float)i + 0.5f) / (float)MULTIPLE_SCATTERING_DIRECTIONS;
+                    const float sinTheta = glm::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+                    const float phi = 2.0f * PI * ((float)j + 0.5f) / (float)MULTIPLE_SCATTERING_DIRECTIONS;
+                    const glm::vec3 direction(sinTheta * glm::cos(phi), cosTheta, sinTheta * glm::sin(phi));
+
+                    const float rayLength = GetRayLength(r, cosTheta);
+                    const float stepSize = rayLength / (float)MULTIPLE_SCATTERING_STEPS;
+
+                    glm::vec3 transmittance(1.0f);
+                    for (uint32_t step = 0; step < MULTIPLE_SCATTERING_STEPS; step++)
+                    {
+                        const glm::vec3 samplePosition = position + direction * (((float)step + 0.5f) * stepSize);
+                        const float sampleRadius = glm::length(samplePosition);
+                        const Medium medium = GetMedium(sampleRadius - m_Config.PlanetRadius);
+
+                        const glm::vec3 scattering = medium.Rayleigh + medium.Mie;
+                        const glm::vec3 segment = IntegrateSegment(medium.Extinction, stepSize);
+                        const glm::vec3 sunTransmittance = GetTransmittance(sampleRadius, glm::dot(samplePosition, sunDirection) / sampleRadius);
+
+                        secondOrder += transmittance * scattering * sunTransmittance * isotropicPhase * segment;
+                        scatteredFraction += transmittance * scattering * segment;
+                        transmittance *= glm::exp(-medium.Extinction * stepSize);
+                    }
+                }
+            }
+
+            // Both are integrated over the sphere with the isotropic phase, which leaves just the average of the directions
+            secondOrder /= directionCount;
+            scatteredFraction /= directionCount;
+
+            m_MultipleScatteringLUT.Texels[y * MULTIPLE_SCATTERING_LUT_SIZE + x] = secondOrder / glm::max(1.0f - scatteredFraction, glm::vec3(1e-4f));
+        }
+    });
+}
+
+// Radiance seen from the view position for every zenith angle and azimuth relative to the sun. Most of the rows are spent
+// close to the horizon, where the sky changes the fastest, and the horizon is exactly in the middle of the LUT
+void SkyBaker::ComputeSkyViewLUT()
+{
+    m_SkyViewLUT.Width = SKY_VIEW_LUT_WIDTH;
+    m_SkyViewLUT.Height = SKY_VIEW_LUT_HEIGHT;
+    m_SkyViewLUT.Texels.resize(SKY_VIEW_LUT_WIDTH * SKY_VIEW_LUT_HEIGHT);
+
+    const float r = m_ViewRadius;
+    const float beta = glm::acos(glm::sqrt(std::max(r * r - m_Config.PlanetRadius * m_Config.PlanetRadius, 0.0f)) / r);
+    const float zenithHorizonAngle = PI - beta;
+
+    const glm::vec3 position(0.0f, r, 0.0f);
+    const glm::vec3 sunDirection(glm::sqrt(std::max(1.0f - m_SunCosZenith * m_SunCosZenith, 0.0f)), m_SunCosZenith, 0.0f);
+    const glm::vec3 sunIlluminance = m_Config.SunRadiance * 2.0f * PI * (1.0f - glm::cos(m_Config.SunAngularRadius));
+
+    ForEachRow(SKY_VIEW_LUT_HEIGHT, [&](uint32_t y)
+    {
+        for (uint32_t x = 0; x < SKY_VIEW_LUT_WIDTH; x++)
+        {
+            const glm::vec2 uv(((float)x + 0.5f) / (float)SKY_VIEW_LUT_WIDTH, ((float)y + 0.5f) / (float)SKY_VIEW_LUT_HEIGHT);
+
+            // Inverse of the mapping in Bake()
+            float viewZenithAngle;
+            if (uv.y < 0.5f)
+            {
+                const float coord = 1.0f - 2.0f * uv.y;
+                viewZenithAngle = zenithHorizonAngle * (1.0f - coord * coord);
+            }
+            else
+            {
+                const float coord = 2.0f * uv.y - 1.0f;
+                viewZenithAngle = zenithHorizonAngle + beta * coord * coord;
+            }
+            const float cosAzimuth = 1.0f - 2.0f * uv.x * uv.x;
+
+            const float cosViewZenith = glm::cos(viewZenithAngle);
+            const float sinViewZenith = glm::sin(viewZenithAngle);
+            const float sinAzimuth = glm::sqrt(std::max(1.0f - cosAzimuth * cosAzimuth, 0.0f));
+            const glm::vec3 direction(sinViewZenith * cosAzimuth, cosViewZenith, sinViewZenith * sinAzimuth);
+
+            const float cosTheta = glm::dot(direction, sunDirection);
+            const float rayleighPhase = RayleighPhase(cosTheta);
+            const float miePhase = MiePhase(cosTheta);
+
+            // Steps grow quadratically, the density falls off exponentially with the distance from the view position
+            const float rayLength = GetRayLength(r, cosViewZenith);
+            glm::vec3 transmittance(1.0f);
+            glm::vec3 radiance(0.0f);
+            for (uint32_t step = 0; step < SKY_VIEW_STEPS; step++)
+            {
+                const float t0 = rayLength * glm::pow((float)step / (float)SKY_VIEW_STEPS, 2.0f);
+                const float t1 = rayLength * glm::pow((float)(step + 1) / (float)SKY_VIEW_STEPS, 2.0f);
+                const float stepSize = t1 - t0;
+
+                const glm::vec3 samplePosition = position + direction * (t0 + 0.5f * stepSize);
+                const float sampleRadius = glm::length(samplePosition);
+                const float sampleCosSun = glm::dot(samplePosition, sunDirection) / sampleRadius;
+                const Medium medium = GetMedium(sampleRadius - m_Config.PlanetRadius);
+
+                // Transmittance to the sun is zero in the shadow of the planet
+                const glm::vec3 singleScattering = GetTransmittance(sampleRadius, sampleCosSun) * (medium.Rayleigh * rayleighPhase + medium.Mie * miePhase);
+                const glm::vec3 multipleScattering = GetMultipleScattering(sampleRadius, sampleCosSun) * (medium.Rayleigh + medium.Mie);
+
+                radiance += transmittance * sunIlluminance * (singleScattering + multipleScattering) * IntegrateSegment(medium.Extinction, stepSize);
+                transmittance *= glm::exp(-medium.Extinction * stepSize);
+            }
+
+            m_SkyViewLUT.Texels[y * SKY_VIEW_LUT_WIDTH + x] = radiance;
+        }
+    });
+}
+
+std::vector<float> SkyBaker::Bake(uint32_t width, uint32_t height) const
+{
+    std::vector<float> pixels((size_t)width * height * 4, 0.0f);
+
+    const float azimuth = m_Config.SkyRotationAzimuth / 180.0f * PI;
+    const float altitude = m_Config.SkyRotationAltitude / 180.0f * PI;
+
+    // Shaders rotate the world space direction into the environment map, so the texels are rotated back
+    auto envToWorld = [&](const glm::vec3& direction) {
+        return Rotate(Rotate(direction, glm::vec3(0.0f, 1.0f, 0.0f), azimuth), glm::vec3(1.0f, 0.0f, 0.0f), altitude);
+    };
+    const glm::mat3 envToWorldMatrix(envToWorld(glm::vec3(1.0f, 0.0f, 0.0f)), envToWorld(glm::vec3(0.0f, 1.0f, 0.0f)), envToWorld(glm::vec3(0.0f, 0.0f, 1.0f)));
+
+    const float r = m_ViewRadius;
+    const float beta = glm::acos(glm::sqrt(std::max(r * r - m_Config.PlanetRadius * m_Config.PlanetRadius, 0.0f)) / r);
+    const float zenithHorizonAngle = PI - beta;
+
+    // Azimuth is measured from the sun, it doesn't matter when the sun is at the zenith
+    const glm::vec3 sunDirection = GetSunDirection();
+    glm::vec3 sunHorizontal = sunDirection - m_Up * m_SunCosZenith;
+    const bool hasSunAzimuth = glm::length(sunHorizontal) > 1e-6f;
+    if (hasSunAzimuth)
+        sunHorizontal = glm::normalize(sunHorizontal);
+
+    ForEachRow(height, [&](uint32_t y)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const glm::vec3 direction = envToWorldMatrix * GetEnvMapDirection(((float)x + 0.5f) / (float)width, ((float)y + 0.5f) / (float)height);
+
+            const float cosViewZenith = glm::clamp(glm::dot(direction, m_Up), -1.0f, 1.0f);
+            const glm::vec3 horizontal = direction - m_Up * cosViewZenith;
+            const float cosAzimuth = hasSunAzimuth && glm::length(horizontal) > 1e-6f ? glm::clamp(glm::dot(glm::normalize(horizontal), sunHorizontal), -1.0f, 1.0f) : 1.0f;
+
+            const float viewZenithAngle = glm::acos(cosViewZenith);
+            glm::vec2 uv;
+            uv.x = glm::sqrt(0.5f - 0.5f * cosAzimuth);
+            if (viewZenithAngle < zenithHorizonAngle)
+                uv.y = (1.0f - glm::sqrt(std::max(1.0f - viewZenithAngle / zenithHorizonAngle, 0.0f))) * 0.5f;
+            else
+                uv.y = glm::sqrt(std::max((viewZenithAngle - zenithHorizonAngle) / beta, 0.0f)) * 0.5f + 0.5f;
+
+            const glm::vec3 radiance = m_SkyViewLUT.Sample(uv);
+
+            const size_t index = ((size_t)y * width + x) * 4;
+            pixels[index + 0] = radiance.r;
+            pixels[index + 1] = radiance.g;
+            pixels[index + 2] = radiance.b;
+        }
+    });
+
+    // Sun disk is usually smaller than a couple of texels. Its energy is spread over the texels it covers so that
+    // the total stays the same, which also makes it the brightest part of the importance map
+    const glm::vec3 sunTransmittance = GetTransmittance(r, m_SunCosZenith);
+    if (glm::all(glm::equal(sunTransmittance * m_Config.SunRadiance, glm::vec3(0.0f))))
+        return pixels;
+
+    const glm::vec3 sunEnvDirection = glm::transpose(envToWorldMatrix) * sunDirection;
+
+    const float sunSolidAngle = 2.0f * PI * (1.0f - glm::cos(m_Config.SunAngularRadius));
+    const glm::vec3 sunEnergy = m_Config.SunRadiance * sunTransmittance * sunSolidAngle;
+    const float cosSunRadius = glm::cos(m_Config.SunAngularRadius);
+    const float stepTheta = PI / (float)height;
+    const float stepPhi = 2.0f * PI / (float)width;
+    const float sunTheta = glm::acos(glm::clamp(-sunEnvDirection.y, -1.0f, 1.0f));
+
+    auto getTexelSolidAngle = [&](uint32_t y) { return (glm::cos((float)y * stepTheta) - glm::cos((float)(y + 1) * stepTheta)) * stepPhi; };
+
+    constexpr uint32_t subsampleCount = 4; // Per dimension
+    const uint32_t firstRow = (uint32_t)std::max((int)glm::floor((sunTheta - m_Config.SunAngularRadius) / stepTheta) - 1, 0);
+    const uint32_t lastRow = (uint32_t)std::min((int)glm::ceil((sunTheta + m_Config.SunAngularRadius) / stepTheta) + 1, (int)height - 1);
+
+    std::vector<std::pair<size_t, float>> coveredTexels;
+    float coveredSolidAngle = 0.0f;
+    for (uint32_t y = firstRow; y <= lastRow; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint32_t coveredSubsamples = 0;
+            for (uint32_t i = 0; i < subsampleCount * subsampleCount; i++)
+            {
+                const float u = ((float)x + ((float)(i % subsampleCount) + 0.5f) / (float)subsampleCount) / (float)width;
+                const float v = ((float)y + ((float)(i / subsampleCount) + 0.5f) / (float)subsampleCount) / (float)height;
+                if (glm::dot(GetEnvMapDirection(u, v), sunEnvDirection) >= cosSunRadius)
+                    coveredSubsamples++;
+            }
+
+            if (coveredSubsamples > 0)
+            {
+                const float coverage = (float)coveredSubsamples / (float)(subsampleCount * subsampleCount);
+                coveredTexels.push_back({ (size_t)y * width + x, coverage });
+                coveredSolidAngle += coverage * getTexelSolidAngle(y);
+            }
+        }
+    }
+
+    if (coveredTexels.empty())
+    {
+        // Disk fell between the subsamples, all of it goes to the closest texel
+        const float u = (glm::atan(sunEnvDirection.x, -sunEnvDirection.z) + PI) / (2.0f * PI);
+        const uint32_t x = std::min((uint32_t)(u * (float)width), width - 1);
+        const uint32_t y = std::min((uint32_t)(sunTheta / stepTheta), height - 1);
+        coveredTexels.push_back({ (size_t)y * width + x, 1.0f });
+        coveredSolidAngle = getTexelSolidAngle(y);
+    }
+
+    for (const auto& [texel, coverage] : coveredTexels)
+    {
+        const glm::vec3 radiance = sunEnergy * coverage / coveredSolidAngle;
+        pixels[texel * 4 + 0] += radiance.r;
+        pixels[texel * 4 + 1] += radiance.g;
+        pixels[texel * 4 + 2] += radiance.b;
+    }
+
+    return pixels;
+}
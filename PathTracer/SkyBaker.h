@@ -0,0 +1,100 @@
+#pragma once
+
+#include "VulkanHelper.h"
+
+#include <functional>
+#include <vector>
+
+// Approximation of the atmosphere from "A Scalable and Production Ready Sky and Atmosphere Rendering Technique" (Hillaire).
+// Multiple scattering and sky-view LUTs are computed on the CPU from the atmosphere parameters and the transmittance LUT
+// of the path tracer, and the sky-view LUT is then baked into an equirectangular environment map, sun disk included. Scattering between the camera and
+// the geometry and the shadows of the scene are ignored, the sky is seen the same way from everywhere.
+class SkyBaker
+{
+public:
+    struct Config
+    {
+        float PlanetRadius = 6360e3f; // In meters
+        float AtmosphereHeight = 100e3f; // In meters
+        glm::vec3 ViewPosition = glm::vec3(0.0f, 6361e3f, 0.0f); // Relative to the planet center, in meters
+
+        // Sea level coefficients, in 1/m
+        glm::vec3 RayleighScattering = glm::vec3(0.0f);
+        glm::vec3 MieScattering = glm::vec3(0.0f);
+        glm::vec3 MieAbsorption = glm::vec3(0.0f);
+        glm::vec3 OzoneAbsorption = glm::vec3(0.0f);
+
+        float RayleighDensityFalloff = 8000.0f; // In meters
+        float MieDensityFalloff = 1200.0f; // In meters
+        float OzoneDensityFalloff = 5000.0f; // In meters
+        float OzonePeak = 22000.0f; // In meters
+
+        glm::vec3 SunRadiance = glm::vec3(0.0f);
+        float SunAngularRadius = 0.0f; // In radians
+
+        // Same rotation the shaders apply to the environment map, also rotates the sun. In degrees
+        float SkyRotationAzimuth = 0.0f;
+        float SkyRotationAltitude = 0.0f;
+
+        // Transmittance LUT read back from the path tracer, parameterized like GetTransmittanceLUTUV() in Atmosphere.slang
+        std::vector<glm::vec4> TransmittanceLUT;
+        uint32_t TransmittanceLUTWidth = 0;
+        uint32_t TransmittanceLUTHeight = 0;
+
+        VulkanHelper::ThreadPool* ThreadPool = nullptr; // Rows are computed on the calling thread if null
+    };
+
+    SkyBaker() = default;
+
+    [[nodiscard]] static SkyBaker New(const Config& config);
+
+    // RGBA texels of the environment map in the layout LoadEnvironmentMap() expects, alpha is left for the PDF
+    [[nodiscard]] std::vector<float> Bake(uint32_t width, uint32_t height) const;
+
+private:
+    constexpr static uint32_t MULTIPLE_SCATTERING_LUT_SIZE = 32;
+    constexpr static uint32_t MULTIPLE_SCATTERING_DIRECTIONS = 8; // Per dimension
+    constexpr static uint32_t MULTIPLE_SCATTERING_STEPS = 20;
+    constexpr static uint32_t SKY_VIEW_LUT_WIDTH = 192;
+    constexpr static uint32_t SKY_VIEW_LUT_HEIGHT = 108;
+    constexpr static uint32_t SKY_VIEW_STEPS = 32;
+
+    struct Medium
+    {
+        glm::vec3 Rayleigh;
+        glm::vec3 Mie; // Scattering only
+        glm::vec3 Extinction;
+    };
+
+    struct LUT
+    {
+        std::vector<glm::vec3> Texels;
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+
+        [[nodiscard]] glm::vec3 Sample(glm::vec2 uv) const; // Bilinear, clamped to the edges
+    };
+
+    [[nodiscard]] Medium GetMedium(float height) const;
+    [[nodiscard]] float GetTopRadius() const { return m_Config.PlanetRadius + m_Config.AtmosphereHeight; }
+    [[nodiscard]] bool IntersectsPlanet(float r, float mu) const;
+    [[nodiscard]] float GetRayLength(float r, float mu) const; // To the planet or the top of the atmosphere
+
+    [[nodiscard]] glm::vec2 GetTransmittanceUV(float r, float mu) const;
+    [[nodiscard]] glm::vec3 GetTransmittance(float r, float mu) const; // Zero when the ray hits the planet
+    [[nodiscard]] glm::vec3 GetMultipleScattering(float r, float muSun) const;
+    [[nodiscard]] glm::vec3 GetSunDirection() const;
+
+    void ForEachRow(uint32_t rowCount, const std::function<void(uint32_t)>& computeRow) const;
+    void ComputeMultipleScatteringLUT();
+    void ComputeSkyViewLUT();
+
+    Config m_Config;
+    glm::vec3 m_Up = glm::vec3(0.0f, 1.0f, 0.0f); // At the view position
+    float m_ViewRadius = 0.0f;
+    float m_SunCosZenith = 0.0f;
+
+    LUT m_TransmittanceLUT;
+    LUT m_MultipleScatteringLUT;
+    LUT m_SkyViewLUT;
+};
@@ -0,0 +1,76 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+TileScheduler TileScheduler::New(const Config& config)
+{
+    TileScheduler scheduler{};
+    scheduler.m_Config = config;
+
+    return scheduler;
+}
+
+void TileScheduler::AddDispatchTime(float milliseconds, uint32_t chunkCount, uint32_t samplesPerDispatch)
+{
+    // Work of a dispatch is proportional to the samples and to 1 / chunkCount^2 of the pixels
+    const float sampleTime = milliseconds * (float)(chunkCount * chunkCount) / (float)samplesPerDispatch;
+
+    if (m_MeasuredDispatches == 0)
+        m_AverageSampleTime = sampleTime;
+    else
+        m_AverageSampleTime += (sampleTime - m_AverageSampleTime) * (1.0f - std::pow(1.0f - AVERAGE_WEIGHT, (float)samplesPerDispatch));
+
+    m_MeasuredDispatches++;
+}
+
+float TileScheduler::GetAverageDispatchTime(uint32_t chunkCount, uint32_t samplesPerDispatch) const
+{
+    return m_AverageSampleTime * (float)samplesPerDispatch / (float)(chunkCount * chunkCount);
+}
+
+bool TileScheduler::Update(uint32_t& chunkCount, uint32_t& samplesPerDispatch, bool allowSampleCountChange)
+{
+    if (m_MeasuredDispatches < MIN_MEASURED_DISPATCHES)
+        return false;
+
+    const float target = m_Config.TargetDispatchTime;
+    const float time = GetAverageDispatchTime(chunkCount, samplesPerDispatch);
+
+    const uint32_t oldChunkCount = chunkCount;
+    const uint32_t oldSamples = samplesPerDispatch;
+
+    if (time > target * SLOW_TOLERANCE)
+    {
+        // Drop samples first so that the whole image keeps updating every frame, split only when there's nothing left to drop
+        if (allowSampleCountChange && samplesPerDispatch > 1)
+            samplesPerDispatch = std::max(samplesPerDispatch / 2, 1u);
+        else if (chunkCount < m_Config.MaxChunkCount)
+            chunkCount++;
+    }
+    else
+    {
+        if (chunkCount > 1 && GetAverageDispatchTime(chunkCount - 1, samplesPerDispatch) < target * FAST_TOLERANCE)
+            chunkCount--;
+        else if (allowSampleCountChange && samplesPerDispatch < m_Config.MaxSamplesPerDispatch && GetAverageDispatchTime(chunkCount, samplesPerDispatch * 2) < target * FAST_TOLERANCE)
+            samplesPerDispatch = std::min(samplesPerDispatch * 2, m_Config.MaxSamplesPerDispatch);
+    }
+
+    if (chunkCount == oldChunkCount && samplesPerDispatch == oldSamples)
+        return false;
+
+    // Old measurements don't say anything about the new split
+    Reset();
+    return true;
+}
+
+void TileScheduler::SetTargetDispatchTime(float milliseconds)
+{
+    m_Config.TargetDispatchTime = milliseconds;
+}
+
+void TileScheduler::Reset()
+{
+    m_AverageSampleTime = 0.0f;
+    m_MeasuredDispatches = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// Picks how the work of a single accumulated frame is split so that each dispatch takes roughly the target time.
+// Dispatches that are too slow get fewer samples or are split into more screen chunks, fast ones are merged back together.
+// Times come from GPU timestamps around the dispatches. They arrive a few frames late, so every time is stored as the cost
+// of a single sample of the whole screen and scaled back to the split it's compared against.
+class TileScheduler
+{
+public:
+    struct Config
+    {
+        float TargetDispatchTime = 16.0f; // In milliseconds
+        uint32_t MaxChunkCount = 4; // Same as the range of the split screen count in the editor
+        uint32_t MaxSamplesPerDispatch = 64;
+    };
+
+    TileScheduler() = default;
+
+    [[nodiscard]] static TileScheduler New(const Config& config);
+
+    // Dispatches with more samples weigh more, the same as the same amount of single sample dispatches would
+    void AddDispatchTime(float milliseconds, uint32_t chunkCount, uint32_t samplesPerDispatch);
+
+    // Has to be called only between frames, changing the chunk count in the middle of a frame would skip pixels.
+    // Returns true if chunk count or samples per dispatch changed
+    bool Update(uint32_t& chunkCount, uint32_t& samplesPerDispatch, bool allowSampleCountChange);
+
+    void SetTargetDispatchTime(float milliseconds);
+
+    // Forgets the measured times, used when the work per dispatch changes for other reasons
+    void Reset();
+
+    [[nodiscard]] inline float GetTargetDispatchTime() const { return m_Config.TargetDispatchTime; }
+    [[nodiscard]] float GetAverageDispatchTime(uint32_t chunkCount, uint32_t samplesPerDispatch) const;
+
+private:
+    constexpr static uint32_t MIN_MEASURED_DISPATCHES = 4; // Before any decision is made, the first dispatches after a change are often outliers
+    constexpr static float AVERAGE_WEIGHT = 0.25f; // Of a single sample dispatch
+    constexpr static float SLOW_TOLERANCE = 1.2f; // Dispatches this much slower than the target are split
+    constexpr static float FAST_TOLERANCE = 0.9f; // Dispatches are merged only if the merged one is predicted to be this much faster than the target
+
+    Config m_Config;
+    float m_AverageSampleTime = 0.0f; // Of a single sample of the whole screen
+    uint32_t m_MeasuredDispatches = 0;
+};
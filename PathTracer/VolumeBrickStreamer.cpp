@@ -0,0 +1,393 @@
+#include "VolumeBrickStreamer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "Log/Log.h"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& filepath)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_FileHandle = file;
+    m_MappingHandle = mapping;
+    m_Data = (const uint8_t*)data;
+    m_Size = (uint64_t)size.QuadPart;
+#else
+    int fileDescriptor = open(filepath.c_str(), O_RDONLY);
+    if (fileDescriptor == -1)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fileDescriptor);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fileDescriptor);
+        return false;
+    }
+
+    // Bricks are read in whatever order rays request them
+    madvise(data, (size_t)fileStat.st_size, MADV_RANDOM);
+
+    m_FileDescriptor = fileDescriptor;
+    m_Data = (const uint8_t*)data;
+    m_Size = (uint64_t)fileStat.st_size;
+#endif
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_Data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_Data);
+    CloseHandle((HANDLE)m_MappingHandle);
+    CloseHandle((HANDLE)m_FileHandle);
+    m_MappingHandle = nullptr;
+    m_FileHandle = nullptr;
+#else
+    munmap((void*)m_Data, (size_t)m_Size);
+    close(m_FileDescriptor);
+    m_FileDescriptor = -1;
+#endif
+
+    m_Data = nullptr;
+    m_Size = 0;
+}
+
+std::shared_ptr<VolumeBrickStreamer> VolumeBrickStreamer::New(const Config& config)
+{
+    std::shared_ptr<VolumeBrickStreamer> streamer(new VolumeBrickStreamer());
+    streamer->m_Device = config.Device;
+
+    if (!streamer->m_File.Open(config.CacheFilepath))
+    {
+        VH_LOG_ERROR("Failed to map volume brick file: {}", config.CacheFilepath);
+        return nullptr;
+    }
+
+    const uint8_t* fileData = streamer->m_File.GetData();
+    uint64_t fileSize = streamer->m_File.GetSize();
+    if (fileSize < sizeof(FileHeader))
+    {
+        VH_LOG_ERROR("Volume brick file is too small: {}", config.CacheFilepath);
+        return nullptr;
+    }
+
+    FileHeader& header = streamer->m_Header;
+    std::memcpy(&header, fileData, sizeof(FileHeader));
+    if (header.Magic != FILE_MAGIC || header.Version != FILE_VERSION)
+    {
+        VH_LOG_ERROR("Volume brick file has invalid header: {}", config.CacheFilepath);
+        return nullptr;
+    }
+
+    streamer->m_BrickCount = (header.VoxelCount + glm::uvec3(BRICK_SIZE - 1)) / glm::uvec3(BRICK_SIZE);
+    streamer->m_TotalBrickCount = streamer->m_BrickCount.x * streamer->m_BrickCount.y * streamer->m_BrickCount.z;
+
+    const uint64_t brickBytes = sizeof(float) * BRICK_VOXEL_COUNT;
+    const uint64_t maxDensitiesBytes = sizeof(float) * 32768;
+    bool sectionsValid = header.BrickDataOffset + header.StoredBrickCount * brickBytes <= fileSize
+        && header.PageTableOffset + streamer->m_TotalBrickCount * sizeof(FilePageTableEntry) <= fileSize
+        && header.MaxDensitiesOffset + maxDensitiesBytes <= fileSize;
+    if (!sectionsValid)
+    {
+        VH_LOG_ERROR("Volume brick file is truncated: {}", config.CacheFilepath);
+        return nullptr;
+    }
+
+    // Page table and max densities are small compared to the bricks so they're read into memory right away
+    streamer->m_FileBrickIndices.resize(streamer->m_TotalBrickCount);
+    streamer->m_PageTable.resize(streamer->m_TotalBrickCount);
+    const FilePageTableEntry* filePageTable = (const FilePageTableEntry*)(fileData + header.PageTableOffset);
+    for (uint32_t i = 0; i < streamer->m_TotalBrickCount; i++)
+    {
+        streamer->m_FileBrickIndices[i] = filePageTable[i].BrickIndex;
+        streamer->m_PageTable[i].PoolSlot = filePageTable[i].BrickIndex == BRICK_EMPTY ? BRICK_EMPTY : BRICK_NOT_RESIDENT;
+        streamer->m_PageTable[i].AverageDensity = filePageTable[i].AverageDensity;
+    }
+
+    streamer->m_MaxDensities.resize(32768);
+    std::memcpy(streamer->m_MaxDensities.data(), fileData + header.MaxDensitiesOffset, maxDensitiesBytes);
+
+    // Pool doesn't have to be bigger than the whole grid
+    uint64_t poolSize = glm::min(config.PoolSize, GetMaxPoolSize(config.Device));
+    uint32_t poolCapacity = (uint32_t)glm::min(poolSize / brickBytes, (uint64_t)header.StoredBrickCount);
+    poolCapacity = glm::max(poolCapacity, 1u);
+    streamer->m_PoolSlotBricks.resize(poolCapacity, BRICK_EMPTY);
+    streamer->m_PoolSlotLastUsed.resize(poolCapacity, 0);
+    streamer->m_FreePoolSlots.reserve(poolCapacity);
+    for (int i = (int)poolCapacity - 1; i >= 0; i--)
+        streamer->m_FreePoolSlots.push_back((uint32_t)i);
+
+    VulkanHelper::Buffer::Config bufferConfig{};
+    bufferConfig.Device = config.Device;
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT | VulkanHelper::Buffer::Usage::TRANSFER_DST_BIT;
+
+    bufferConfig.Size = sizeof(PageTableEntry) * (uint64_t)streamer->m_TotalBrickCount;
+    bufferConfig.DebugName = "Volume Brick Page Table";
+    streamer->m_PageTableBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Size = brickBytes * poolCapacity;
+    bufferConfig.DebugName = "Volume Brick Pool";
+    streamer->m_BrickPoolBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    bufferConfig.Size = sizeof(uint32_t) * (uint64_t)((streamer->m_TotalBrickCount + 31) / 32);
+    bufferConfig.Usage = VulkanHelper::Buffer::Usage::STORAGE_BUFFER_BIT;
+    bufferConfig.CpuMapable = true;
+    bufferConfig.DebugName = "Volume Brick Feedback";
+    streamer->m_FeedbackBuffer = VulkanHelper::Buffer::New(bufferConfig).Value();
+
+    void* feedback = streamer->m_FeedbackBuffer.Map().Value();
+    std::memset(feedback, 0, bufferConfig.Size);
+    streamer->m_FeedbackBuffer.Unmap();
+
+    VH_LOG_DEBUG("Volume brick streaming: {} of {} bricks stored, pool holds {} bricks ({} MB)", header.StoredBrickCount, streamer->m_TotalBrickCount, poolCapacity, (float)(brickBytes * poolCapacity) / (1024.0f * 1024.0f));
+
+    return streamer;
+}
+
+void VolumeBrickStreamer::UploadPageTable(VulkanHelper::CommandBuffer commandBuffer)
+{
+    VulkanHelper::Buffer::Config stagingBufferConfig{};
+    stagingBufferConfig.Device = m_Device;
+    stagingBufferConfig.Size = sizeof(PageTableEntry) * (uint64_t)m_PageTable.size();
+    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    stagingBufferConfig.CpuMapable = true;
+    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
+
+    VH_ASSERT(stagingBuffer.UploadData(m_PageTable.data(), stagingBufferConfig.Size, 0) == VulkanHelper::VHResult::OK, "Failed to upload volume brick page table");
+    VH_ASSERT(m_PageTableBuffer.CopyFromBuffer(commandBuffer, stagingBuffer, 0, 0, stagingBufferConfig.Size) == VulkanHelper::VHResult::OK, "Failed to copy volume brick page table");
+
+    m_PageTableBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT,
+        VulkanHelper::AccessFlags::MEMORY_READ_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    m_PageTableUploaded = true;
+}
+
+bool VolumeBrickStreamer::Update(VulkanHelper::CommandBuffer commandBuffer)
+{
+    if (!m_PageTableUploaded)
+    {
+        UploadPageTable(commandBuffer);
+        return true;
+    }
+
+    m_UpdateCount++;
+
+    // Feedback is read without waiting for the GPU, so it lags a few frames behind and bits set by frames
+    // that are still in flight may get cleared. That's fine, bricks that are still needed get marked again
+    std::vector<uint32_t> requestedBricks;
+    uint32_t* feedback = (uint32_t*)m_FeedbackBuffer.Map().Value();
+    uint32_t feedbackWordCount = (m_TotalBrickCount + 31) / 32;
+    for (uint32_t word = 0; word < feedbackWordCount; word++)
+    {
+        uint32_t bits = feedback[word];
+        if (bits == 0)
+            continue;
+
+        feedback[word] = 0;
+        while (bits != 0)
+        {
+            uint32_t brick = word * 32 + (uint32_t)std::countr_zero(bits);
+            bits &= bits - 1;
+
+            const PageTableEntry& entry = m_PageTable[brick];
+            if (entry.PoolSlot == BRICK_EMPTY)
+                continue;
+
+            if (entry.PoolSlot == BRICK_NOT_RESIDENT)
+                requestedBricks.push_back(brick);
+            else
+                m_PoolSlotLastUsed[entry.PoolSlot] = m_UpdateCount;
+        }
+    }
+    m_FeedbackBuffer.Unmap();
+
+    if (requestedBricks.empty())
+        return false;
+
+    if (requestedBricks.size() > MAX_BRICK_UPLOADS_PER_UPDATE)
+        requestedBricks.resize(MAX_BRICK_UPLOADS_PER_UPDATE);
+
+    // Only bricks that weren't touched recently can be evicted, least recently used go first
+    std::vector<uint32_t> evictionCandidates;
+    if (m_FreePoolSlots.size() < requestedBricks.size())
+    {
+        for (uint32_t slot = 0; slot < (uint32_t)m_PoolSlotBricks.size(); slot++)
+        {
+            if (m_PoolSlotBricks[slot] != BRICK_EMPTY && m_PoolSlotLastUsed[slot] + EVICTION_GRACE_UPDATES < m_UpdateCount)
+                evictionCandidates.push_back(slot);
+        }
+
+        std::sort(evictionCandidates.begin(), evictionCandidates.end(), [this](uint32_t a, uint32_t b) { return m_PoolSlotLastUsed[a] > m_PoolSlotLastUsed[b]; });
+    }
+
+    struct BrickUpload
+    {
+        uint32_t Brick;
+        uint32_t PoolSlot;
+    };
+    std::vector<BrickUpload> uploads;
+    std::vector<uint32_t> changedPageTableEntries;
+    uploads.reserve(requestedBricks.size());
+
+    for (uint32_t brick : requestedBricks)
+    {
+        uint32_t slot;
+        if (!m_FreePoolSlots.empty())
+        {
+            slot = m_FreePoolSlots.back();
+            m_FreePoolSlots.pop_back();
+        }
+        else if (!evictionCandidates.empty())
+        {
+            slot = evictionCandidates.back();
+            evictionCandidates.pop_back();
+
+            uint32_t evictedBrick = m_PoolSlotBricks[slot];
+            m_PageTable[evictedBrick].PoolSlot = BRICK_NOT_RESIDENT;
+            changedPageTableEntries.push_back(evictedBrick);
+            m_ResidentBrickCount--;
+        }
+        else
+        {
+            break; // Pool is full of bricks that are in use
+        }
+
+        m_PoolSlotBricks[slot] = brick;
+        m_PoolSlotLastUsed[slot] = m_UpdateCount;
+        m_PageTable[brick].PoolSlot = slot;
+        changedPageTableEntries.push_back(brick);
+        m_ResidentBrickCount++;
+
+        uploads.push_back({ brick, slot });
+    }
+
+    if (uploads.empty())
+        return false;
+
+    // Bricks and page table entries are packed into one staging buffer and copied to their places
+    const uint64_t brickBytes = sizeof(float) * BRICK_VOXEL_COUNT;
+    const uint64_t pageTableOffset = brickBytes * uploads.size();
+    std::vector<uint8_t> stagingData(pageTableOffset + sizeof(PageTableEntry) * changedPageTableEntries.size());
+
+    const uint8_t* brickData = m_File.GetData() + m_Header.BrickDataOffset;
+    for (size_t i = 0; i < uploads.size(); i++)
+        std::memcpy(stagingData.data() + brickBytes * i, brickData + brickBytes * m_FileBrickIndices[uploads[i].Brick], brickBytes);
+
+    for (size_t i = 0; i < changedPageTableEntries.size(); i++)
+        std::memcpy(stagingData.data() + pageTableOffset + sizeof(PageTableEntry) * i, &m_PageTable[changedPageTableEntries[i]], sizeof(PageTableEntry));
+
+    VulkanHelper::Buffer::Config stagingBufferConfig{};
+    stagingBufferConfig.Device = m_Device;
+    stagingBufferConfig.Size = stagingData.size();
+    stagingBufferConfig.Usage = VulkanHelper::Buffer::Usage::TRANSFER_SRC_BIT;
+    stagingBufferConfig.CpuMapable = true;
+    VulkanHelper::Buffer stagingBuffer = VulkanHelper::Buffer::New(stagingBufferConfig).Value();
+    VH_ASSERT(stagingBuffer.UploadData(stagingData.data(), stagingData.size(), 0) == VulkanHelper::VHResult::OK, "Failed to upload volume bricks");
+
+    // Evicted slots may still be read by frames in flight, so wait for them before overwriting
+    m_BrickPoolBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::MEMORY_READ_BIT,
+        VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT
+    );
+
+    for (size_t i = 0; i < uploads.size(); i++)
+    {
+        VH_ASSERT(m_BrickPoolBuffer.CopyFromBuffer(commandBuffer, stagingBuffer, brickBytes * i, brickBytes * uploads[i].PoolSlot, brickBytes) == VulkanHelper::VHResult::OK, "Failed to copy volume brick");
+    }
+
+    for (size_t i = 0; i < changedPageTableEntries.size(); i++)
+    {
+        VH_ASSERT(m_PageTableBuffer.CopyFromBuffer(commandBuffer, stagingBuffer, pageTableOffset + sizeof(PageTableEntry) * i, sizeof(PageTableEntry) * changedPageTableEntries[i], sizeof(PageTableEntry)) == VulkanHelper::VHResult::OK, "Failed to copy volume brick page table entry");
+    }
+
+    m_BrickPoolBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT,
+        VulkanHelper::AccessFlags::MEMORY_READ_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+    m_PageTableBuffer.Barrier(
+        commandBuffer,
+        VulkanHelper::AccessFlags::TRANSFER_WRITE_BIT,
+        VulkanHelper::AccessFlags::MEMORY_READ_BIT,
+        VulkanHelper::PipelineStages::TRANSFER_BIT,
+        VulkanHelper::PipelineStages::RAY_TRACING_SHADER_BIT_KHR | VulkanHelper::PipelineStages::COMPUTE_SHADER_BIT
+    );
+
+    return true;
+}
+
+uint64_t VolumeBrickStreamer::GetMaxPoolSize(VulkanHelper::Device device)
+{
+    return glm::min((uint64_t)device.GetMaxStorageBufferRange(), 4ull * 1024 * 1024 * 1024);
+}
+
+uint64_t VolumeBrickStreamer::GetGpuMemorySize() const
+{
+    return m_PageTableBuffer.GetSize() + m_BrickPoolBuffer.GetSize() + m_FeedbackBuffer.GetSize() + sizeof(float) * m_MaxDensities.size();
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "VulkanHelper.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] bool Open(const std::string& filepath);
+    void Close();
+
+    [[nodiscard]] inline const uint8_t* GetData() const { return m_Data; }
+    [[nodiscard]] inline uint64_t GetSize() const { return m_Size; }
+
+private:
+    const uint8_t* m_Data = nullptr;
+    uint64_t m_Size = 0;
+
+#ifdef _WIN32
+    void* m_FileHandle = nullptr;
+    void* m_MappingHandle = nullptr;
+#else
+    int m_FileDescriptor = -1;
+#endif
+};
+
+// Out of core representation of a density grid for volumes that don't fit into VRAM. The grid is split into
+// 8x8x8 voxel bricks stored in a cache file that's memory mapped, and only the bricks that rays actually touch
+// are copied into a fixed size brick pool on the GPU. Shaders find bricks through a page table and mark every
+// brick they touch in a feedback bitmask, which is read back to decide what to stream in and what to evict.
+// Until a brick is resident its average density is used instead.
+class VolumeBrickStreamer
+{
+public:
+    constexpr static uint32_t BRICK_SIZE = 8;
+    constexpr static uint32_t BRICK_VOXEL_COUNT = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+    constexpr static uint32_t BRICK_EMPTY = 0xFFFFFFFF; // Brick has no density at all, it's never streamed
+    constexpr static uint32_t BRICK_NOT_RESIDENT = 0xFFFFFFFE;
+    constexpr static uint32_t FILE_MAGIC = 0x4B524256; // "VBRK"
+    constexpr static uint32_t FILE_VERSION = 1;
+
+    // Layout of the brick cache file: header, non empty bricks one after another, page table and max densities
+    struct FileHeader
+    {
+        uint32_t Magic = FILE_MAGIC;
+        uint32_t Version = FILE_VERSION;
+        glm::uvec3 VoxelCount = glm::uvec3(0);
+        uint32_t StoredBrickCount = 0;
+        glm::vec3 CornerMin = glm::vec3(-1.0f);
+        float MaxDensityInTheGrid = 0.0f;
+        glm::vec3 CornerMax = glm::vec3(1.0f);
+        uint32_t Padding = 0;
+        uint64_t BrickDataOffset = 0;
+        uint64_t PageTableOffset = 0;    // FilePageTableEntry for every brick
+        uint64_t MaxDensitiesOffset = 0; // 32x32x32 floats, same as for regular grids
+    };
+
+    struct FilePageTableEntry
+    {
+        uint32_t BrickIndex; // Index of the brick in the file, BRICK_EMPTY if there's no density
+        float AverageDensity;
+    };
+
+    // Same layout as on the GPU, PoolSlot is either index into the brick pool, BRICK_EMPTY or BRICK_NOT_RESIDENT
+    struct PageTableEntry
+    {
+        uint32_t PoolSlot;
+        float AverageDensity;
+    };
+
+    struct Config
+    {
+        VulkanHelper::Device Device;
+        std::string CacheFilepath;
+        uint64_t PoolSize = 1024ull * 1024 * 1024; // Brick pool is never bigger than that
+    };
+
+    // Returns nullptr if the cache file is missing or invalid
+    [[nodiscard]] static std::shared_ptr<VolumeBrickStreamer> New(const Config& config);
+
+    // Whole pool is bound as a single storage buffer and indexed with 32 bit voxel indices in the shaders
+    [[nodiscard]] static uint64_t GetMaxPoolSize(VulkanHelper::Device device);
+
+    // Reads the feedback from previous frames, evicts bricks that weren't touched for a while and uploads
+    // requested ones. Returns true if any brick was uploaded, so the rendered image changed
+    bool Update(VulkanHelper::CommandBuffer commandBuffer);
+
+    [[nodiscard]] inline const FileHeader& GetHeader() const { return m_Header; }
+    [[nodiscard]] inline glm::uvec3 GetBrickCount() const { return m_BrickCount; }
+    [[nodiscard]] inline const std::vector<float>& GetMaxDensities() const { return m_MaxDensities; }
+    [[nodiscard]] inline VulkanHelper::Buffer GetPageTableBuffer() const { return m_PageTableBuffer; }
+    [[nodiscard]] inline VulkanHelper::Buffer GetBrickPoolBuffer() const { return m_BrickPoolBuffer; }
+    [[nodiscard]] inline VulkanHelper::Buffer GetFeedbackBuffer() const { return m_FeedbackBuffer; }
+    [[nodiscard]] inline uint32_t GetPoolCapacity() const { return (uint32_t)m_PoolSlotBricks.size(); }
+    [[nodiscard]] inline uint32_t GetResidentBrickCount() const { return m_ResidentBrickCount; }
+    [[nodiscard]] inline uint32_t GetStoredBrickCount() const { return m_Header.StoredBrickCount; }
+    [[nodiscard]] uint64_t GetGpuMemorySize() const;
+
+private:
+    VolumeBrickStreamer() = default;
+
+    void UploadPageTable(VulkanHelper::CommandBuffer commandBuffer);
+
+    // Bricks touched within this many updates are never evicted, that way the pool doesn't thrash when the
+    // working set is bigger than the pool, the missing bricks just keep using their average density
+    constexpr static uint64_t EVICTION_GRACE_UPDATES = 8;
+    constexpr static uint32_t MAX_BRICK_UPLOADS_PER_UPDATE = 4096; // 8 MB
+
+    VulkanHelper::Device m_Device;
+    MappedFile m_File;
+    FileHeader m_Header;
+    glm::uvec3 m_BrickCount = glm::uvec3(0);
+    uint32_t m_TotalBrickCount = 0;
+
+    std::vector<uint32_t> m_FileBrickIndices; // Index of each brick in the file
+    std::vector<PageTableEntry> m_PageTable;
+    std::vector<float> m_MaxDensities;
+
+    std::vector<uint32_t> m_PoolSlotBricks; // Brick stored in each pool slot, BRICK_EMPTY if free
+    std::vector<uint64_t> m_PoolSlotLastUsed;
+    std::vector<uint32_t> m_FreePoolSlots;
+    uint32_t m_ResidentBrickCount = 0;
+    uint64_t m_UpdateCount = 0;
+    bool m_PageTableUploaded = false;
+
+    VulkanHelper::Buffer m_PageTableBuffer;
+    VulkanHelper::Buffer m_BrickPoolBuffer;
+    VulkanHelper::Buffer m_FeedbackBuffer; // One bit per brick, cpu mapable so it can be read without stalling
+};
@@ -0,0 +1,186 @@
+#include "VolumeGridManager.h"
+
+#include "Log/Log.h"
+
+VolumeGridManager VolumeGridManager::New(uint32_t slotCount, uint64_t memoryBudget)
+{
+    VolumeGridManager manager{};
+    manager.m_Slots.resize(slotCount);
+    manager.m_MemoryBudget = memoryBudget;
+
+    // Reversed so that slots are handed out starting from 0
+    manager.m_FreeSlots.reserve(slotCount);
+    for (int i = (int)slotCount - 1; i >= 0; i--)
+        manager.m_FreeSlots.push_back(i);
+
+    return manager;
+}
+
+int VolumeGridManager::Allocate(const std::string& key, uint64_t size)
+{
+    if (!EvictUntilFits(size))
+    {
+        VH_LOG_WARN("Volume grid of size {} MB doesn't fit into the VRAM budget of {} MB, loading it anyway", (float)size / (1024.0f * 1024.0f), (float)m_MemoryBudget / (1024.0f * 1024.0f));
+    }
+
+    if (m_FreeSlots.empty())
+    {
+        int slotToEvict = FindLeastRecentlyUsedUnreferenced();
+        if (slotToEvict == -1)
+        {
+            VH_LOG_ERROR("All {} volume grid slots are in use by the scene", m_Slots.size());
+            return -1;
+        }
+
+        VH_LOG_DEBUG("Evicting volume grid from slot {}: {}", slotToEvict, m_Slots[(size_t)slotToEvict].Key);
+        Free(slotToEvict);
+    }
+
+    int slotIndex = m_FreeSlots.back();
+    m_FreeSlots.pop_back();
+
+    Slot& slot = m_Slots[(size_t)slotIndex];
+    slot.Key = key;
+    slot.Size = size;
+    slot.ReferenceCount = 1;
+    slot.LastUsed = ++m_UseCounter;
+    slot.Resident = true;
+    m_UsedMemory += size;
+
+    return slotIndex;
+}
+
+int VolumeGridManager::Acquire(const std::string& key)
+{
+    if (key.empty())
+        return -1;
+
+    for (size_t i = 0; i < m_Slots.size(); i++)
+    {
+        if (m_Slots[i].Resident && m_Slots[i].Key == key)
+        {
+            m_Slots[i].ReferenceCount++;
+            m_Slots[i].LastUsed = ++m_UseCounter;
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+void VolumeGridManager::AddReference(int slot)
+{
+    if (slot < 0 || slot >= (int)m_Slots.size() || m_Slots[(size_t)slot].ReferenceCount == 0)
+    {
+        VH_LOG_WARN("Adding reference to volume grid slot {} that isn't referenced", slot);
+        return;
+    }
+
+    m_Slots[(size_t)slot].ReferenceCount++;
+    m_Slots[(size_t)slot].LastUsed = ++m_UseCounter;
+}
+
+void VolumeGridManager::Release(int slot)
+{
+    if (slot < 0 || slot >= (int)m_Slots.size() || m_Slots[(size_t)slot].ReferenceCount == 0)
+    {
+        VH_LOG_WARN("Releasing volume grid slot {} that isn't referenced", slot);
+        return;
+    }
+
+    Slot& slotData = m_Slots[(size_t)slot];
+    slotData.ReferenceCount--;
+    slotData.LastUsed = ++m_UseCounter;
+
+    // Grids without a key can't be found again, so there's no point in keeping them around
+    if (slotData.ReferenceCount == 0 && slotData.Key.empty())
+        Free(slot);
+}
+
+void VolumeGridManager::SetGrid(int slot, const GridBuffers& buffers, const GridInfo& info, uint64_t size)
+{
+    Slot& slotData = m_Slots[(size_t)slot];
+    m_UsedMemory -= slotData.Size;
+    m_UsedMemory += size;
+
+    slotData.Buffers = buffers;
+    slotData.Info = info;
+    slotData.Size = size;
+    slotData.LastUsed = ++m_UseCounter;
+
+    // This slot is referenced so it won't evict itself
+    if (!EvictUntilFits(0))
+    {
+        VH_LOG_WARN("Volume grids in use take {} MB which is over the VRAM budget of {} MB", (float)m_UsedMemory / (1024.0f * 1024.0f), (float)m_MemoryBudget / (1024.0f * 1024.0f));
+    }
+}
+
+void VolumeGridManager::SetMemoryBudget(uint64_t budget)
+{
+    m_MemoryBudget = budget;
+    EvictUntilFits(0);
+}
+
+uint32_t VolumeGridManager::GetResidentGridCount() const
+{
+    uint32_t count = 0;
+    for (const auto& slot : m_Slots)
+    {
+        if (slot.Resident)
+            count++;
+    }
+
+    return count;
+}
+
+uint32_t VolumeGridManager::GetReferencedGridCount() const
+{
+    uint32_t count = 0;
+    for (const auto& slot : m_Slots)
+    {
+        if (slot.Resident && slot.ReferenceCount > 0)
+            count++;
+    }
+
+    return count;
+}
+
+void VolumeGridManager::Free(int slot)
+{
+    m_UsedMemory -= m_Slots[(size_t)slot].Size;
+
+    // Buffers are destroyed with a frame delay, so it's fine if frames in flight still read them
+    m_Slots[(size_t)slot] = Slot{};
+    m_FreeSlots.push_back(slot);
+}
+
+bool VolumeGridManager::EvictUntilFits(uint64_t size)
+{
+    while (m_UsedMemory + size > m_MemoryBudget)
+    {
+        int slotToEvict = FindLeastRecentlyUsedUnreferenced();
+        if (slotToEvict == -1)
+            return false;
+
+        VH_LOG_DEBUG("Evicting volume grid from slot {} to stay in VRAM budget: {}", slotToEvict, m_Slots[(size_t)slotToEvict].Key);
+        Free(slotToEvict);
+    }
+
+    return true;
+}
+
+int VolumeGridManager::FindLeastRecentlyUsedUnreferenced() const
+{
+    int leastRecentlyUsed = -1;
+    for (size_t i = 0; i < m_Slots.size(); i++)
+    {
+        const Slot& slot = m_Slots[i];
+        if (!slot.Resident || slot.ReferenceCount > 0)
+            continue;
+
+        if (leastRecentlyUsed == -1 || slot.LastUsed < m_Slots[(size_t)leastRecentlyUsed].LastUsed)
+            leastRecentlyUsed = (int)i;
+    }
+
+    return leastRecentlyUsed;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "VulkanHelper.h"
+#include "VolumeBrickStreamer.h"
+
+#include <string>
+#include <vector>
+
+// Keeps track of which heterogeneous volume grids live in which descriptor slot and how much VRAM they take.
+// Grids are reference counted by the volumes in the scene. When nothing references a grid
+// it stays resident so it can be reused without reloading, until it gets evicted (least recently used first)
+// because the slots or the memory budget ran out.
+class VolumeGridManager
+{
+public:
+    struct GridBuffers
+    {
+        VulkanHelper::Buffer Density;
+        VulkanHelper::Buffer Temperature; // Can be null
+        VulkanHelper::Buffer MaxDensities;
+        std::shared_ptr<VolumeBrickStreamer> BrickStreamer; // Set if the grid is streamed, density buffer is null then
+    };
+
+    // Data needed to restore a volume from a resident grid without reloading the file
+    struct GridInfo
+    {
+        glm::vec3 CornerMin = glm::vec3(-1.0f);
+        glm::vec3 CornerMax = glm::vec3(1.0f);
+        float MaxDensityInTheGrid = 0.0f;
+    };
+
+    VolumeGridManager() = default;
+
+    [[nodiscard]] static VolumeGridManager New(uint32_t slotCount, uint64_t memoryBudget);
+
+    // Reserves a slot for a grid of a given size, evicting unreferenced grids if needed. Returned slot
+    // already has one reference. Grids with empty key are never reused and are freed as soon as they're released.
+    // Returns -1 if there's no free slot even after evicting everything that can be evicted.
+    [[nodiscard]] int Allocate(const std::string& key, uint64_t size);
+
+    // Returns the slot of a resident grid with the given key and adds a reference to it, -1 if not resident
+    [[nodiscard]] int Acquire(const std::string& key);
+
+    // Adds a reference to a slot that's already referenced, used when volumes are copied
+    void AddReference(int slot);
+    void Release(int slot);
+
+    // Replaces buffers in the slot, used for sequences that reuse the same slot for every frame
+    void SetGrid(int slot, const GridBuffers& buffers, const GridInfo& info, uint64_t size);
+
+    void SetMemoryBudget(uint64_t budget);
+
+    [[nodiscard]] inline const GridBuffers& GetBuffers(int slot) const { return m_Slots[(size_t)slot].Buffers; }
+    [[nodiscard]] inline const GridInfo& GetInfo(int slot) const { return m_Slots[(size_t)slot].Info; }
+    [[nodiscard]] inline uint64_t GetMemoryBudget() const { return m_MemoryBudget; }
+    [[nodiscard]] inline uint64_t GetUsedMemory() const { return m_UsedMemory; }
+    [[nodiscard]] inline uint32_t GetSlotCount() const { return (uint32_t)m_Slots.size(); }
+    [[nodiscard]] uint32_t GetResidentGridCount() const;
+    [[nodiscard]] uint32_t GetReferencedGridCount() const;
+
+private:
+    struct Slot
+    {
+        std::string Key;
+        GridBuffers Buffers;
+        GridInfo Info;
+        uint64_t Size = 0;
+        uint32_t ReferenceCount = 0;
+        uint64_t LastUsed = 0;
+        bool Resident = false;
+    };
+
+    void Free(int slot);
+
+    // Evicts unreferenced grids until the requested size fits into the budget. Returns false if it doesn't fit anyway
+    bool EvictUntilFits(uint64_t size);
+    int FindLeastRecentlyUsedUnreferenced() const;
+
+    std::vector<Slot> m_Slots;
+    std::vector<int> m_FreeSlots;
+    uint64_t m_MemoryBudget = 0;
+    uint64_t m_UsedMemory = 0;
+    uint64_t m_UseCounter = 0;
+};